@@ -0,0 +1,438 @@
+/*  Intersection microbenchmark. Builds a synthetic scene, generates coherent
+    camera rays and incoherent bounce rays and measures the throughput of the
+    primitive intersection routines, of `closest_obj` with and without the
+    scene BVH and of `occluded`. Results are written as JSON so they can be
+    compared across builds:
+
+      pathtracer_bench --device cpu --triangles 200000 --output bench.json */
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <sycl/sycl.hpp>
+
+#include "include/camera.h"
+#include "include/object.h"
+#include "include/ray.h"
+#include "include/utils.h"
+
+/* Work group size of the benchmark kernels */
+const int kBenchGroupSize = 64;
+
+namespace {
+struct BenchOptions {
+  std::string device = "default";
+  /* Scene size for `closest_obj` */
+  int spheres = 32;
+  int planes = 2;
+  int triangles = 100000;
+  /* Primitives every ray is tested against in the per primitive benchmarks */
+  int primitives = 64;
+  /* Camera resolution, one ray per pixel */
+  int width = 512;
+  int height = 256;
+  /* Timed runs per benchmark, the median is reported */
+  int repeat = 5;
+  unsigned seed = 1;
+  /* JSON output file, stdout if empty */
+  std::string output;
+};
+
+struct BenchResult {
+  std::string kernel;
+  std::string distribution;
+  std::size_t rays;
+  std::size_t primitives; /* Tested per ray, 0 for whole scene queries */
+  double seconds;
+};
+
+void PrintUsage(const char* program) {
+  printf("Usage: %s [options]\n"
+         "  --device NAME       SYCL device: default, cpu or gpu\n"
+         "  --spheres N         Spheres in the closest_obj scene\n"
+         "  --planes N          Planes in the closest_obj scene\n"
+         "  --triangles N       Mesh triangles in the closest_obj scene\n"
+         "  --primitives N      Primitives per ray in per primitive benchmarks\n"
+         "  --width N           Camera rays per row\n"
+         "  --height N          Camera rays per column\n"
+         "  --repeat N          Timed runs per benchmark\n"
+         "  --seed N            Scene and ray seed\n"
+         "  --output PATH       JSON output file instead of stdout\n",
+         program);
+}
+
+bool ParseBenchOptions(int argc, char** argv, BenchOptions& options) {
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    if (i + 1 >= argc) {
+      PrintUsage(argv[0]);
+      return false;
+    }
+    const char* value = argv[++i];
+
+    char* end;
+    long number = std::strtol(value, &end, 10);
+    bool numeric = *end == '\0' && number >= 0 && number <= 1 << 28;
+
+    if (std::strcmp(arg, "--device") == 0) {
+      options.device = value;
+    } else if (std::strcmp(arg, "--output") == 0) {
+      options.output = value;
+    } else if (!numeric) {
+      printf("Invalid argument: %s %s\n", arg, value);
+      PrintUsage(argv[0]);
+      return false;
+    } else if (std::strcmp(arg, "--spheres") == 0) {
+      options.spheres = number;
+    } else if (std::strcmp(arg, "--planes") == 0) {
+      options.planes = number;
+    } else if (std::strcmp(arg, "--triangles") == 0) {
+      options.triangles = number;
+    } else if (std::strcmp(arg, "--primitives") == 0) {
+      options.primitives = std::max(1L, number);
+    } else if (std::strcmp(arg, "--width") == 0) {
+      options.width = std::max(1L, number);
+    } else if (std::strcmp(arg, "--height") == 0) {
+      options.height = std::max(1L, number);
+    } else if (std::strcmp(arg, "--repeat") == 0) {
+      options.repeat = std::max(1L, number);
+    } else if (std::strcmp(arg, "--seed") == 0) {
+      options.seed = number;
+    } else {
+      printf("Invalid argument: %s\n", arg);
+      PrintUsage(argv[0]);
+      return false;
+    }
+  }
+  return true;
+}
+
+sycl::nd_range<1> RayRange(std::size_t count) {
+  std::size_t groups = (count + kBenchGroupSize - 1) / kBenchGroupSize;
+  return sycl::nd_range<1>{sycl::range<1>{groups * kBenchGroupSize},
+                           sycl::range<1>{kBenchGroupSize}};
+}
+
+/* Median wall clock time of `repeat` runs of `launch` after one warmup run */
+template <typename F>
+double Time(F&& launch, int repeat) {
+  launch();
+  std::vector<double> times;
+  for (int i = 0; i < repeat; i++) {
+    auto start = std::chrono::steady_clock::now();
+    launch();
+    auto end = std::chrono::steady_clock::now();
+    times.push_back(std::chrono::duration<double>(end - start).count());
+  }
+  std::sort(times.begin(), times.end());
+  return times[times.size() / 2];
+}
+
+/* Every ray against every primitive in `prims`, the closest distance is
+   written out so nothing gets optimized away */
+template <typename T>
+double TimeIntersect(sycl::queue& q, const T* prims, std::size_t count,
+                     const Ray* rays, std::size_t ray_count, float* out,
+                     int repeat) {
+  return Time([&]() {
+    q.parallel_for(RayRange(ray_count), [=](sycl::nd_item<1> it) {
+      std::size_t i = it.get_global_id(0);
+      if (i >= ray_count) return;
+
+      Hit hit;
+      for (std::size_t k = 0; k < count; k++) {
+        prims[k].Intersect(rays[i], hit);
+      }
+      out[i] = hit.t;
+    }).wait_and_throw();
+  }, repeat);
+}
+
+/*  Closest hits in the whole scene. `linear` tests every object of the
+    scene instead of walking the scene BVH, the baseline the BVH is measured
+    against */
+double TimeClosest(sycl::queue& q,
+                   const containerutils::VariantContainer<Objects>* objects,
+                   const SceneBVH bvh, bool linear, const Ray* rays,
+                   std::size_t ray_count, float* out, int repeat) {
+  return Time([&]() {
+    q.parallel_for(RayRange(ray_count), [=](sycl::nd_item<1> it) {
+      std::size_t i = it.get_global_id(0);
+      if (i >= ray_count) return;
+
+      std::optional<Intersector> hit =
+          linear ? closest_obj(rays[i], *objects)
+                 : closest_obj(rays[i], *objects, bvh);
+      out[i] = hit.has_value() ? hit->t : INFINITY;
+    }).wait_and_throw();
+  }, repeat);
+}
+
+/* Same rays as `TimeClosest` as unbounded occlusion queries */
+double TimeOccluded(sycl::queue& q,
+                    const containerutils::VariantContainer<Objects>* objects,
+                    const SceneBVH bvh, const Ray* rays,
+                    std::size_t ray_count, float* out, int repeat) {
+  return Time([&]() {
+    q.parallel_for(RayRange(ray_count), [=](sycl::nd_item<1> it) {
+      std::size_t i = it.get_global_id(0);
+      if (i >= ray_count) return;
+
+      out[i] = occluded(rays[i], *objects, bvh, INFINITY) ? 1.0f : 0.0f;
+    }).wait_and_throw();
+  }, repeat);
+}
+
+/*  Bounce rays leave the first hit of the camera rays in a uniformly random
+    direction of the hemisphere around the normal. Camera rays that miss are
+    replaced by random rays from inside the scene bounds */
+void GenerateBounceRays(sycl::queue& q,
+                        const containerutils::VariantContainer<Objects>* objects,
+                        const SceneBVH bvh, const bvh::AABB bounds,
+                        unsigned seed, const Ray* camera_rays, Ray* rays,
+                        std::size_t ray_count) {
+  q.parallel_for(RayRange(ray_count), [=](sycl::nd_item<1> it) {
+    std::size_t i = it.get_global_id(0);
+    if (i >= ray_count) return;
+
+    miscutils::PhiloxSampler random(i, seed);
+    sycl::vec<float, 3> dir;
+    do {
+      dir = sycl::vec<float, 3>(random(), random(), random()) * 2.0f - 1.0f;
+    } while (sycl::dot(dir, dir) > 1.0f || sycl::dot(dir, dir) < 1e-6f);
+    dir = sycl::normalize(dir);
+
+    std::optional<Intersector> hit = closest_obj(camera_rays[i], *objects, bvh);
+    Ray ray;
+    if (hit.has_value()) {
+      if (sycl::dot(dir, hit->normal) < 0.0f) dir = -dir;
+      ray.origin = camera_rays[i].origin + camera_rays[i].dir * hit->t +
+                   hit->normal * 1e-3f;
+    } else {
+      sycl::vec<float, 3> r(random(), random(), random());
+      ray.origin = bounds.min + (bounds.max - bounds.min) * r;
+    }
+    ray.dir = dir;
+    rays[i] = ray;
+  }).wait_and_throw();
+}
+
+/* Escapes the characters JSON strings cannot hold verbatim */
+std::string JsonEscape(const std::string& str) {
+  std::string escaped;
+  for (char c : str) {
+    if (c == '"' || c == '\\') escaped += '\\';
+    if ((unsigned char)c >= 0x20) escaped += c;
+  }
+  return escaped;
+}
+
+void WriteJson(FILE* file, const BenchOptions& options,
+               const std::string& device, std::size_t triangles,
+               std::size_t spheres, std::size_t planes,
+               const std::vector<BenchResult>& results) {
+  fprintf(file, "{\n");
+  fprintf(file, "  \"device\": \"%s\",\n", JsonEscape(device).c_str());
+  fprintf(file,
+          "  \"scene\": {\"spheres\": %zu, \"planes\": %zu, \"triangles\": "
+          "%zu},\n",
+          spheres, planes, triangles);
+  fprintf(file, "  \"rays\": %d,\n", options.width * options.height);
+  fprintf(file, "  \"repeat\": %d,\n", options.repeat);
+  fprintf(file, "  \"results\": [\n");
+  for (std::size_t i = 0; i < results.size(); i++) {
+    const BenchResult& r = results[i];
+    double mrays = r.rays / r.seconds * 1e-6;
+    /* Ray-primitive tests only make sense for the per primitive benchmarks */
+    char mtests[32] = "null";
+    if (r.primitives > 0) {
+      snprintf(mtests, sizeof(mtests), "%.3f", mrays * r.primitives);
+    }
+    fprintf(file,
+            "    {\"kernel\": \"%s\", \"distribution\": \"%s\", "
+            "\"primitives\": %zu, \"seconds\": %.6f, \"mrays_per_s\": %.3f, "
+            "\"mtests_per_s\": %s}%s\n",
+            r.kernel.c_str(), r.distribution.c_str(), r.primitives, r.seconds,
+            mrays, mtests, i + 1 < results.size() ? "," : "");
+  }
+  fprintf(file, "  ]\n}\n");
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  BenchOptions options;
+  if (!ParseBenchOptions(argc, argv, options)) {
+    return -1;
+  }
+
+  sycl::device device;
+  try {
+    if (options.device == "cpu") {
+      device = sycl::device(sycl::cpu_selector_v);
+    } else if (options.device == "gpu") {
+      device = sycl::device(sycl::gpu_selector_v);
+    } else {
+      device = sycl::device(sycl::default_selector_v);
+    }
+  } catch (const sycl::exception& e) {
+    printf("SYCL error: No %s device available: %s\n", options.device.c_str(),
+           e.what());
+    return -1;
+  }
+  sycl::queue q(device);
+
+  /* Synthetic scene inside a box in front of the camera */
+  const bvh::AABB bounds(sycl::vec<float, 3>(5.0f, -10.0f, -10.0f),
+                         sycl::vec<float, 3>(25.0f, 10.0f, 10.0f));
+  std::mt19937 rng(options.seed);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  auto random_point = [&]() {
+    sycl::vec<float, 3> r(unit(rng), unit(rng), unit(rng));
+    return bounds.min + (bounds.max - bounds.min) * r;
+  };
+  auto random_dir = [&]() {
+    sycl::vec<float, 3> d(unit(rng) - 0.5f, unit(rng) - 0.5f, unit(rng) - 0.5f);
+    return sycl::normalize(d);
+  };
+
+  std::size_t sphere_count = std::max(options.spheres, options.primitives);
+  std::size_t plane_count = std::max(options.planes, options.primitives);
+  std::vector<Sphere> spheres;
+  for (std::size_t i = 0; i < sphere_count; i++) {
+    spheres.push_back(Sphere(random_point(), 0.1f + unit(rng), 0));
+  }
+  std::vector<Plane> planes;
+  for (std::size_t i = 0; i < plane_count; i++) {
+    planes.push_back(Plane(random_point(), random_dir(), 0));
+  }
+
+  /* Triangle soup of small random triangles */
+  std::size_t triangle_count =
+      std::max<std::size_t>(std::max(options.triangles, options.primitives), 1);
+  std::vector<sycl::vec<float, 3>> vertices;
+  std::vector<uint32_t> indices;
+  for (std::size_t i = 0; i < triangle_count; i++) {
+    sycl::vec<float, 3> a = random_point();
+    for (int k = 0; k < 3; k++) {
+      indices.push_back(vertices.size());
+      vertices.push_back(k == 0 ? a : a + random_dir() * 0.5f);
+    }
+  }
+  std::optional<Mesh> mesh = Mesh::Create(
+      q, vertices, indices, std::vector<material::Id>(triangle_count, 0));
+  if (!mesh.has_value()) {
+    printf("Could not create the benchmark mesh\n");
+    return -1;
+  }
+
+  /* Primitive arrays for the per primitive benchmarks */
+  std::size_t primitives = options.primitives;
+  Sphere* sphere_array = sycl::malloc_shared<Sphere>(primitives, q);
+  Plane* plane_array = sycl::malloc_shared<Plane>(primitives, q);
+  MeshTriangle* triangle_array = sycl::malloc_shared<MeshTriangle>(primitives, q);
+  for (std::size_t i = 0; i < primitives; i++) {
+    new (&sphere_array[i]) Sphere(spheres[i]);
+    new (&plane_array[i]) Plane(planes[i]);
+    const sycl::vec<float, 3> &a = vertices[3 * i], &b = vertices[3 * i + 1],
+                              &c = vertices[3 * i + 2];
+    new (&triangle_array[i]) MeshTriangle(
+        a, b, c, sycl::normalize(sycl::cross(b - a, c - a)), 0);
+  }
+
+  /* Whole scene for `closest_obj` */
+  auto* objects =
+      sycl::malloc_shared<containerutils::VariantContainer<Objects>>(1, q);
+  new (objects) containerutils::VariantContainer<Objects>();
+  std::size_t scene_spheres = options.spheres;
+  std::size_t scene_planes = options.planes;
+  objects->Reserve<Sphere>(q, scene_spheres);
+  for (std::size_t i = 0; i < scene_spheres; i++) {
+    objects->push_back(q, spheres[i]);
+  }
+  for (std::size_t i = 0; i < scene_planes; i++) {
+    objects->push_back(q, planes[i]);
+  }
+  if (options.triangles > 0) {
+    objects->push_back(q, *mesh);
+  }
+  SceneBVH bvh = BuildSceneBVH(q, *objects);
+  objects->Freeze(q);
+
+  /* Ray distributions */
+  std::size_t ray_count = (std::size_t)options.width * options.height;
+  Camera* camera = sycl::malloc_shared<Camera>(1, q);
+  new (camera) Camera(sycl::vec<float, 3>(1.0f, 0.0f, 0.0f),
+                      sycl::vec<float, 3>(0.0f, 0.0f, 0.0f),
+                      sycl::vec<float, 3>(0.0f, 0.0f, 1.0f), 90.0f, 1.0f,
+                      options.width, options.height);
+  Ray* camera_rays = sycl::malloc_device<Ray>(ray_count, q);
+  Ray* bounce_rays = sycl::malloc_device<Ray>(ray_count, q);
+  float* out = sycl::malloc_device<float>(ray_count, q);
+
+  const int width = options.width;
+  q.parallel_for(RayRange(ray_count), [=](sycl::nd_item<1> it) {
+    std::size_t i = it.get_global_id(0);
+    if (i >= ray_count) return;
+
+    Ray ray;
+    camera->GenerateRay(i % width, i / width, ray);
+    camera_rays[i] = ray;
+  }).wait_and_throw();
+  GenerateBounceRays(q, objects, bvh, bounds, options.seed, camera_rays,
+                     bounce_rays, ray_count);
+
+  std::vector<BenchResult> results;
+  const std::pair<const char*, const Ray*> distributions[] = {
+      {"coherent", camera_rays}, {"incoherent", bounce_rays}};
+  for (const auto& [distribution, rays] : distributions) {
+    int repeat = options.repeat;
+    results.push_back({"Sphere::Intersect", distribution, ray_count, primitives,
+                       TimeIntersect(q, sphere_array, primitives, rays,
+                                     ray_count, out, repeat)});
+    results.push_back({"Plane::Intersect", distribution, ray_count, primitives,
+                       TimeIntersect(q, plane_array, primitives, rays,
+                                     ray_count, out, repeat)});
+    results.push_back({"MeshTriangle::Intersect", distribution, ray_count,
+                       primitives,
+                       TimeIntersect(q, triangle_array, primitives, rays,
+                                     ray_count, out, repeat)});
+    results.push_back({"closest_obj", distribution, ray_count, 0,
+                       TimeClosest(q, objects, bvh, false, rays, ray_count,
+                                   out, repeat)});
+    results.push_back({"closest_obj_linear", distribution, ray_count, 0,
+                       TimeClosest(q, objects, bvh, true, rays, ray_count,
+                                   out, repeat)});
+    results.push_back({"occluded", distribution, ray_count, 0,
+                       TimeOccluded(q, objects, bvh, rays, ray_count, out,
+                                    repeat)});
+  }
+
+  FILE* file = options.output.empty() ? stdout
+                                      : std::fopen(options.output.c_str(), "w");
+  if (file == nullptr) {
+    printf("Could not open %s\n", options.output.c_str());
+    return -1;
+  }
+  WriteJson(file, options, device.get_info<sycl::info::device::name>(),
+            options.triangles > 0 ? triangle_count : 0, scene_spheres,
+            scene_planes, results);
+  if (file != stdout) std::fclose(file);
+
+  mesh->Free(q);
+  FreeSceneBVH(bvh, q);
+  objects->Free(q);
+  sycl::free(objects, q);
+  sycl::free(sphere_array, q);
+  sycl::free(plane_array, q);
+  sycl::free(triangle_array, q);
+  sycl::free(camera, q);
+  sycl::free(camera_rays, q);
+  sycl::free(bounce_rays, q);
+  sycl::free(out, q);
+  return 0;
+}
@@ -0,0 +1,65 @@
+#ifndef PATHTRACER_INCLUDE_ADAPTIVE_H_
+#define PATHTRACER_INCLUDE_ADAPTIVE_H_
+
+#include <cstdint>
+#include <vector>
+
+#include <sycl/sycl.hpp>
+
+#include "include/render.h"
+
+/* Samples every pixel gets before tiles may be skipped */
+const int kAdaptiveMinSamples = 16;
+/* Samples between two re-evaluations of the active tiles */
+const int kAdaptiveInterval = 8;
+
+namespace render {
+/*  Adaptive sampling over tiles of `kAdaptiveTileSize` pixels. The frame
+    additionally tracks the squared luminance and the sample count of every
+    pixel, `Update` estimates the relative standard error of each pixel mean
+    from them and marks the tiles whose worst pixel is still above the
+    threshold. Only those tiles are sampled by the next batches. Taking the
+    worst pixel keeps single pixels with a lucky, too low variance estimate
+    from stopping early */
+class AdaptiveSampler {
+ private:
+  int width_;
+  int height_;
+  int tiles_x_;
+  int tiles_y_;
+  float threshold_;
+
+  /* Per pixel statistics and per tile decision, in device memory */
+  float* squares_;
+  uint32_t* sample_counts_;
+  uint8_t* active_tiles_;
+  /* Number of active tiles after the last `Update`, in shared memory */
+  uint32_t* active_count_;
+
+ public:
+  /* `threshold` is the relative standard error pixels have to reach */
+  AdaptiveSampler(sycl::queue& q, int width, int height, float threshold);
+
+  void Free(sycl::queue& q);
+
+  /*  Points the adaptive sampling state of `frame` at this sampler. Whenever
+      `frame.executed_samples` is 0 `Reset` has to be called before the
+      batch, the batch itself clears the statistics */
+  void Attach(Frame& frame) const;
+
+  /* Marks all tiles active, `ActiveTiles` is only updated by `Update` */
+  sycl::event Reset(sycl::queue& q,
+                    const std::vector<sycl::event>& depends_on = {});
+
+  /* Re-evaluates the active tiles from the statistics accumulated in `frame` */
+  sycl::event Update(sycl::queue& q, const Frame& frame,
+                     const std::vector<sycl::event>& depends_on = {});
+
+  /* Tiles still above the threshold, valid once `Update` has completed */
+  uint32_t ActiveTiles() const { return *this->active_count_; }
+
+  uint32_t TileCount() const { return this->tiles_x_ * this->tiles_y_; }
+};
+}  // namespace render
+
+#endif
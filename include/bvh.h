@@ -0,0 +1,239 @@
+#ifndef PATHTRACER_INCLUDE_BVH_H_
+#define PATHTRACER_INCLUDE_BVH_H_
+
+#include <cstdint>
+#include <vector>
+
+#include <sycl/sycl.hpp>
+
+#include "include/ray.h"
+
+/* Maximum depth of a built tree, also the size of the traversal stack */
+const int kBVHMaxDepth = 64;
+/* Leaves are only split further when they hold more than this */
+const int kBVHMaxLeafSize = 4;
+/* Number of bins the SAH is evaluated over per axis */
+const int kBVHBins = 16;
+
+namespace bvh {
+/* Axis aligned bounding box, used while building on the host and refitting
+   on the device */
+struct AABB {
+  sycl::vec<float, 3> min{INFINITY, INFINITY, INFINITY};
+  sycl::vec<float, 3> max{-INFINITY, -INFINITY, -INFINITY};
+
+  SYCL_EXTERNAL AABB() {};
+  SYCL_EXTERNAL AABB(sycl::vec<float, 3> min, sycl::vec<float, 3> max)
+      : min(min), max(max) {};
+
+  SYCL_EXTERNAL void Grow(const sycl::vec<float, 3>& point) {
+    this->min = sycl::fmin(this->min, point);
+    this->max = sycl::fmax(this->max, point);
+  }
+
+  SYCL_EXTERNAL void Grow(const AABB& other) {
+    this->min = sycl::fmin(this->min, other.min);
+    this->max = sycl::fmax(this->max, other.max);
+  }
+
+  SYCL_EXTERNAL sycl::vec<float, 3> Centroid() const {
+    return (this->min + this->max) * 0.5f;
+  }
+
+  /* Returns 0 for empty boxes */
+  SYCL_EXTERNAL float SurfaceArea() const {
+    sycl::vec<float, 3> e = this->max - this->min;
+    if (e.x() < 0.0f || e.y() < 0.0f || e.z() < 0.0f) return 0.0f;
+    return 2.0f * (e.x() * e.y() + e.y() * e.z() + e.z() * e.x());
+  }
+};
+
+/*  Flattened tree node, 32 bytes so two nodes share a cache line. Nodes are
+    stored depth first so the left child of an interior node always directly
+    follows its parent:
+      interior: `count == 0`, left child is `this + 1`, right child `offset`
+      leaf:     `count > 0`, primitives `offset .. offset + count - 1`      */
+struct Node {
+  float min[3];
+  uint32_t offset;
+  float max[3];
+  uint32_t count;
+
+  /* Slab test against the ray, `tnear` is set to the entry distance */
+  SYCL_EXTERNAL bool Intersect(const sycl::vec<float, 3>& origin,
+                               const sycl::vec<float, 3>& inv_dir, float tmax,
+                               float& tnear) const {
+    float t0x = (this->min[0] - origin.x()) * inv_dir.x();
+    float t1x = (this->max[0] - origin.x()) * inv_dir.x();
+    float t0y = (this->min[1] - origin.y()) * inv_dir.y();
+    float t1y = (this->max[1] - origin.y()) * inv_dir.y();
+    float t0z = (this->min[2] - origin.z()) * inv_dir.z();
+    float t1z = (this->max[2] - origin.z()) * inv_dir.z();
+
+    tnear = sycl::fmax(sycl::fmax(sycl::fmin(t0x, t1x), sycl::fmin(t0y, t1y)),
+                       sycl::fmax(sycl::fmin(t0z, t1z), 0.0f));
+    float tfar = sycl::fmin(sycl::fmin(sycl::fmax(t0x, t1x), sycl::fmax(t0y, t1y)),
+                            sycl::fmin(sycl::fmax(t0z, t1z), tmax));
+    return tnear <= tfar;
+  }
+};
+
+/* Device view of a flattened tree in shared memory */
+struct BVH {
+  Node* nodes = nullptr;
+  uint32_t node_count = 0;
+
+  /*  Stack based front to back traversal. `leaf` is called as
+      `leaf(primitive, tmax)` for every primitive in a visited leaf and has to
+      shrink `tmax` when it finds a closer hit so farther nodes get culled */
+  template <class F>
+  SYCL_EXTERNAL void Traverse(const Ray& ray, float tmax, F&& leaf) const {
+    if (this->node_count == 0) return;
+
+    sycl::vec<float, 3> inv_dir = 1.0f / ray.dir;
+    float tnear;
+    if (!this->nodes[0].Intersect(ray.origin, inv_dir, tmax, tnear)) return;
+
+    uint32_t stack[kBVHMaxDepth];
+    int top = 0;
+    uint32_t current = 0;
+    while (true) {
+      PATHTRACER_COUNT(ray, nodes_visited, 1);
+      const Node& node = this->nodes[current];
+      if (node.count > 0) {
+        for (uint32_t i = node.offset; i < node.offset + node.count; i++) {
+          leaf(i, tmax);
+        }
+      } else {
+        uint32_t left = current + 1;
+        uint32_t right = node.offset;
+        float tleft, tright;
+        bool hit_left =
+            this->nodes[left].Intersect(ray.origin, inv_dir, tmax, tleft);
+        bool hit_right =
+            this->nodes[right].Intersect(ray.origin, inv_dir, tmax, tright);
+
+        if (hit_left && hit_right) {
+          /* Visit the nearer child first, the farther one might get culled */
+          if (tleft > tright) {
+            uint32_t tmp = left;
+            left = right;
+            right = tmp;
+          }
+          stack[top++] = right;
+          current = left;
+          continue;
+        }
+        if (hit_left || hit_right) {
+          current = hit_left ? left : right;
+          continue;
+        }
+      }
+
+      if (top == 0) break;
+      current = stack[--top];
+    }
+  }
+
+  /*  Any hit traversal for occlusion queries. `leaf` is called as
+      `leaf(primitive)` for the primitives in visited leaves and returns true
+      on a hit closer than `tmax`, which ends the walk. Any hit will do, so
+      children are not ordered by distance. Returns true if `leaf` did */
+  template <class F>
+  SYCL_EXTERNAL bool TraverseAny(const Ray& ray, float tmax, F&& leaf) const {
+    if (this->node_count == 0) return false;
+
+    sycl::vec<float, 3> inv_dir = 1.0f / ray.dir;
+    float tnear;
+    if (!this->nodes[0].Intersect(ray.origin, inv_dir, tmax, tnear)) {
+      return false;
+    }
+
+    uint32_t stack[kBVHMaxDepth];
+    int top = 0;
+    uint32_t current = 0;
+    while (true) {
+      PATHTRACER_COUNT(ray, nodes_visited, 1);
+      const Node& node = this->nodes[current];
+      if (node.count > 0) {
+        for (uint32_t i = node.offset; i < node.offset + node.count; i++) {
+          if (leaf(i)) return true;
+        }
+      } else {
+        uint32_t left = current + 1;
+        uint32_t right = node.offset;
+        float tleft, tright;
+        bool hit_left =
+            this->nodes[left].Intersect(ray.origin, inv_dir, tmax, tleft);
+        bool hit_right =
+            this->nodes[right].Intersect(ray.origin, inv_dir, tmax, tright);
+
+        if (hit_left && hit_right) {
+          stack[top++] = right;
+          current = left;
+          continue;
+        }
+        if (hit_left || hit_right) {
+          current = hit_left ? left : right;
+          continue;
+        }
+      }
+
+      if (top == 0) return false;
+      current = stack[--top];
+    }
+  }
+};
+
+/*  Updates the bounds of a built tree after its primitives moved, keeping
+    its topology. Every level of the tree is refit by one kernel, deepest
+    first, so nodes only read finished children. Trees get looser the farther
+    primitives move from where they were built, `Cost` measures by how much
+    so callers can decide when a rebuild pays off */
+class Refitter {
+ private:
+  /* Node indices grouped by depth, in device memory */
+  uint32_t* levels_ = nullptr;
+  /* Start of every depth in `levels_`, followed by the node count */
+  std::vector<uint32_t> level_offsets_;
+
+  AABB* bounds_ = nullptr; /* Per primitive, in device memory */
+  uint32_t primitive_count_ = 0;
+  float* cost_;            /* Sum of the cost kernel, in shared memory */
+
+ public:
+  /* Reads the topology of `tree`, which no kernel may write meanwhile */
+  Refitter(sycl::queue& q, const BVH& tree);
+
+  void Free(sycl::queue& q);
+
+  /*  Bounds of the primitives in leaf order, the `i` passed to the leaf
+      function of `BVH::Traverse`. Filled by the caller before `Refit` */
+  AABB* PrimitiveBounds() const { return bounds_; }
+  uint32_t PrimitiveCount() const { return primitive_count_; }
+
+  /* Recomputes the node bounds of `tree` from `PrimitiveBounds` */
+  sycl::event Refit(sycl::queue& q, const BVH& tree,
+                    const std::vector<sycl::event>& depends_on = {});
+
+  /*  Surface area heuristic cost of `tree`: the expected traversal steps and
+      primitive tests of a ray through its root. Waits for the device */
+  float Cost(sycl::queue& q, const BVH& tree,
+             const std::vector<sycl::event>& depends_on = {});
+};
+
+/*  Builds a tree over the given primitive bounds with the binned surface area
+    heuristic. `nodes` receives the flattened tree and `order` the primitive
+    indices in leaf order, leaves address primitives through `order`.
+    `leaf_width` is the number of primitives a leaf tests at once, leaves are
+    costed in whole batches of it and may hold `kBVHMaxLeafSize` batches */
+void Build(const std::vector<AABB>& bounds, std::vector<Node>& nodes,
+           std::vector<uint32_t>& order, int leaf_width = 1);
+
+/* Copies host built nodes into shared memory */
+BVH Upload(sycl::queue& q, const std::vector<Node>& nodes);
+
+void Free(BVH& bvh, sycl::queue& q);
+}  // namespace bvh
+
+#endif
@@ -37,9 +37,10 @@ class Camera {
          uint16_t pwidth,
          uint16_t pheight); /* 65536 x 65536 max resolution for fb */
 
-  /* Generates the ray from the given pixel on the image and local work camera
-   * variables */ 
-  SYCL_EXTERNAL void GenerateRay(int w, int h, Ray& ray) const;
+  /* Generates the ray through the given image position in pixels from the
+   * local work camera variables. Fractional positions land inside the pixel,
+   * which is how samples are jittered for antialiasing */
+  SYCL_EXTERNAL void GenerateRay(float w, float h, Ray& ray) const;
 
   void LookAt(sycl::vec<float, 3> dir, const sycl::vec<float, 3>& up);
 
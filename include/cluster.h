@@ -0,0 +1,61 @@
+#ifndef PATHTRACER_INCLUDE_CLUSTER_H_
+#define PATHTRACER_INCLUDE_CLUSTER_H_
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+/*  Sample splitting over worker processes. A coordinator hands every worker
+    a disjoint range of sample indices of the same image, workers render
+    their range with the usual per pixel and per sample seeding and send
+    back the float accumulation, which the coordinator sums up. As samples
+    only depend on their pixel and index, the merged image takes exactly the
+    samples of a single process render.
+
+    Workers and coordinator talk over TCP, on one machine over the loopback
+    interface. Connections are not authenticated, so workers only listen on
+    the loopback interface unless given a host. Messages are raw structs and
+    floats, so all processes have to run on machines of the same byte order */
+namespace cluster {
+/* Work for one worker, samples `first_sample .. first_sample + samples - 1` */
+struct Job {
+  uint32_t width;
+  uint32_t height;
+  /*  Settings and scene the samples are taken with, workers reject jobs that
+      do not match their own so that the merged image stays the one of a
+      single process */
+  uint32_t max_depth;
+  uint32_t sampler;
+  uint32_t nee;
+  float ambient_occlusion;
+  /* `HashFile` of the scene or OBJ file, 0 for the built-in scene */
+  uint64_t scene_hash;
+
+  uint32_t first_sample;
+  uint32_t samples;
+};
+
+/*  FNV-1a hash of the contents of the file at `path`, 0 if it cannot be
+    read */
+uint64_t HashFile(const std::string& path);
+
+/*  Renders `job` into `image`, `width*height*3` sums of the job's samples.
+    Returns false if the job cannot be rendered, e.g. if its size or settings
+    do not match the ones of the worker */
+using JobRenderer = std::function<bool(const Job& job, std::vector<float>& image)>;
+
+/*  Listens on `address` (`host:port`, the loopback interface if the host is
+    empty) and serves the jobs of one coordinator connection after the other.
+    Only returns if the socket cannot be set up, after printing the reason */
+void ServeWorker(const std::string& address, const JobRenderer& render);
+
+/*  Splits `samples` over the workers at `addresses` and sums their images
+    into `image`. `settings` is the job without its sample range. Prints the
+    reason and returns false if a worker cannot be reached or fails its job */
+bool RenderDistributed(const std::vector<std::string>& addresses,
+                       const Job& settings, uint32_t samples,
+                       std::vector<float>& image);
+}  // namespace cluster
+
+#endif
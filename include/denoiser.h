@@ -0,0 +1,63 @@
+#ifndef PATHTRACER_INCLUDE_DENOISER_H_
+#define PATHTRACER_INCLUDE_DENOISER_H_
+
+#include <cstdint>
+#include <vector>
+
+#include <sycl/sycl.hpp>
+
+#include "include/render.h"
+
+/* Filter passes, the last one spans `2^(kDenoiserPasses-1)*2` pixels */
+const int kDenoiserPasses = 5;
+
+namespace render {
+/*  Edge avoiding a-trous wavelet filter (Dammertz et al. 2010) guided by the
+    first hit features of the frame. The irradiance, the pixel color divided
+    by its albedo, is blurred with a 5x5 B3 spline whose taps get sparser
+    every pass, so large radii stay cheap. Each tap is weighted down by its
+    difference to the center in irradiance, normal and depth, so edges and
+    shading boundaries stay sharp. The albedo is multiplied back in
+    afterwards and keeps texture detail out of the blur */
+class Denoiser {
+ private:
+  int width_;
+  int height_;
+
+  /* Feature sums attached to the frame, in device memory */
+  float* albedo_;
+  float* normal_;
+  float* depth_;
+
+  /*  Per pixel means of the features and the irradiance ping pong buffers of
+      the passes, in device memory */
+  sycl::vec<float, 3>* mean_albedo_;
+  sycl::vec<float, 3>* mean_normal_;
+  float* mean_depth_;
+  sycl::vec<float, 3>* irradiance_[2];
+
+ public:
+  Denoiser(sycl::queue& q, int width, int height);
+
+  void Free(sycl::queue& q);
+
+  /* Points the feature buffers of `frame` at this denoiser */
+  void Attach(Frame& frame) const;
+
+  /*  Filters the accumulation of `frame` once `depends_on` completes.
+      `samples` is the number of samples accumulated per pixel, it is
+      ignored if `frame` counts them per pixel. The denoised pixel means are
+      written to `output` (`width*height*3` floats) and the display values
+      to `frame.framebuffer`, either may be `nullptr` */
+  sycl::event Denoise(sycl::queue& q, const Frame& frame, int samples,
+                      float* output,
+                      const std::vector<sycl::event>& depends_on = {});
+
+  /*  Copies the per pixel feature means of the last `Denoise` to the host,
+      the depth repeated in all 3 channels so all are written as images */
+  void ReadFeatures(sycl::queue& q, std::vector<float>& albedo,
+                    std::vector<float>& normal, std::vector<float>& depth);
+};
+}  // namespace render
+
+#endif
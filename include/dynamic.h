@@ -0,0 +1,85 @@
+#ifndef PATHTRACER_INCLUDE_DYNAMIC_H_
+#define PATHTRACER_INCLUDE_DYNAMIC_H_
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <sycl/sycl.hpp>
+
+#include "include/bvh.h"
+#include "include/object.h"
+#include "include/scene.h"
+
+/*  Factor the scene BVH cost may grow by through refits before it is rebuilt,
+    relative to its cost right after the last build */
+const float kDefaultRebuildThreshold = 1.3f;
+/* Frames per second of animations rendered to files */
+const float kAnimationFrameRate = 24.0f;
+
+/*  Keeps the scene BVH of a scene with moving objects usable. After objects
+    moved, the BVH is refit on the device, which is far cheaper than a build
+    but keeps the old tree topology. Once the surface area heuristic cost of
+    the refit tree exceeds the rebuild threshold, the tree is rebuilt on the
+    host instead */
+class DynamicScene {
+ private:
+  Scene* scene_;
+  bvh::Refitter refitter_;
+  float rebuild_threshold_;
+  /* SAH cost after the last build and after the last update */
+  float built_cost_;
+  float cost_;
+  bool moved_ = false;
+
+  uint32_t refits_ = 0;
+  uint32_t rebuilds_ = 0;
+  double refit_seconds_ = 0.0;
+  double rebuild_seconds_ = 0.0;
+
+ public:
+  DynamicScene(sycl::queue& q, Scene& scene, float rebuild_threshold);
+
+  void Free(sycl::queue& q);
+
+  /*  Replaces the object of type `T` at `index` among the objects of its
+      type. No kernel may read the scene meanwhile and the move only reaches
+      the BVH with the next `Update` */
+  template <typename T>
+  void Move(std::size_t index, const T& object) {
+    this->scene_->objects->Set(index, object);
+    this->moved_ = true;
+  }
+
+  /*  Refits or rebuilds the scene BVH after `Move`s, waits for the device.
+      Returns true if the BVH was rebuilt */
+  bool Update(sycl::queue& q);
+
+  /* SAH cost of the current BVH relative to the one after the last build */
+  float RelativeCost() const { return cost_ / built_cost_; }
+
+  uint32_t Refits() const { return refits_; }
+  uint32_t Rebuilds() const { return rebuilds_; }
+  double RefitSeconds() const { return refit_seconds_; }
+  double RebuildSeconds() const { return rebuild_seconds_; }
+};
+
+/*  Moves the bounded objects of a scene along circles around the places they
+    were loaded at, each object with its own phase. Objects sampled for direct
+    light stay in place, the emitter list is only built once */
+class Animation {
+ private:
+  std::vector<std::pair<uint32_t, Sphere>> spheres_;
+  std::vector<std::pair<uint32_t, Instance>> instances_;
+
+ public:
+  explicit Animation(const Scene& scene);
+
+  /* Number of moving objects */
+  std::size_t size() const { return spheres_.size() + instances_.size(); }
+
+  /* Moves every object to its place at `time` seconds, the loaded scene at 0 */
+  void Apply(DynamicScene& dynamic, float time) const;
+};
+
+#endif
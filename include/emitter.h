@@ -0,0 +1,77 @@
+#ifndef PATHTRACER_INCLUDE_EMITTER_H_
+#define PATHTRACER_INCLUDE_EMITTER_H_
+
+#include <cstdint>
+#include <vector>
+
+#include <sycl/sycl.hpp>
+
+#include "include/material.h"
+#include "include/object.h"
+#include "include/utils.h"
+
+/* Surface of an emissive object that is sampled for direct lighting */
+struct Emitter {
+  enum Shape : uint32_t { kSphere = 0, kTriangle = 1 };
+
+  uint32_t shape;
+  material::Id material_id;
+
+  sycl::vec<float, 3> origin; /* Sphere center or first triangle vertex */
+  sycl::vec<float, 3> edge1;  /* Triangle b - a */
+  sycl::vec<float, 3> edge2;  /* Triangle c - a */
+  float radius;               /* Sphere */
+};
+
+/* Direction toward a point on an emitter as seen from a shading point */
+struct EmitterSample {
+  sycl::vec<float, 3> dir; /* Normalized */
+  float distance;
+  /* Emitted radiance divided by the probability density of the sample in
+     solid angle, including the probability of picking the emitter */
+  sycl::vec<float, 3> radiance;
+};
+
+/*  All emitters of a scene in shared memory. Emitters are picked
+    proportionally to their emitted power, so the few bright lights of a scene
+    get most of the samples */
+struct EmitterList {
+  Emitter* emitters = nullptr;
+  float* cdf = nullptr; /* Power CDF, the last entry is 1 */
+  uint32_t count = 0;
+
+  /*  Bit per material id, set if objects with the material are sampled.
+      Covers the ids up to the largest sampled one */
+  uint32_t* sampled_materials = nullptr;
+  uint32_t sampled_words = 0;
+
+  /*  Surfaces of sampled materials already got their emission through an
+      emitter sample at the previous path vertex and must not add it again
+      when a bounce hits them */
+  SYCL_EXTERNAL bool Sampled(material::Id material_id) const {
+    return material_id / 32u < this->sampled_words &&
+           ((this->sampled_materials[material_id / 32] >> (material_id % 32)) &
+            1u);
+  }
+};
+
+/*  Collects the spheres and mesh triangles with emissive materials, the
+    triangles of instances moved into the world. Planes are infinite and
+    cannot be sampled, emissive planes only contribute when a bounce hits
+    them. So do all other objects that share a material with a plane, as
+    `EmitterList::Sampled` is decided per material */
+EmitterList BuildEmitterList(
+    sycl::queue& q, const containerutils::VariantContainer<Objects>& objects,
+    const std::vector<Material>& materials);
+
+void FreeEmitterList(EmitterList& emitters, sycl::queue& q);
+
+/*  Picks an emitter and a point on it visible from `p`. Returns false if no
+    emitter could be sampled, e.g. when the list is empty or `p` lies inside
+    the picked sphere */
+SYCL_EXTERNAL bool SampleEmitter(const EmitterList& emitters,
+                                 const Material* materials,
+                                 const sycl::vec<float, 3>& p, float u0,
+                                 float u1, float u2, EmitterSample& sample);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef PATHTRACER_INCLUDE_IMAGE_H_
+#define PATHTRACER_INCLUDE_IMAGE_H_
+
+#include <string>
+
+namespace imageutils {
+/* All writers take the raw accumulation buffer `rgb` (`width*height*3` sums
+   of `samples` samples each, bottom row first as rendered for OpenGL) and
+   average it before writing. Return false if the file could not be written */
+
+/* Binary 8-bit PPM (P6) with gamma correction */
+bool WritePPM(const std::string& path, const float* rgb, int width, int height,
+              int samples);
+
+/* Little endian PFM with linear radiance, suitable for further processing */
+bool WritePFM(const std::string& path, const float* rgb, int width, int height,
+              int samples);
+
+/* Picks the writer from the extension of `path`, `.pfm` for PFM and PPM for
+   everything else */
+bool WriteImage(const std::string& path, const float* rgb, int width,
+                int height, int samples);
+}  // namespace imageutils
+
+#endif
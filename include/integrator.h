@@ -0,0 +1,433 @@
+#ifndef PATHTRACER_INCLUDE_INTEGRATOR_H_
+#define PATHTRACER_INCLUDE_INTEGRATOR_H_
+
+#include <sycl/sycl.hpp>
+
+#include "include/camera.h"
+#include "include/emitter.h"
+#include "include/material.h"
+#include "include/ray.h"
+#include "include/render.h"
+#include "include/scene.h"
+#include "include/texture.h"
+
+/*  Path tracing steps shared by the megakernel and the wavefront pipeline so
+    that both produce the same image */
+namespace render {
+/*  Radiance of rays leaving the scene, the white sky of ambient occlusion
+    mode, see `ShadeAmbientOcclusion` */
+SYCL_EXTERNAL inline sycl::vec<float, 3> Background(const Scene& scene,
+                                                    const Ray& ray) {
+  (void)ray;
+  if (scene.ambient_occlusion > 0.0f) {
+    return sycl::vec<float, 3>{1.0f, 1.0f, 1.0f};
+  }
+  return sycl::vec<float, 3>{0.6f, 0.6f, 0.6f};
+}
+
+/* Offset of continuation and shadow rays from the surface they leave */
+const float kRayEpsilon = 1e-3f;
+
+/* Footprint of the ray cone at the hit, see `texture::Sample` */
+SYCL_EXTERNAL inline float TextureLod(const Intersector& intersection,
+                                      const Ray& ray) {
+  return intersection.lod +
+         sycl::log2(ray.ConeWidth(intersection.t) /
+                    sycl::fabs(sycl::dot(intersection.normal, ray.dir)));
+}
+
+/*  Multiplies the textured parameters of `material` by its textures at the
+    hit of `ray`. Textures are filtered over the footprint of the ray cone
+    projected onto the surface (Akenine-Moeller et al., "Texture Level of
+    Detail Strategies for Real-Time Ray Tracing") */
+SYCL_EXTERNAL inline void ApplyTextures(const texture::Atlas& atlas,
+                                        const Intersector& intersection,
+                                        const Ray& ray, Material& material) {
+  if (material.albedo_texture == texture::kNone &&
+      material.roughness_texture == texture::kNone &&
+      material.metallic_texture == texture::kNone) {
+    return;
+  }
+  float lod = TextureLod(intersection, ray);
+  if (material.albedo_texture != texture::kNone) {
+    material.base_color *= texture::Sample(atlas, material.albedo_texture,
+                                           intersection.uv, lod);
+  }
+  if (material.roughness_texture != texture::kNone) {
+    material.roughness *= texture::Sample(atlas, material.roughness_texture,
+                                          intersection.uv, lod).x();
+  }
+  if (material.metallic_texture != texture::kNone) {
+    material.metallic *= texture::Sample(atlas, material.metallic_texture,
+                                         intersection.uv, lod).x();
+  }
+}
+
+/* Occlusion rays per hit in ambient occlusion mode */
+const int kAmbientOcclusionRays = 4;
+
+/*  Adds the fraction of cosine weighted directions over the hit of `ray`
+    that leave it unoccluded within `scene.ambient_occlusion` to
+    `radiance`, a white sky over white surfaces without bounces. The rays
+    only ask whether anything is in the way, see `occluded`. Every ray
+    consumes one dimension group of the sampler */
+template <class Sampler>
+SYCL_EXTERNAL bool ShadeAmbientOcclusion(const Scene& scene, Sampler& random,
+                                         const Intersector& intersection,
+                                         const Ray& ray,
+                                         const sycl::vec<float, 3>& throughput,
+                                         sycl::vec<float, 3>& radiance) {
+  bool front = sycl::dot(intersection.normal, ray.dir) < 0.0f;
+  sycl::vec<float, 3> n = front ? intersection.normal : -intersection.normal;
+  sycl::vec<float, 3> p =
+      ray.origin + ray.dir * intersection.t + n * kRayEpsilon;
+  sycl::vec<float, 3> plane_x, plane_y;
+  vecutils::PlaneVectors(n, plane_x, plane_y);
+
+  int unoccluded = 0;
+  for (int i = 0; i < kAmbientOcclusionRays; i++) {
+    float u1 = random(), u2 = random();
+    float r = sycl::sqrt(u1);
+    float phi = 2.0f * M_PI * u2;
+    Ray probe(p, plane_x * (r * sycl::cos(phi)) +
+                     plane_y * (r * sycl::sin(phi)) +
+                     n * sycl::sqrt(sycl::fmax(0.0f, 1.0f - u1)));
+#ifdef PATHTRACER_STATS
+    probe.counters = ray.counters;
+#endif
+    unoccluded += !occluded(probe, *scene.objects, scene.bvh,
+                            scene.ambient_occlusion);
+    random.NextGroup();
+  }
+  PATHTRACER_COUNT(ray, bounces, 1);
+  radiance += throughput * ((float)unoccluded / kAmbientOcclusionRays);
+  return false;
+}
+
+/*  Adds the contribution of the surface hit by `ray` to `radiance` and turns
+    `ray` into the continuation of the path, specialized for surfaces of
+    material family `F`. Direct light is gathered with a shadow ray toward a
+    sampled emitter (next event estimation), so emitters only add their
+    emission on bounce hits if they are not in the emitter list or the ray
+    left a smooth surface. Every vertex consumes two dimension groups of the
+    sampler, one for the emitter sample and the roulette and one for the
+    bounce. Returns false once the path has reached its maximum depth, was
+    absorbed or was ended by Russian roulette */
+template <material::Family F, class Sampler>
+SYCL_EXTERNAL bool ShadeFamily(const Scene& scene, Sampler& random,
+                               const Intersector& intersection, Ray& ray,
+                               sycl::vec<float, 3>& throughput,
+                               sycl::vec<float, 3>& radiance) {
+  using material::Family;
+  if (scene.ambient_occlusion > 0.0f) {
+    return ShadeAmbientOcclusion(scene, random, intersection, ray, throughput,
+                                 radiance);
+  }
+  /* A copy, the terms of the microfacet model are not const */
+  Material material = scene.materials[intersection.material_id];
+  /* Surfaces emit on the side their normal points to */
+  bool front = sycl::dot(intersection.normal, ray.dir) < 0.0f;
+  if (front && (ray.depth == 0 || ray.specular ||
+                !scene.emitters.Sampled(intersection.material_id))) {
+    radiance += throughput * material.Emission();
+  }
+  PATHTRACER_COUNT(ray, bounces, 1);
+  if constexpr (F == Family::kEmissive) {
+    return false;
+  }
+  /* Emission stays untextured like the emitter samples */
+  ApplyTextures(scene.textures, intersection, ray, material);
+
+  /* Shade the side the ray arrives from */
+  sycl::vec<float, 3> n = front ? intersection.normal : -intersection.normal;
+  sycl::vec<float, 3> v = -ray.dir;
+  sycl::vec<float, 3> hit = ray.origin + ray.dir * intersection.t;
+  sycl::vec<float, 3> p = hit + n * kRayEpsilon;
+
+  /* The first two dimensions of a group are the best stratified pair */
+  float u1 = random(), u2 = random(), u0 = random(), roulette = random();
+  sycl::vec<float, 3> l;
+  if constexpr (F == Family::kDielectric) {
+    /*  Reflects with the Fresnel reflectance, Schlick's approximation taken
+        on the side of the denser medium, and refracts otherwise. Emitter
+        samples never lie on the two directions */
+    float eta = front ? 1.0f / material.Ior() : material.Ior();
+    float cos_i = sycl::dot(n, v);
+    float sin2_t = eta * eta * (1.0f - cos_i * cos_i);
+    float reflectance = 1.0f;
+    if (sin2_t < 1.0f) {
+      float c = 1.0f - (front ? cos_i : sycl::sqrt(1.0f - sin2_t));
+      reflectance =
+          material.fresnel0 + (1.0f - material.fresnel0) * c * c * c * c * c;
+    }
+    if (u1 < reflectance) {
+      l = 2.0f * cos_i * n - v;
+      ray.origin = p;
+    } else {
+      l = -v * eta + n * (eta * cos_i - sycl::sqrt(1.0f - sin2_t));
+      ray.origin = hit - n * kRayEpsilon;
+      throughput *= material.base_color;
+    }
+    ray.specular = true;
+  } else {
+    EmitterSample sample;
+    if (SampleEmitter(scene.emitters, scene.materials, p, u0, u1, u2,
+                      sample) &&
+        sycl::dot(n, sample.dir) > 0.0f) {
+      Ray shadow(p, sample.dir);
+#ifdef PATHTRACER_STATS
+      shadow.counters = ray.counters;
+#endif
+      if (!occluded(shadow, *scene.objects, scene.bvh,
+                    sample.distance - kRayEpsilon)) {
+        sycl::vec<float, 3> brdf = F == Family::kMetal
+                                       ? material.Specular(sample.dir, v, n)
+                                       : material.Diffuse(sample.dir, n);
+        radiance += throughput * brdf * sycl::dot(n, sample.dir) *
+                    sample.radiance;
+      }
+    }
+
+    if constexpr (F == Family::kMetal) {
+      /* Halfway vectors follow the normal distribution, the estimator
+         weight leaves the Fresnel and the geometric term. Reflections
+         below the surface end the path */
+      sycl::vec<float, 3> h;
+      material.Sample(random, v, n, h, l);
+      if (sycl::dot(n, l) <= 0.0f || sycl::dot(l, h) <= 0.0f) {
+        return false;
+      }
+      throughput *= material.Eval(l, v, n, h);
+    } else {
+      material.SampleDiffuse(random, n, l);
+      /* BRDF times cosine over the sampling density */
+      throughput *= material.base_color;
+    }
+    ray.origin = p;
+    ray.specular = false;
+  }
+  random.NextGroup();
+  ray.depth += 1;
+  ray.dir = l;
+  /*  The cone continues from its footprint on the surface. Rough bounces
+      widen it by the GGX alpha, diffuse ones as if fully rough, so their
+      texture lookups read small mip levels */
+  ray.cone_width = ray.ConeWidth(intersection.t);
+  if constexpr (F == Family::kDiffuse) {
+    ray.cone_spread += 1.0f;
+  } else if constexpr (F == Family::kMetal) {
+    ray.cone_spread += material.roughness * material.roughness;
+  }
+  if (ray.depth >= scene.max_depth) {
+    return false;
+  }
+
+  /*  Russian roulette, paths survive with a probability following their
+      throughput and are reweighted so the estimate stays unbiased */
+  if (ray.depth >= kRouletteDepth) {
+    float survival = sycl::fmin(
+        sycl::fmax(throughput.x(), sycl::fmax(throughput.y(), throughput.z())),
+        0.95f);
+    if (roulette >= survival) {
+      return false;
+    }
+    throughput /= survival;
+  }
+  return true;
+}
+
+/*  Family the hit of `ray` is shaded with. Diffuse and metal materials with
+    a metallic texture pick one of the two per hit by their textured
+    metallic parameter, every other material keeps the family of its
+    constant parameters */
+SYCL_EXTERNAL inline material::Family HitFamily(
+    const Scene& scene, const Intersector& intersection, const Ray& ray) {
+  using material::Family;
+  const Material& material = scene.materials[intersection.material_id];
+  if (material.metallic_texture == texture::kNone ||
+      (material.family != Family::kDiffuse &&
+       material.family != Family::kMetal)) {
+    return material.family;
+  }
+  float metallic = material.metallic *
+                   texture::Sample(scene.textures, material.metallic_texture,
+                                   intersection.uv,
+                                   TextureLod(intersection, ray)).x();
+  return metallic >= kMetalThreshold ? Family::kMetal : Family::kDiffuse;
+}
+
+/*  `ShadeFamily` for the family of the hit, see `HitFamily`. Paths of
+    different families diverge here, the wavefront pipeline groups hits by
+    family first and calls `ShadeFamily` directly */
+template <class Sampler>
+SYCL_EXTERNAL bool Shade(const Scene& scene, Sampler& random,
+                         const Intersector& intersection, Ray& ray,
+                         sycl::vec<float, 3>& throughput,
+                         sycl::vec<float, 3>& radiance) {
+  using material::Family;
+  switch (HitFamily(scene, intersection, ray)) {
+    case Family::kMetal:
+      return ShadeFamily<Family::kMetal>(scene, random, intersection, ray,
+                                         throughput, radiance);
+    case Family::kDielectric:
+      return ShadeFamily<Family::kDielectric>(scene, random, intersection,
+                                              ray, throughput, radiance);
+    case Family::kEmissive:
+      return ShadeFamily<Family::kEmissive>(scene, random, intersection, ray,
+                                            throughput, radiance);
+    default:
+      return ShadeFamily<Family::kDiffuse>(scene, random, intersection, ray,
+                                           throughput, radiance);
+  }
+}
+
+/* First hit attributes of the samples of a pixel, see `Frame::albedo` */
+struct Features {
+  sycl::vec<float, 3> albedo{0.0f, 0.0f, 0.0f};
+  sycl::vec<float, 3> normal{0.0f, 0.0f, 0.0f};
+  float depth = 0.0f;
+};
+
+/*  Adds the attributes of the first hit of a camera ray. Misses only have the
+    background as albedo */
+SYCL_EXTERNAL inline void AddFeatures(const Scene& scene,
+                                      const std::optional<Intersector>& hit,
+                                      const Ray& ray, Features& features) {
+  if (!hit.has_value()) {
+    features.albedo += Background(scene, ray);
+    return;
+  }
+  Material material = scene.materials[hit->material_id];
+  ApplyTextures(scene.textures, *hit, ray, material);
+  features.albedo += material.base_color;
+  features.normal += sycl::dot(hit->normal, ray.dir) < 0.0f ? hit->normal
+                                                            : -hit->normal;
+  features.depth += hit->t;
+}
+
+/* Gamma corrected 8-bit value of an averaged accumulation channel */
+SYCL_EXTERNAL inline uint8_t ToDisplay(float sum, float samples) {
+  float kGamma = 1.0f/2.2f;
+  return sycl::pow(sycl::clamp(sum/samples,0.0f,1.0f),kGamma)*255;
+}
+
+/* Whether the pixel gets samples in this batch, see `Frame::active_tiles` */
+SYCL_EXTERNAL inline bool PixelActive(const Frame& frame, uint32_t w,
+                                      uint32_t h) {
+  if (frame.active_tiles == nullptr) {
+    return true;
+  }
+  uint32_t tiles_x = (frame.width + kAdaptiveTileSize - 1) / kAdaptiveTileSize;
+  return frame.active_tiles[(h / kAdaptiveTileSize) * tiles_x +
+                            w / kAdaptiveTileSize];
+}
+
+/*  Adds the radiance, the features and the cost counters summed over the
+    `kSamplesPerPixel` samples of a batch to pixel `index`, unless the pixel
+    was skipped, and writes its display value. Restarts the accumulation if
+    `frame.executed_samples` is 0 */
+SYCL_EXTERNAL inline void AccumulatePixel(const Frame& frame, uint32_t index,
+                                          bool sampled,
+                                          const sycl::vec<float, 3>& radiance,
+                                          const Features& features,
+                                          const stats::Counters& counters) {
+  float* pixel = &frame.image[index*3];
+  if (frame.executed_samples == 0) {
+    pixel[0] = pixel[1] = pixel[2] = 0.0f;
+    if (frame.squares != nullptr) {
+      frame.squares[index] = 0.0f;
+      frame.sample_counts[index] = 0;
+    }
+    if (frame.albedo != nullptr) {
+      for (int c = 0; c < 3; c++) {
+        frame.albedo[index*3+c] = frame.normal[index*3+c] = 0.0f;
+      }
+      frame.depth[index] = 0.0f;
+    }
+    if (stats::kEnabled && frame.counters != nullptr) {
+      frame.counters[index] = stats::Counters();
+    }
+  }
+
+  if (stats::kEnabled && sampled && frame.counters != nullptr) {
+    frame.counters[index] += counters;
+  }
+
+  if (sampled && frame.albedo != nullptr) {
+    for (int c = 0; c < 3; c++) {
+      frame.albedo[index*3+c] += features.albedo[c];
+      frame.normal[index*3+c] += features.normal[c];
+    }
+    frame.depth[index] += features.depth;
+  }
+
+  if (sampled) {
+    pixel[0] += radiance.x();
+    pixel[1] += radiance.y();
+    pixel[2] += radiance.z();
+    if (frame.squares != nullptr) {
+      /* Batch means are the samples of the variance estimate */
+      float luminance = vecutils::Luminance(radiance) / kSamplesPerPixel;
+      frame.squares[index] += luminance * luminance;
+      frame.sample_counts[index] += kSamplesPerPixel;
+    }
+  }
+
+  if (frame.framebuffer == nullptr) {
+    return;
+  }
+
+  sycl::device_ptr<uint8_t> framebuffer = frame.framebuffer;
+  float samples = frame.sample_counts != nullptr
+                      ? sycl::fmax((float)frame.sample_counts[index], 1.0f)
+                      : frame.executed_samples + kSamplesPerPixel;
+  for (int c = 0; c < 3; c++) {
+    framebuffer[index*3+c] = ToDisplay(pixel[c], samples);
+  }
+}
+
+/*  Traces the `kSamplesPerPixel` samples of a batch for pixel (`w`, `h`) and
+    accumulates them into `frame`, the whole work of the megakernel and the
+    tile scheduler for one pixel */
+template <class Sampler>
+SYCL_EXTERNAL inline void RenderPixel(const Scene& scene, const Camera& camera,
+                                      const Frame& frame, uint32_t w,
+                                      uint32_t h) {
+  uint32_t pixel = frame.width*h+w;
+  bool active = PixelActive(frame, w, h);
+
+  sycl::vec<float, 3> radiance{0.0f, 0.0f, 0.0f};
+  Features features;
+  stats::Counters counters;
+  for (int s = 0; active && s < kSamplesPerPixel; s++) {
+    Sampler random(pixel, frame.total_executed_samples + s);
+    Ray ray;
+    /* Jittered inside the pixel */
+    float x = random(), y = random();
+    camera.GenerateRay(w + x, h + y, ray);
+    random.NextGroup();
+#ifdef PATHTRACER_STATS
+    ray.counters = &counters;
+#endif
+
+    sycl::vec<float, 3> throughput{1.0f, 1.0f, 1.0f};
+    while (true) {
+      auto obj = closest_obj(ray, *scene.objects, scene.bvh);
+      if (ray.depth == 0) {
+        AddFeatures(scene, obj, ray, features);
+      }
+      if (!obj.has_value()) {
+        radiance += throughput*Background(scene, ray);
+        break;
+      }
+
+      if (!Shade(scene, random, *obj, ray, throughput, radiance)) {
+        break;
+      }
+    }
+  }
+  AccumulatePixel(frame, pixel, active, radiance, features, counters);
+}
+}  // namespace render
+
+#endif
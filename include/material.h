@@ -2,14 +2,50 @@
 #define PATHTRACER_INCLUDE_MATERIAL_H_
 
 #include <cmath>
+#include <cstdint>
+#include <limits>
+
 #include <sycl/sycl.hpp>
 
+#include "include/texture.h"
 #include "include/utils.h"
 
-/* For debugging */
-const bool kUseAngleForSampling = true;
+/* For debugging, the angle sampling ignores the roughness */
+const bool kUseAngleForSampling = false;
+
+/* Materials at least this metallic are shaded as `Family::kMetal` */
+const float kMetalThreshold = 0.5f;
 
 namespace material {
+/* Index into the material table of a scene, see `Scene::materials` */
+using Id = uint16_t;
+/* Size of the largest material table ids can address */
+const std::size_t kMaxMaterials =
+    (std::size_t)std::numeric_limits<Id>::max() + 1;
+
+/*  BRDF family a material is shaded with. Every family has its own
+    specialization of the shading code, see `render::ShadeFamily` */
+enum class Family : uint8_t {
+  kDiffuse,    /* Lambertian */
+  kMetal,      /* GGX microfacet reflection tinted by the base color */
+  kDielectric, /* Smooth glass, reflects or refracts */
+  kEmissive    /* Emits and absorbs everything */
+};
+const int kFamilyCount = 4;
+
+/* Family of a material with the given parameters */
+SYCL_EXTERNAL inline Family FamilyOf(float metallic, bool dielectric,
+                                     float emitance) {
+  if (emitance > 0.0f) return Family::kEmissive;
+  if (dielectric) return Family::kDielectric;
+  return metallic >= kMetalThreshold ? Family::kMetal : Family::kDiffuse;
+}
+
+/* `reflectance` parameter of a dielectric with index of refraction `ior` */
+inline float ReflectanceForIor(float ior) {
+  return (ior - 1.0f) / (ior + 1.0f) / 0.4f;
+}
+
 /* Microfacet material model */
 template <class Fresnel, class Normal, class Geometry>
 struct MicrofacetMaterial {
@@ -17,6 +53,11 @@ struct MicrofacetMaterial {
   Normal normal;
   Geometry geometry;
 
+  /*  Derived from the parameters, emission makes a material emissive,
+      `dielectric` glass and a `metallic` of at least `kMetalThreshold` a
+      metal, see `FamilyOf` */
+  Family family;
+
   sycl::vec<float, 3> base_color;
 
   float metallic;
@@ -27,20 +68,66 @@ struct MicrofacetMaterial {
 
   float emitance;
 
+  /* Normal incidence reflectance of dielectrics, `0.16 * reflectance^2` */
   float fresnel0;
 
+  /*  Textures the base color, the roughness and the metallic parameter are
+      multiplied with at every hit, `texture::kNone` if constant. With a
+      metallic texture, diffuse and metal materials switch between the two
+      families per hit, see `render::HitFamily` */
+  texture::Id albedo_texture = texture::kNone;
+  texture::Id roughness_texture = texture::kNone;
+  texture::Id metallic_texture = texture::kNone;
+
   SYCL_EXTERNAL MicrofacetMaterial(sycl::vec<float, 3> base_color, float metallic,
                      float roughness, bool dielectric, float reflectance,
                      float emmitance)
       : fresnel(Fresnel()),
         normal(Normal()),
         geometry(Geometry()),
+        family(FamilyOf(metallic, dielectric, emmitance)),
         base_color(base_color),
         metallic(metallic),
         roughness(roughness),
         dielectric(dielectric),
         reflectance(reflectance),
-        emitance(emmitance){};
+        emitance(emmitance),
+        fresnel0(0.16f * reflectance * reflectance){};
+
+  /* Index of refraction of dielectrics, the one with `fresnel0` */
+  SYCL_EXTERNAL float Ior() const {
+    float root = sycl::sqrt(this->fresnel0);
+    return (1.0f + root) / (1.0f - root);
+  }
+
+  /* Radiance emitted by the surface */
+  SYCL_EXTERNAL sycl::vec<float, 3> Emission() const {
+    return this->base_color * this->emitance;
+  }
+
+  /* Lambertian BRDF with `base_color` as albedo, zero below the surface */
+  SYCL_EXTERNAL sycl::vec<float, 3> Diffuse(const sycl::vec<float, 3> &l,
+                                            const sycl::vec<float, 3> &n) const {
+    if (sycl::dot(n, l) <= 0.0f) {
+      return sycl::vec<float, 3>{0.0f, 0.0f, 0.0f};
+    }
+    return this->base_color * (float)M_1_PI;
+  }
+
+  /* Cosine weighted direction `l` around `n`. Its density cos/pi cancels
+     against the cosine and the 1/pi of `Diffuse` in the estimator */
+  template <class Random>
+  SYCL_EXTERNAL void SampleDiffuse(Random &random, const sycl::vec<float, 3> &n,
+                                   sycl::vec<float, 3> &l) const {
+    float u1 = random(), u2 = random();
+    float r = sycl::sqrt(u1);
+    float phi = 2.0f * M_PI * u2;
+
+    sycl::vec<float, 3> plane_x, plane_y;
+    vecutils::PlaneVectors(n, plane_x, plane_y);
+    l = plane_x * (r * sycl::cos(phi)) + plane_y * (r * sycl::sin(phi)) +
+        n * sycl::sqrt(sycl::fmax(0.0f, 1.0f - u1));
+  }
 
   /* Samples the halfway vector and the new direction vector from geometric
      normal and the view direction. `h` and `l` are overwritten by the sampled
@@ -50,13 +137,30 @@ struct MicrofacetMaterial {
               const sycl::vec<float, 3> &n, sycl::vec<float, 3> &h,
               sycl::vec<float, 3> &l) {
     this->normal.SampleHVec(*this, random(), random(), n, h);
-    /* Sampled outgoing direction (light direction) */
-    l = h;
+    /* Sampled outgoing direction (light direction), `v` mirrored at `h` */
+    l = 2.0f * sycl::dot(v, h) * h - v;
+  }
+
+  /*  Full microfacet BRDF for light arriving from `l`, zero below the
+      surface */
+  SYCL_EXTERNAL sycl::vec<float, 3> Specular(const sycl::vec<float, 3> &l,
+                                             const sycl::vec<float, 3> &v,
+                                             const sycl::vec<float, 3> &n) {
+    float nl = sycl::dot(n, l), nv = sycl::dot(n, v);
+    if (nl <= 0.0f || nv <= 0.0f) {
+      return sycl::vec<float, 3>{0.0f, 0.0f, 0.0f};
+    }
+    sycl::vec<float, 3> h = sycl::normalize(l + v);
+    return this->fresnel(*this, h, l) * this->normal(*this, n, h) *
+           this->geometry(*this, l, v, n, h) / (4.0f * nl * nv);
   }
 
-  /* Returns the summation element for the monte carlo estimator */
-  SYCL_EXTERNAL float Eval(const sycl::vec<float, 3> &l, const sycl::vec<float, 3> &v,
-             const sycl::vec<float, 3> &n, const sycl::vec<float, 3> &h) {
+  /* Returns the summation element for the monte carlo estimator of
+     directions from `Sample`, the BRDF times the cosine over the density */
+  SYCL_EXTERNAL sycl::vec<float, 3> Eval(const sycl::vec<float, 3> &l,
+                                         const sycl::vec<float, 3> &v,
+                                         const sycl::vec<float, 3> &n,
+                                         const sycl::vec<float, 3> &h) {
     /* Fresnel term in BRDF */
     sycl::vec<float, 3> F = this->fresnel(*this, h, l);
     /* Geometric term in BRDF */
@@ -67,9 +171,9 @@ struct MicrofacetMaterial {
       float denominator = sycl::dot(n, v)*
                           sycl::dot(n, h);
 
-      return G * sycl::fabs(sycl::dot(v, h)) / denominator;
+      return F * (G * sycl::fabs(sycl::dot(v, h)) / denominator);
     }
-    return 0.0f;
+    return sycl::vec<float, 3>{0.0f, 0.0f, 0.0f};
   }
 };
 
@@ -211,4 +315,7 @@ public:
 
 } /* namespace material */
 
+using Material = material::MicrofacetMaterial<material::FresnelSchlick,
+  material::NormalGGX, material::GeometryGGXSchlick>;
+
 #endif
\ No newline at end of file
@@ -1,17 +1,72 @@
 #ifndef PATHTRACER_INCLUDE_OBJECT_H_
 #define PATHTRACER_INCLUDE_OBJECT_H_
 
+#include <type_traits>
+#include <utility>
 #include <variant>
+#include <vector>
 
-// #include "objects/mesh.h"
+#include "objects/instance.h"
+#include "objects/mesh.h"
 #include "objects/plane.h"
 #include "objects/sphere.h"
+#include "include/bvh.h"
 #include "include/ray.h"
 #include "include/utils.h"
 
-using Objects = std::variant<Sphere, Plane>;
+using Objects = std::variant<Sphere, Plane, Mesh, Instance>;
 
+/* Objects with finite extent provide `bvh::AABB Bounds() const` and are put
+   into the scene BVH, all other objects (like `Plane`) are tested linearly */
+template <typename T, typename = void>
+struct is_bounded : std::false_type {};
+
+template <typename T>
+struct is_bounded<T, std::void_t<decltype(std::declval<const T&>().Bounds())>>
+    : std::true_type {};
+
+template <typename T>
+inline constexpr bool is_bounded_v = is_bounded<T>::value;
+
+/* Addresses an object inside a `VariantContainer`, see `forEachIndexed` */
+using PrimitiveRef = containerutils::ElementRef;
+
+/* BVH over the bounded objects of a container, leaf `i` references the object
+   at `refs[i]` */
+struct SceneBVH {
+  bvh::BVH tree;
+  PrimitiveRef* refs = nullptr;
+};
+
+/* Builds the BVH over the current content of `objects`. It has to be rebuilt
+   whenever bounded objects are added */
+SceneBVH BuildSceneBVH(sycl::queue& q,
+                       const containerutils::VariantContainer<Objects>& objects);
+
+/*  Refits `bvh` to the current bounds of the objects it was built over, after
+    bounded objects moved. `refitter` has to be created from `bvh.tree` and
+    `objects` has to live in shared memory like `Scene::objects` */
+sycl::event RefitSceneBVH(
+    sycl::queue& q, const containerutils::VariantContainer<Objects>& objects,
+    const SceneBVH& bvh, bvh::Refitter& refitter,
+    const std::vector<sycl::event>& depends_on = {});
+
+void FreeSceneBVH(SceneBVH& bvh, sycl::queue& q);
+
+/* Brute force reference, tests every object */
 SYCL_EXTERNAL std::optional<Intersector> closest_obj(
     const Ray &ray, const containerutils::VariantContainer<Objects> &objects);
 
-#endif
\ No newline at end of file
+/* Tests the unbounded objects and walks `bvh` for the rest */
+SYCL_EXTERNAL std::optional<Intersector> closest_obj(
+    const Ray &ray, const containerutils::VariantContainer<Objects> &objects,
+    const SceneBVH &bvh);
+
+/*  Whether any object is hit in front of the ray closer than `tmax`. Returns
+    at the first hit found without computing anything about it, which makes
+    shadow and visibility rays far cheaper than `closest_obj` */
+SYCL_EXTERNAL bool occluded(
+    const Ray &ray, const containerutils::VariantContainer<Objects> &objects,
+    const SceneBVH &bvh, float tmax);
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef PATHTRACER_INCLUDE_OBJECTS_INSTANCE_H_
+#define PATHTRACER_INCLUDE_OBJECTS_INSTANCE_H_
+
+#include <cstdint>
+
+#include <sycl/sycl.hpp>
+
+#include "include/bvh.h"
+#include "include/objects/mesh.h"
+#include "include/ray.h"
+
+/* Affine transform, the rows of a 3x4 matrix */
+struct Transform {
+  sycl::vec<float, 4> rows[3] = {{1.0f, 0.0f, 0.0f, 0.0f},
+                                 {0.0f, 1.0f, 0.0f, 0.0f},
+                                 {0.0f, 0.0f, 1.0f, 0.0f}};
+
+  /*  Scales uniformly by `scale`, rotates by `rotation` degrees around the
+      X, then the Y and then the Z axis and finally moves by `translation` */
+  static Transform Compose(const sycl::vec<float, 3>& translation,
+                           const sycl::vec<float, 3>& rotation, float scale);
+
+  /* Inverse transform, the matrix has to be invertible */
+  Transform Inverse() const;
+
+  SYCL_EXTERNAL sycl::vec<float, 3> Point(const sycl::vec<float, 3>& p) const {
+    sycl::vec<float, 4> h{p.x(), p.y(), p.z(), 1.0f};
+    return sycl::vec<float, 3>{sycl::dot(this->rows[0], h),
+                               sycl::dot(this->rows[1], h),
+                               sycl::dot(this->rows[2], h)};
+  }
+
+  /* Directions ignore the translation */
+  SYCL_EXTERNAL sycl::vec<float, 3> Vector(const sycl::vec<float, 3>& v) const {
+    sycl::vec<float, 4> h{v.x(), v.y(), v.z(), 0.0f};
+    return sycl::vec<float, 3>{sycl::dot(this->rows[0], h),
+                               sycl::dot(this->rows[1], h),
+                               sycl::dot(this->rows[2], h)};
+  }
+
+  /*  Multiplies by the transposed linear part. On the inverse transform this
+      carries normals over, as they transform with the inverse transpose */
+  SYCL_EXTERNAL sycl::vec<float, 3> TransposedVector(
+      const sycl::vec<float, 3>& v) const {
+    return sycl::vec<float, 3>{this->rows[0].x(), this->rows[0].y(),
+                               this->rows[0].z()} * v.x() +
+           sycl::vec<float, 3>{this->rows[1].x(), this->rows[1].y(),
+                               this->rows[1].z()} * v.y() +
+           sycl::vec<float, 3>{this->rows[2].x(), this->rows[2].y(),
+                               this->rows[2].z()} * v.z();
+  }
+};
+
+/*  Placement of a shared mesh. The instance only keeps the mesh handle, so
+    all instances of a mesh use the same vertex, packet and BVH buffers, and
+    the transform between the mesh's object space and the world. Instances
+    are leaves of the scene BVH, which makes it the top level structure over
+    the mesh BVHs: rays entering an instance are moved into object space and
+    traverse the mesh BVH there.
+
+    The object space ray direction is not normalized, so hit distances stay
+    the distances along the world ray */
+class Instance {
+ private:
+  Mesh mesh_;
+  Transform to_world_;
+  Transform to_object_;
+  bvh::AABB bounds_; /* World space */
+  /* Added to `Intersector::lod`, texture footprints grow with the scale */
+  float lod_bias_;
+  uint32_t geometry_;
+
+ public:
+  /*  `mesh` is the shared geometry at index `geometry` of the scene's
+      geometries, see `Scene::geometries` */
+  Instance(const Mesh& mesh, uint32_t geometry, const Transform& to_world);
+
+  /* Searches the mesh in object space, see `Mesh::Intersect` */
+  SYCL_EXTERNAL bool Intersect(const Ray& ray, Hit& hit) const;
+
+  /* Attributes of the mesh hit, with the normal moved into world space */
+  SYCL_EXTERNAL Intersector Attributes(const Ray& ray, const Hit& hit) const;
+
+  SYCL_EXTERNAL bool Occludes(const Ray& ray, float tmax) const;
+
+  SYCL_EXTERNAL bvh::AABB Bounds() const;
+
+  const Mesh& Geometry() const { return mesh_; }
+  uint32_t GeometryIndex() const { return geometry_; }
+  const Transform& ToWorld() const { return to_world_; }
+};
+
+#endif
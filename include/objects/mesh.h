@@ -1,37 +1,223 @@
 #ifndef PATHTRACER_INCLUDE_OBJECTS_MESH_H_
 #define PATHTRACER_INCLUDE_OBJECTS_MESH_H_
 
+#include <optional>
+#include <string>
+#include <vector>
+
 #include <sycl/sycl.hpp>
 
+#include "include/bvh.h"
+#include "include/material.h"
 #include "include/ray.h"
-#include "rapidobj/rapidobj.hpp"
+#include "include/texture.h"
+
+/* Triangles tested at once by `TrianglePacket` in mesh BVH leaves */
+const int kTrianglePacketWidth = 8;
 
+/* Single triangle with precomputed edges for Moeller-Trumbore tests */
 class MeshTriangle {
  private:
   sycl::vec<float, 3> a_;
-  sycl::vec<float, 3> b_;
-  sycl::vec<float, 3> c_;
+  sycl::vec<float, 3> edge1_; /* b - a */
+  sycl::vec<float, 3> edge2_; /* c - a */
 
   sycl::vec<float, 3> normal_;
 
-  uint8_t material_id_;
+  material::Id material_id_;
 
  public:
-  MeshTriangle(sycl::vec<float, 3> a, sycl::vec<float, 3> b,
-               sycl::vec<float, 3> c, sycl::vec<float, 3> normal,
-               uint8_t material_id)
-      : a_(a), b_(b), c_(c), normal_(normal), material_id_(material_id){};
+  SYCL_EXTERNAL MeshTriangle(sycl::vec<float, 3> a, sycl::vec<float, 3> b,
+                             sycl::vec<float, 3> c, sycl::vec<float, 3> normal,
+                             material::Id material_id)
+      : a_(a), edge1_(b - a), edge2_(c - a), normal_(normal),
+        material_id_(material_id){};
+
+  /*  Moves `hit` to the triangle if it is hit in front of the ray closer
+      than `hit.t`, returns whether it did */
+  SYCL_EXTERNAL bool Intersect(const Ray& ray, Hit& hit) const;
+
+  SYCL_EXTERNAL Intersector Attributes(const Ray& ray, const Hit& hit) const;
+
+  SYCL_EXTERNAL const sycl::vec<float, 3>& A() const { return a_; }
+  SYCL_EXTERNAL const sycl::vec<float, 3>& Edge1() const { return edge1_; }
+  SYCL_EXTERNAL const sycl::vec<float, 3>& Edge2() const { return edge2_; }
+  SYCL_EXTERNAL material::Id MaterialId() const { return material_id_; }
+};
+
+/*  `N` triangles in structure of arrays layout. All lanes run the same
+    branchless Moeller-Trumbore test, so the loop vectorizes on CPU SIMD units
+    and stays free of divergence on GPU lanes. Unused lanes have zero edges
+    and never report a hit */
+template <int N>
+struct TrianglePacket {
+  float ax[N], ay[N], az[N];
+  float e1x[N], e1y[N], e1z[N];
+  float e2x[N], e2y[N], e2z[N];
+
+  /* Empty packet, every lane degenerate */
+  TrianglePacket() {
+    for (int i = 0; i < N; i++) {
+      this->Set(i, sycl::vec<float, 3>(0.0f, 0.0f, 0.0f),
+                sycl::vec<float, 3>(0.0f, 0.0f, 0.0f),
+                sycl::vec<float, 3>(0.0f, 0.0f, 0.0f));
+    }
+  }
+
+  void Set(int lane, const sycl::vec<float, 3>& a, const sycl::vec<float, 3>& b,
+           const sycl::vec<float, 3>& c) {
+    sycl::vec<float, 3> e1 = b - a, e2 = c - a;
+    this->ax[lane] = a.x(), this->ay[lane] = a.y(), this->az[lane] = a.z();
+    this->e1x[lane] = e1.x(), this->e1y[lane] = e1.y(), this->e1z[lane] = e1.z();
+    this->e2x[lane] = e2.x(), this->e2y[lane] = e2.y(), this->e2z[lane] = e2.z();
+  }
+
+  /*  Returns the lane with the closest hit in front of the ray and closer
+      than `tmax`, which is then updated to the hit distance. Returns -1 if
+      no lane is hit */
+  SYCL_EXTERNAL int Intersect(const Ray& ray, float& tmax) const {
+    const float ox = ray.origin.x(), oy = ray.origin.y(), oz = ray.origin.z();
+    const float dx = ray.dir.x(), dy = ray.dir.y(), dz = ray.dir.z();
+
+    float best_t = tmax;
+    int best = -1;
+#pragma unroll
+    for (int i = 0; i < N; i++) {
+      /* p = dir x e2 */
+      float px = dy * this->e2z[i] - dz * this->e2y[i];
+      float py = dz * this->e2x[i] - dx * this->e2z[i];
+      float pz = dx * this->e2y[i] - dy * this->e2x[i];
+      float det = this->e1x[i] * px + this->e1y[i] * py + this->e1z[i] * pz;
+      float inv_det = 1.0f / det;
+
+      float tx = ox - this->ax[i], ty = oy - this->ay[i], tz = oz - this->az[i];
+      float u = (tx * px + ty * py + tz * pz) * inv_det;
+
+      /* q = t x e1 */
+      float qx = ty * this->e1z[i] - tz * this->e1y[i];
+      float qy = tz * this->e1x[i] - tx * this->e1z[i];
+      float qz = tx * this->e1y[i] - ty * this->e1x[i];
+      float v = (dx * qx + dy * qy + dz * qz) * inv_det;
+      float t = (this->e2x[i] * qx + this->e2y[i] * qy + this->e2z[i] * qz) *
+                inv_det;
+
+      bool hit = det != 0.0f && u >= 0.0f && v >= 0.0f && u + v <= 1.0f &&
+                 t > 0.0f && t < best_t;
+      best_t = hit ? t : best_t;
+      best = hit ? i : best;
+    }
+
+    tmax = best_t;
+    return best;
+  }
+
+  /*  Whether any lane is hit in front of the ray closer than `tmax`. The
+      lanes run the same test as `Intersect` but only the hit flags are
+      combined */
+  SYCL_EXTERNAL bool Occludes(const Ray& ray, float tmax) const {
+    const float ox = ray.origin.x(), oy = ray.origin.y(), oz = ray.origin.z();
+    const float dx = ray.dir.x(), dy = ray.dir.y(), dz = ray.dir.z();
+
+    bool any = false;
+#pragma unroll
+    for (int i = 0; i < N; i++) {
+      float px = dy * this->e2z[i] - dz * this->e2y[i];
+      float py = dz * this->e2x[i] - dx * this->e2z[i];
+      float pz = dx * this->e2y[i] - dy * this->e2x[i];
+      float det = this->e1x[i] * px + this->e1y[i] * py + this->e1z[i] * pz;
+      float inv_det = 1.0f / det;
 
-  SYCL_EXTERNAL std::optional<Intersector> Intersect(const Ray& ray) const;
+      float tx = ox - this->ax[i], ty = oy - this->ay[i], tz = oz - this->az[i];
+      float u = (tx * px + ty * py + tz * pz) * inv_det;
+
+      float qx = ty * this->e1z[i] - tz * this->e1y[i];
+      float qy = tz * this->e1x[i] - tx * this->e1z[i];
+      float qz = tx * this->e1y[i] - ty * this->e1x[i];
+      float v = (dx * qx + dy * qy + dz * qz) * inv_det;
+      float t = (this->e2x[i] * qx + this->e2y[i] * qy + this->e2z[i] * qz) *
+                inv_det;
+
+      any |= det != 0.0f && u >= 0.0f && v >= 0.0f && u + v <= 1.0f &&
+             t > 0.0f && t < tmax;
+    }
+    return any;
+  }
+};
+
+using MeshPacket = TrianglePacket<kTrianglePacketWidth>;
+
+/* Texture coordinates of the corners of a face */
+struct FaceTexcoords {
+  sycl::vec<float, 2> uv[3];
+  float lod; /* See `Intersector::lod` */
 };
 
+/*  Triangle mesh living in shared memory. The object itself is only a handle
+    to the buffers, so it is cheap to copy into the scene container and into
+    kernels. Faces are stored in the leaf order of the mesh's own BVH and
+    grouped into packets, face `i` is lane `i % kTrianglePacketWidth` of
+    packet `i / kTrianglePacketWidth`. BVH leaves address packets */
 class Mesh {
+ private:
+  sycl::vec<float, 3>* vertices_ = nullptr; /* Positions */
+  uint32_t* indices_ = nullptr;             /* 3 vertex indices per face */
+  sycl::vec<float, 3>* normals_ = nullptr;  /* Geometric face normals */
+  material::Id* material_ids_ = nullptr;    /* Material per face */
+  MeshPacket* packets_ = nullptr;           /* Precomputed face edges */
+  /* Per face, `nullptr` if the mesh has no texture coordinates */
+  FaceTexcoords* texcoords_ = nullptr;
+
+  uint32_t vertex_count_ = 0;
+  uint32_t triangle_count_ = 0; /* Face slots including unused packet lanes */
+
+  bvh::BVH bvh_;
+  bvh::AABB bounds_;
+
+  Mesh() {};
+
+  /* Stores and restores the buffers as they are */
+  friend class SceneFile;
+
  public:
-  std::vector<MeshTriangle> faces_;
+  /*  Loads and triangulates all shapes of the OBJ file at `path` into one
+      mesh. The MTL materials are appended to `materials` and referenced by
+      their index there, their texture maps are added to `textures` and the
+      texture coordinates are kept. OBJ files are Y-up while the tracer is
+      Z-up, so the vertices are rotated and then moved by `translation`.
+      Prints the reason and returns no value on failure */
+  static std::optional<Mesh> Load(sycl::queue& q, const std::string& path,
+                                  std::vector<Material>& materials,
+                                  texture::Library& textures,
+                                  const sycl::vec<float, 3>& translation);
+
+  /*  Builds a mesh from vertex positions, 3 vertex indices per face and one
+      material per face, optionally with the texture coordinates of the 3
+      corners of every face. Degenerate faces are dropped, no value is
+      returned if none remain */
+  static std::optional<Mesh> Create(
+      sycl::queue& q, const std::vector<sycl::vec<float, 3>>& vertices,
+      const std::vector<uint32_t>& face_indices,
+      const std::vector<material::Id>& face_material_ids,
+      const std::vector<sycl::vec<float, 2>>& face_texcoords = {});
+
+  /* Releases the shared buffers of every copy of this mesh */
+  void Free(sycl::queue& q);
+
+  SYCL_EXTERNAL MeshTriangle Triangle(uint32_t index) const;
+
+  /*  Moves `hit` to the closest face hit closer than `hit.t`, with the face
+      slot as `hit.primitive`. Returns whether it did */
+  SYCL_EXTERNAL bool Intersect(const Ray& ray, Hit& hit) const;
+
+  /* Normal, material and texture coordinates at a hit found by `Intersect` */
+  SYCL_EXTERNAL Intersector Attributes(const Ray& ray, const Hit& hit) const;
+
+  /* Whether any face is hit closer than `tmax`, stops at the first one */
+  SYCL_EXTERNAL bool Occludes(const Ray& ray, float tmax) const;
 
-  Mesh(const rapidobj::Shape& shape, const rapidobj::Attributes& attributes);
+  SYCL_EXTERNAL bvh::AABB Bounds() const;
 
-  SYCL_EXTERNAL std::optional<Intersector> Intersect(const Ray& ray) const;
+  uint32_t TriangleCount() const;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -4,20 +4,77 @@
 #include <sycl/sycl.hpp>
 
 #include "include/ray.h"
+#include "include/utils.h"
+
+class PlaneArray;
 
 class Plane {
  private:
   sycl::vec<float, 3> point_; /* Point in plane */
   sycl::vec<float, 3> normal_;
 
-  uint8_t material_id_;
+  material::Id material_id_;
+
+  friend class PlaneArray;
 
  public:
+  /* Storage inside `VariantContainer` */
+  using Storage = PlaneArray;
+
   Plane(sycl::vec<float, 3> point, sycl::vec<float, 3> normal,
-        uint8_t material_id)
+        material::Id material_id)
       : point_(point), normal_(normal), material_id_(material_id){};
 
-  SYCL_EXTERNAL std::optional<Intersector> Intersect(const Ray& ray) const;
+  /*  Moves `hit` to the plane if it is hit in front of the ray closer than
+      `hit.t`, returns whether it did */
+  SYCL_EXTERNAL bool Intersect(const Ray& ray, Hit& hit) const;
+
+  /* Normal, material and texture coordinates at a hit found by `Intersect` */
+  SYCL_EXTERNAL Intersector Attributes(const Ray& ray, const Hit& hit) const;
+
+  /* Whether the plane is hit in front of the ray closer than `tmax` */
+  SYCL_EXTERNAL bool Occludes(const Ray& ray, float tmax) const;
+
+  SYCL_EXTERNAL material::Id MaterialId() const { return material_id_; }
+};
+
+/* Planes in structure of arrays layout, see `SphereArray` */
+class PlaneArray {
+ private:
+  containerutils::UsmVector<float> px_;
+  containerutils::UsmVector<float> py_;
+  containerutils::UsmVector<float> pz_;
+  containerutils::UsmVector<float> nx_;
+  containerutils::UsmVector<float> ny_;
+  containerutils::UsmVector<float> nz_;
+  containerutils::UsmVector<material::Id> material_id_;
+
+ public:
+  using value_type = Plane;
+
+  bool Reserve(sycl::queue& q, std::size_t capacity);
+
+  bool push_back(sycl::queue& q, const Plane& plane);
+
+  void Set(std::size_t index, const Plane& plane);
+
+  void Freeze(sycl::queue& q);
+
+  void Free(sycl::queue& q);
+
+  SYCL_EXTERNAL Plane at(std::size_t index) const noexcept;
+
+  SYCL_EXTERNAL std::size_t size() const noexcept { return this->px_.size(); }
+
+  /* Closest plane hit closer than `hit.t`, see `SphereArray::Intersect` */
+  SYCL_EXTERNAL bool Intersect(const Ray& ray, Hit& hit) const;
+
+  SYCL_EXTERNAL Intersector Attributes(const Ray& ray, const Hit& hit) const {
+    return this->at(hit.primitive).Attributes(ray, hit);
+  }
+
+  /* Whether any plane is hit closer than `tmax` */
+  SYCL_EXTERNAL bool Occludes(const Ray& ray, float tmax) const;
 };
 
-#endif
\ No newline at end of file
+#endif
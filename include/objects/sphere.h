@@ -3,20 +3,91 @@
 
 #include <sycl/sycl.hpp>
 
+#include "include/bvh.h"
 #include "include/ray.h"
+#include "include/utils.h"
+
+class SphereArray;
 
 class Sphere {
  private:
   sycl::vec<float, 3> origin_;
   float radius_;
 
-  uint8_t material_id_;
+  material::Id material_id_;
+
+  friend class SphereArray;
 
  public:
-  SYCL_EXTERNAL Sphere(sycl::vec<float, 3> origin, float radius, uint8_t material_id)
+  /* Storage inside `VariantContainer` */
+  using Storage = SphereArray;
+
+  SYCL_EXTERNAL Sphere(sycl::vec<float, 3> origin, float radius,
+                       material::Id material_id)
       : origin_(origin), radius_(radius), material_id_(material_id){};
 
-  SYCL_EXTERNAL std::optional<Intersector> Intersect(const Ray& ray) const;
+  /*  Moves `hit` to the sphere if it is hit in front of the ray closer than
+      `hit.t`, returns whether it did */
+  SYCL_EXTERNAL bool Intersect(const Ray& ray, Hit& hit) const;
+
+  /* Normal, material and texture coordinates at a hit found by `Intersect` */
+  SYCL_EXTERNAL Intersector Attributes(const Ray& ray, const Hit& hit) const;
+
+  /* Whether the sphere is hit in front of the ray closer than `tmax` */
+  SYCL_EXTERNAL bool Occludes(const Ray& ray, float tmax) const;
+
+  SYCL_EXTERNAL bvh::AABB Bounds() const;
+
+  SYCL_EXTERNAL const sycl::vec<float, 3>& Origin() const { return origin_; }
+  SYCL_EXTERNAL float Radius() const { return radius_; }
+  SYCL_EXTERNAL material::Id MaterialId() const { return material_id_; }
+};
+
+/* Spheres in structure of arrays layout, every member in its own contiguous
+   array so closest hit loops stream through them and vectorize */
+class SphereArray {
+ private:
+  containerutils::UsmVector<float> x_;
+  containerutils::UsmVector<float> y_;
+  containerutils::UsmVector<float> z_;
+  containerutils::UsmVector<float> radius_;
+  containerutils::UsmVector<material::Id> material_id_;
+
+ public:
+  using value_type = Sphere;
+
+  bool Reserve(sycl::queue& q, std::size_t capacity);
+
+  bool push_back(sycl::queue& q, const Sphere& sphere);
+
+  void Set(std::size_t index, const Sphere& sphere);
+
+  void Freeze(sycl::queue& q);
+
+  void Free(sycl::queue& q);
+
+  SYCL_EXTERNAL Sphere at(std::size_t index) const noexcept;
+
+  SYCL_EXTERNAL std::size_t size() const noexcept { return this->x_.size(); }
+
+  /*  Moves `hit` to the closest sphere hit closer than `hit.t`, with the
+      sphere's index as `hit.primitive`. Returns whether it did */
+  SYCL_EXTERNAL bool Intersect(const Ray& ray, Hit& hit) const;
+
+  SYCL_EXTERNAL Intersector Attributes(const Ray& ray, const Hit& hit) const {
+    return this->at(hit.primitive).Attributes(ray, hit);
+  }
+
+  /* Whether any sphere is hit closer than `tmax` */
+  SYCL_EXTERNAL bool Occludes(const Ray& ray, float tmax) const;
+
+  /*  `Sphere::Intersect` and `Sphere::Occludes` of the sphere at `index`,
+      reading only the members the test needs. Scene BVH leaves address
+      single spheres and use these instead of building them with `at` */
+  SYCL_EXTERNAL bool IntersectAt(std::size_t index, const Ray& ray,
+                                 Hit& hit) const;
+  SYCL_EXTERNAL bool OccludesAt(std::size_t index, const Ray& ray,
+                                float tmax) const;
 };
 
-#endif
\ No newline at end of file
+#endif
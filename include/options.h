@@ -0,0 +1,79 @@
+#ifndef PATHTRACER_INCLUDE_OPTIONS_H_
+#define PATHTRACER_INCLUDE_OPTIONS_H_
+
+#include <string>
+#include <vector>
+
+#include "include/dynamic.h"
+#include "include/render.h"
+#include "include/tiles.h"
+#include "include/utils.h"
+
+/* Command line options of the pathtracer */
+struct Options {
+  /* Render without a window straight into a file */
+  bool headless = false;
+  /* Use the wavefront pipeline instead of the megakernel */
+  bool wavefront = false;
+  /* Sort continuation rays by origin and direction between the wavefront
+     bounces */
+  bool sort_rays = false;
+  /* Schedule the megakernel over tiles on CPU devices */
+  bool tiles = true;
+  /* Edge length of the scheduled tiles in pixels */
+  int tile_size = kDefaultTileSize;
+  /* Sample emitters directly at every path vertex */
+  bool nee = true;
+  /* SYCL device to render on, one of `default`, `cpu` or `gpu` */
+  std::string device = "default";
+
+  /* OBJ file rendered instead of the built-in scene, empty for none */
+  std::string obj;
+  /* Precompiled scene file loaded instead of the built-in scene, see
+     `SceneFile` */
+  std::string scene;
+
+  int width = kImageWidth;
+  int height = kImageHeight;
+
+  /* Maximum number of bounces of a path */
+  int max_depth = kMaxRayDepth;
+  /* Low discrepancy Sobol or white noise Philox random numbers */
+  miscutils::SamplerType sampler = miscutils::SamplerType::kSobol;
+  /* Occlusion distance of the ambient occlusion mode, 0 renders light
+     transport */
+  float ambient_occlusion = 0.0f;
+
+  /* Samples per pixel to accumulate in headless mode, the maximum per pixel
+     with adaptive sampling */
+  int samples = 64;
+  /* Relative standard error adaptive sampling stops pixels at, 0 samples
+     every pixel equally */
+  float adaptive_error = 0.0f;
+  /* Headless output, `.pfm` for linear float output and PPM otherwise */
+  std::string output = "render.ppm";
+  /* Filter the accumulation guided by the first hit features */
+  bool denoise = false;
+  /* Also write the first hit albedo, normal and depth next to the output */
+  bool aovs = false;
+  /* Print the cost counters and write their heatmaps next to the output,
+     needs a build with `PATHTRACER_STATS` */
+  bool stats = false;
+
+  /* Frames of the animated scene to render headless, each with `samples`
+     samples, 0 for a still image. The viewer animates if it is nonzero */
+  int animate = 0;
+  /* Relative BVH cost growth that triggers a rebuild instead of a refit */
+  float rebuild_threshold = kDefaultRebuildThreshold;
+
+  /* `host:port` to serve sample ranges on as a worker, empty for none */
+  std::string worker;
+  /* `host:port` of the workers to split the samples over as coordinator */
+  std::vector<std::string> workers;
+};
+
+/* Parses `argv` into `options`. Prints the usage and returns false on invalid
+   or unknown arguments and on `--help` */
+bool ParseOptions(int argc, char** argv, Options& options);
+
+#endif
@@ -3,25 +3,67 @@
 
 #include <sycl/sycl.hpp>
 
+#include "include/material.h"
+#include "include/stats.h"
+
 struct Ray {
   sycl::vec<float, 3> origin;
   sycl::vec<float, 3> dir; /* Normalized direction vector */
 
   int depth;
+  /*  Set if the ray left its origin in a direction emitter samples cannot
+      pick, like off glass, so the emitter it hits adds its emission */
+  bool specular;
+
+  /*  Ray cone for texture filtering: the width of the footprint at the origin
+      and its growth per unit of distance */
+  float cone_width;
+  float cone_spread;
+
+#ifdef PATHTRACER_STATS
+  /* Counters of the sample the ray belongs to, `nullptr` to not count */
+  stats::Counters* counters = nullptr;
+#endif
 
   SYCL_EXTERNAL Ray(sycl::vec<float, 3> origin, sycl::vec<float, 3> dir)
-      : origin(origin), dir(dir), depth(0){};
+      : origin(origin), dir(dir), depth(0), specular(false), cone_width(0.0f),
+        cone_spread(0.0f){};
+
+  SYCL_EXTERNAL Ray()
+      : depth(0), specular(false), cone_width(0.0f), cone_spread(0.0f){};
+
+  /* Width of the ray cone at distance `t` */
+  SYCL_EXTERNAL float ConeWidth(float t) const {
+    return this->cone_width + this->cone_spread * t;
+  }
+};
 
-  SYCL_EXTERNAL Ray() : depth(0) {};
+/*  Closest hit of an intersection search so far. The search only compares
+    distances, the attributes of the hit are derived once it is over, see
+    `Intersector` */
+struct Hit {
+  float t = INFINITY;
+  /*  Face of a mesh or object of a storage searched as a whole, like
+      `SphereArray`. Unused by single spheres and planes */
+  uint32_t primitive = 0;
 };
 
+/* Attributes of the closest hit of a ray */
 struct Intersector {
   float t;
   sycl::vec<float, 3> normal;
-  uint8_t material_id;
+  material::Id material_id;
+  /* Texture coordinates of the hit */
+  sycl::vec<float, 2> uv;
+  /*  Base 2 logarithm of the texture coordinate change per unit of surface
+      length, half the logarithm of texture over surface area */
+  float lod;
 
-  SYCL_EXTERNAL Intersector(float t, sycl::vec<float, 3> normal, uint8_t material_id)
-      : t(t), normal(normal), material_id(material_id){};
+  SYCL_EXTERNAL Intersector(float t, sycl::vec<float, 3> normal,
+                            material::Id material_id,
+                            sycl::vec<float, 2> uv = {0.0f, 0.0f},
+                            float lod = 0.0f)
+      : t(t), normal(normal), material_id(material_id), uv(uv), lod(lod){};
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,70 @@
+#ifndef PATHTRACER_INCLUDE_RENDER_H_
+#define PATHTRACER_INCLUDE_RENDER_H_
+
+#include <cstdint>
+#include <vector>
+
+#include <sycl/sycl.hpp>
+
+#include "include/scene.h"
+
+const int kImageWidth = 1024;
+const int kImageHeight = 512;
+
+/* Antialiasing block */
+const int kAABlockWidth = 2;
+const int kAABlockHeight = 2;
+
+const int kSamplesPerPixel = 1;
+
+/* Default path length limit, see `Scene::max_depth` */
+const int kMaxRayDepth = 16;
+/* Bounces every path survives before Russian roulette may end it */
+const int kRouletteDepth = 3;
+
+/* Square pixel tiles adaptive sampling decides on, see `AdaptiveSampler` */
+const int kAdaptiveTileSize = 8;
+
+namespace render {
+/* Progressive accumulation state that the next batch of samples is added to */
+struct Frame {
+  int width;
+  int height;
+
+  float* image;         /* Linear RGB sample sums, `width*height*3` floats */
+  uint8_t* framebuffer; /* Gamma corrected RGB8 output, may be `nullptr` */
+
+  int executed_samples;       /* Samples accumulated in `image` so far */
+  int total_executed_samples; /* Samples ever executed, used for seeding */
+
+  /*  Adaptive sampling state, all `nullptr` when every pixel is sampled.
+      Pixels in tiles whose `active_tiles` entry is 0 are skipped, so the
+      sample count differs per pixel and is kept in `sample_counts` */
+  float* squares = nullptr;          /* Sums of squared batch luminances */
+  uint32_t* sample_counts = nullptr; /* Samples accumulated per pixel */
+  const uint8_t* active_tiles = nullptr;
+
+  /*  First hit features guiding the denoiser, summed over the samples like
+      `image`. All `nullptr` unless a `Denoiser` is attached */
+  float* albedo = nullptr; /* `width*height*3` */
+  float* normal = nullptr; /* `width*height*3`, facing the camera */
+  float* depth = nullptr;  /* `width*height`, hit distance, 0 for misses */
+
+  /*  Cost counters summed over the samples like `image`, `width*height`.
+      `nullptr` unless a `stats::Heatmap` is attached, never filled in builds
+      without `PATHTRACER_STATS` */
+  stats::Counters* counters = nullptr;
+};
+
+/* Submits `kSamplesPerPixel` samples for every pixel of `frame`. If
+   `executed_samples` is 0 the accumulation in `image` is restarted. The
+   dimensions of the frame have to be multiples of the antialiasing block.
+   The kernels start once `depends_on` completes, usually the previous batch
+   into the same image, and the camera is read at submission, so it may be
+   moved while the batch runs */
+sycl::event RenderSamples(sycl::queue& q, const Scene& scene,
+                          const Frame& frame,
+                          const std::vector<sycl::event>& depends_on = {});
+}  // namespace render
+
+#endif
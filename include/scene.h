@@ -0,0 +1,40 @@
+#ifndef PATHTRACER_INCLUDE_SCENE_H_
+#define PATHTRACER_INCLUDE_SCENE_H_
+
+#include <sycl/sycl.hpp>
+
+#include "include/camera.h"
+#include "include/emitter.h"
+#include "include/material.h"
+#include "include/object.h"
+#include "include/texture.h"
+#include "include/utils.h"
+
+/* Everything a render kernel needs to know about the world. All pointers
+   point to shared (unified) memory so the struct itself can be copied into
+   kernels by value */
+struct Scene {
+  Camera* camera;
+  Material* materials;
+  /* Textures referenced by the materials */
+  texture::Atlas textures;
+  containerutils::VariantContainer<Objects>* objects;
+  /* Meshes placed through `Instance` objects, owned by the scene and
+     shared by all instances of them. Only used on the host */
+  Mesh* geometries = nullptr;
+  uint32_t geometry_count = 0;
+  /* Built over `objects` once the scene is filled, the top level structure
+     over the mesh BVHs of the instances */
+  SceneBVH bvh;
+  /* Emissive objects sampled for direct light, empty if disabled */
+  EmitterList emitters;
+  /* Maximum number of bounces of a path */
+  int max_depth;
+  /* Random numbers of the paths, see `miscutils::SobolSampler` */
+  miscutils::SamplerType sampler;
+  /* Renders ambient occlusion within this distance instead of light
+     transport if positive, see `render::ShadeAmbientOcclusion` */
+  float ambient_occlusion = 0.0f;
+};
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef PATHTRACER_INCLUDE_SCENE_FILE_H_
+#define PATHTRACER_INCLUDE_SCENE_FILE_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <sycl/sycl.hpp>
+
+#include "include/camera.h"
+#include "include/material.h"
+#include "include/object.h"
+#include "include/texture.h"
+
+/* Bumped whenever the layout of a stored type or of the file changes */
+const uint32_t kSceneFileVersion = 4;
+
+/*  Precompiled scenes. A scene file holds the camera, the materials, all
+    objects including the buffers and BVHs of meshes, the geometries shared
+    by instances and the scene BVH, so loading it involves no parsing and no
+    building. Every array is stored as
+    the raw bytes of its elements, 16 byte aligned and prefixed by its length
+    and element size:
+
+      header      magic "PTSCENE", version
+      camera
+      materials
+      textures    texels, levels and textures of the atlas
+      spheres, planes
+      meshes      count, then per mesh its bounds and buffers, texture
+                  coordinates empty if it has none
+      geometries  same as the meshes
+      instances   geometry index and transform of every instance
+      scene BVH   nodes and leaf references
+
+    The files are specific to the architecture and the build that wrote them,
+    the element sizes and the version catch most mismatches. Files are
+    written by the `pathtracer_convert` tool */
+class SceneFile {
+ public:
+  /*  Writes a scene whose `bvh` was built over `objects`. The instances
+      among `objects` reference `geometries` by index, the materials
+      reference `textures`. Prints the reason and returns false on failure */
+  static bool Write(const std::string& path, const Camera& camera,
+                    const std::vector<Material>& materials,
+                    const texture::HostAtlas& textures,
+                    const std::vector<Mesh>& geometries,
+                    const containerutils::VariantContainer<Objects>& objects,
+                    const SceneBVH& bvh);
+
+  /*  Maps the file at `path` and copies its arrays into shared memory. The
+      objects are appended to the empty container `objects` and the meshes
+      their instances share to `geometries`. The textures stay on the host
+      for `texture::Upload`. Prints the reason and returns false on failure,
+      anything loaded so far is freed again then */
+  static bool Read(sycl::queue& q, const std::string& path, Camera& camera,
+                   std::vector<Material>& materials,
+                   texture::HostAtlas& textures,
+                   std::vector<Mesh>& geometries,
+                   containerutils::VariantContainer<Objects>& objects,
+                   SceneBVH& bvh);
+};
+
+#endif
@@ -0,0 +1,109 @@
+#ifndef PATHTRACER_INCLUDE_STATS_H_
+#define PATHTRACER_INCLUDE_STATS_H_
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include <sycl/sycl.hpp>
+
+/*  Per pixel cost counters. They are only collected in builds with
+    `PATHTRACER_STATS` defined (CMake option of the same name), otherwise every
+    counting site compiles to nothing and rays carry no counter pointer.
+
+    Rays point to the counters of the pixel sample they belong to, the
+    traversal and intersection routines count through that pointer and the
+    integrator adds the counters of a batch to the frame like the radiance */
+#ifdef PATHTRACER_STATS
+#define PATHTRACER_COUNT(ray, counter, n)                          \
+  do {                                                             \
+    if ((ray).counters != nullptr) (ray).counters->counter += (n); \
+  } while (0)
+#else
+#define PATHTRACER_COUNT(ray, counter, n) \
+  do {                                    \
+  } while (0)
+#endif
+
+namespace render {
+struct Frame;
+}  // namespace render
+
+namespace stats {
+#ifdef PATHTRACER_STATS
+constexpr bool kEnabled = true;
+#else
+constexpr bool kEnabled = false;
+#endif
+
+struct Counters {
+  uint32_t rays = 0;            /* Closest hit and occlusion queries */
+  uint32_t primitive_tests = 0; /* Object and triangle intersection tests */
+  uint32_t nodes_visited = 0;   /* Scene and mesh BVH nodes entered */
+  uint32_t bounces = 0;         /* Path vertices shaded */
+
+  SYCL_EXTERNAL Counters& operator+=(const Counters& other) {
+    this->rays += other.rays;
+    this->primitive_tests += other.primitive_tests;
+    this->nodes_visited += other.nodes_visited;
+    this->bounces += other.bounces;
+    return *this;
+  }
+};
+
+/* Counter shown by a heatmap */
+enum class Counter : uint8_t { kRays, kPrimitiveTests, kNodesVisited, kBounces };
+const int kCounterCount = 4;
+
+/* Short lowercase name, used for file names and the viewer title */
+const char* CounterName(Counter counter);
+
+SYCL_EXTERNAL inline uint32_t Get(const Counters& counters, Counter counter) {
+  switch (counter) {
+    case Counter::kRays:
+      return counters.rays;
+    case Counter::kPrimitiveTests:
+      return counters.primitive_tests;
+    case Counter::kNodesVisited:
+      return counters.nodes_visited;
+    default:
+      return counters.bounces;
+  }
+}
+
+/*  Owns the per pixel counters of a frame and turns them into heatmaps. The
+    counters are summed over the samples like the image and restarted with
+    it */
+class Heatmap {
+ private:
+  int width_;
+  int height_;
+
+  Counters* counters_;  /* Per pixel, in device memory */
+  uint32_t* maximum_;   /* Bits of the largest per sample mean, shared */
+
+ public:
+  Heatmap(sycl::queue& q, int width, int height);
+
+  void Free(sycl::queue& q);
+
+  /* Points the counters of `frame` at this heatmap */
+  void Attach(render::Frame& frame) const;
+
+  /*  Colors every pixel by its mean of `counter` per sample relative to the
+      largest mean of the frame, blue for cheap up to white for the most
+      expensive pixels. `samples` is the number of samples accumulated per
+      pixel, ignored if `frame` counts them per pixel. Linear colors are
+      written to `output` (`width*height*3` floats) and display values to
+      `frame.framebuffer`, either may be `nullptr` */
+  sycl::event Draw(sycl::queue& q, const render::Frame& frame, Counter counter,
+                   int samples, float* output,
+                   const std::vector<sycl::event>& depends_on = {});
+
+  /* Sums of the counters over all pixels indexed by `Counter`, waits for
+     the device */
+  std::array<uint64_t, kCounterCount> Totals(sycl::queue& q) const;
+};
+}  // namespace stats
+
+#endif
@@ -0,0 +1,159 @@
+#ifndef PATHTRACER_INCLUDE_TEXTURE_H_
+#define PATHTRACER_INCLUDE_TEXTURE_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <sycl/sycl.hpp>
+
+/*  Mip-mapped textures. All textures of a scene live in one atlas in device
+    memory: every mip level is cut into square tiles of `kTileSize` texels
+    that are stored contiguously, so the 2x2 footprint of a bilinear lookup
+    touches one or two cache lines instead of two rows of the image, and the
+    mip level is picked from the ray footprint so distant and indirect hits
+    read small, cache resident levels */
+namespace texture {
+/* Index into the textures of an atlas */
+using Id = uint16_t;
+/* Id of materials without a texture */
+const Id kNone = 0xFFFF;
+
+/* Edge length of a tile, 16 texels of 4 bytes fill a 64 byte cache line */
+const int kTileSize = 4;
+/* Levels of the largest texture, 32768 texels wide */
+const int kMaxLevels = 16;
+
+/*  8-bit texel. Color textures store the square root of the linear value,
+    which keeps precision in the darks and decodes with one multiplication.
+    Data textures (roughness, metallic) are linear and use the red channel */
+struct alignas(4) Texel {
+  uint8_t r, g, b, a;
+};
+
+/* One mip level, padded to whole tiles */
+struct Level {
+  uint32_t offset; /* First texel in `Atlas::texels` */
+  uint16_t width;
+  uint16_t height;
+  uint16_t tiles_x; /* Tiles per row */
+};
+
+struct Texture {
+  uint32_t first_level; /* Index into `Atlas::levels`, the full size level */
+  uint16_t level_count; /* Down to 1x1 */
+  uint16_t color;       /* Square root encoded, see `Texel` */
+};
+
+/*  Device copy of all textures of a scene, cheap to copy into kernels. An
+    empty atlas has no buffers */
+struct Atlas {
+  Texel* texels = nullptr;
+  Level* levels = nullptr;
+  Texture* textures = nullptr;
+  uint32_t texture_count = 0;
+};
+
+/* Host copy of an atlas in the same layout, see `Library::Build` */
+struct HostAtlas {
+  std::vector<Texel> texels;
+  std::vector<Level> levels;
+  std::vector<Texture> textures;
+};
+
+/* Linear value of a texel */
+SYCL_EXTERNAL inline sycl::vec<float, 3> Decode(const Texel& texel,
+                                                bool color) {
+  sycl::vec<float, 3> value =
+      sycl::vec<float, 3>{(float)texel.r, (float)texel.g, (float)texel.b} *
+      (1.0f / 255.0f);
+  return color ? value * value : value;
+}
+
+/*  Bilinear lookup in `level`. Coordinates repeat outside [0, 1), v = 0 is
+    the bottom row as in OBJ files */
+SYCL_EXTERNAL inline sycl::vec<float, 3> Bilinear(const Atlas& atlas,
+                                                  const Level& level,
+                                                  bool color,
+                                                  sycl::vec<float, 2> uv) {
+  float x = (uv.x() - sycl::floor(uv.x())) * level.width - 0.5f;
+  float y = (uv.y() - sycl::floor(uv.y())) * level.height - 0.5f;
+  float x0 = sycl::floor(x), y0 = sycl::floor(y);
+  float fx = x - x0, fy = y - y0;
+
+  auto fetch = [&](int tx, int ty) {
+    /* Wraps around, `tx` and `ty` are at least -1 */
+    uint32_t px = (uint32_t)(tx + level.width) % level.width;
+    uint32_t py = (uint32_t)(ty + level.height) % level.height;
+    uint32_t tile = (py / kTileSize) * level.tiles_x + px / kTileSize;
+    uint32_t index = level.offset + tile * kTileSize * kTileSize +
+                     (py % kTileSize) * kTileSize + px % kTileSize;
+    return Decode(atlas.texels[index], color);
+  };
+
+  int ix = (int)x0, iy = (int)y0;
+  sycl::vec<float, 3> bottom =
+      fetch(ix, iy) * (1.0f - fx) + fetch(ix + 1, iy) * fx;
+  sycl::vec<float, 3> top =
+      fetch(ix, iy + 1) * (1.0f - fx) + fetch(ix + 1, iy + 1) * fx;
+  return bottom * (1.0f - fy) + top * fy;
+}
+
+/*  Trilinear lookup of texture `id` at `uv`. `lod` is the base 2 logarithm
+    of the ray footprint in texture space with texture coordinates in [0, 1),
+    the size of the texture is added here. Footprints below a texel read the
+    full size level, larger ones blend the two closest levels */
+SYCL_EXTERNAL inline sycl::vec<float, 3> Sample(const Atlas& atlas, Id id,
+                                                sycl::vec<float, 2> uv,
+                                                float lod) {
+  const Texture& texture = atlas.textures[id];
+  const Level& full = atlas.levels[texture.first_level];
+  float level = lod + 0.5f * sycl::log2((float)full.width * full.height);
+  /* Also maps NaN footprints, like the one of a grazing ray, to level 0 */
+  level = sycl::fmin(sycl::fmax(level, 0.0f), texture.level_count - 1.0f);
+
+  int fine = (int)level;
+  float blend = level - fine;
+  sycl::vec<float, 3> value = Bilinear(
+      atlas, atlas.levels[texture.first_level + fine], texture.color, uv);
+  if (blend > 0.0f) {
+    value = value * (1.0f - blend) +
+            Bilinear(atlas, atlas.levels[texture.first_level + fine + 1],
+                     texture.color, uv) * blend;
+  }
+  return value;
+}
+
+/*  Textures loaded on the host, each image only once. Images are read from
+    binary PPM (P6, 8 bit, gamma 2.2 encoded as written by the tracer) and
+    PFM (linear) files */
+class Library {
+ private:
+  struct Image {
+    std::string path;
+    bool color;
+    int width;
+    int height;
+    std::vector<float> rgb; /* Linear, bottom row first */
+  };
+  std::vector<Image> images_;
+
+ public:
+  /*  Id of the texture from the image at `path`, loaded on first use.
+      `color` marks albedo textures, PPM data textures are not gamma
+      decoded. Prints the reason and returns `kNone` on failure */
+  Id Add(const std::string& path, bool color);
+
+  std::size_t size() const { return images_.size(); }
+
+  /* Mip chains of all textures in the tiled atlas layout */
+  HostAtlas Build() const;
+};
+
+/* Copies an atlas into device memory, waits for the copies */
+Atlas Upload(sycl::queue& q, const HostAtlas& host);
+
+void Free(Atlas& atlas, sycl::queue& q);
+}  // namespace texture
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef PATHTRACER_INCLUDE_TILES_H_
+#define PATHTRACER_INCLUDE_TILES_H_
+
+#include <cstdint>
+#include <vector>
+
+#include <sycl/sycl.hpp>
+
+#include "include/render.h"
+#include "include/scene.h"
+
+/* Tile edge length in pixels the tile scheduler uses by default on CPUs */
+const int kDefaultTileSize = 16;
+
+namespace render {
+/*  Megakernel scheduled over square pixel tiles for CPU devices. Instead of
+    one work item per pixel, one long running work item per compute unit
+    (worker) renders whole tiles:
+
+    - Tiles are ordered along a Morton curve, so consecutive tiles are close
+      in the image and share the scene data they touch in the caches.
+    - Every worker owns a contiguous range of that order and takes tiles from
+      its front. Once empty it steals from the back of the ranges of the
+      others, far away from where their owners are working, until no tile
+      is left anywhere. Expensive regions of the image thus never leave
+      workers idle.
+
+    Produces the same image as `render::RenderSamples` */
+class TileScheduler {
+ private:
+  int width_;
+  int height_;
+  int tile_size_;
+  uint32_t tile_count_;
+  uint32_t workers_;
+
+  /* Tile origins packed as `y << 16 | x` in Morton order, device memory */
+  uint32_t* tiles_;
+  /*  Range of tiles every worker still has to render, packed as
+      `end << 32 | begin` so both ends change with a single atomic. The live
+      ranges are restored from the initial ones before every batch */
+  uint64_t* ranges_;
+  uint64_t* initial_ranges_;
+
+  template <class Sampler>
+  sycl::event Submit(sycl::queue& q, const Scene& scene, const Frame& frame,
+                     const std::vector<sycl::event>& depends_on);
+
+ public:
+  /* `workers` 0 uses one worker per compute unit of the queue's device */
+  TileScheduler(sycl::queue& q, int width, int height, int tile_size,
+                uint32_t workers = 0);
+
+  void Free(sycl::queue& q);
+
+  /* Same contract as `render::RenderSamples` */
+  sycl::event RenderSamples(sycl::queue& q, const Scene& scene,
+                            const Frame& frame,
+                            const std::vector<sycl::event>& depends_on = {});
+
+  uint32_t TileCount() const { return this->tile_count_; }
+  uint32_t Workers() const { return this->workers_; }
+};
+}  // namespace render
+
+#endif
@@ -1,7 +1,10 @@
 #ifndef PATHTRACER_INCLUDE_UTILS_H_
 #define PATHTRACER_INCLUDE_UTILS_H_
 
+#include <algorithm>
 #include <array>
+#include <memory>
+#include <tuple>
 #include <vector>
 #include <variant>
 #include <type_traits>
@@ -10,10 +13,12 @@
 
 #include <sycl/sycl.hpp>
 
-
-const int kStackVectorCapacity = 32;
-
 namespace vecutils {
+/* Luminance of linear RGB */
+SYCL_EXTERNAL inline float Luminance(const sycl::vec<float, 3>& color) {
+  return 0.2126f * color.x() + 0.7152f * color.y() + 0.0722f * color.z();
+}
+
 template <typename T>
 SYCL_EXTERNAL sycl::vec<T,3> Lerp(const sycl::vec<T,3>& a, const sycl::vec<T,3>& b,
                             float r) {
@@ -38,17 +43,66 @@ SYCL_EXTERNAL void PlaneVectors(const sycl::vec<T, 3>& n, sycl::vec<T, 3>& u,
 namespace miscutils {
 SYCL_EXTERNAL int ShadowFactor(float a);
 
-class XorShiftPRNG {
+/*  Samplers hand out the random numbers of one path sample as floats in
+    [0, 1). They are pure functions of (pixel, sample, dimension), every call
+    returns the next dimension, so a sampler can be rebuilt anywhere from
+    these three numbers and no generator state has to be stored or
+    carried between kernels. Both samplers only use 32-bit integer math */
+enum class SamplerType : uint8_t { kSobol, kPhilox };
+
+/* Counter-based Philox4x32-10 generator, white noise */
+class PhiloxSampler {
 private:
-  uint64_t state_;
+  uint32_t pixel_;
+  uint32_t sample_;
+  uint32_t dimension_;
 
 public:
-  SYCL_EXTERNAL XorShiftPRNG(uint64_t seed) : state_(seed) {};
+  SYCL_EXTERNAL PhiloxSampler(uint32_t pixel, uint32_t sample,
+                              uint32_t dimension = 0)
+      : pixel_(pixel), sample_(sample), dimension_(dimension) {};
+
+  SYCL_EXTERNAL float operator()();
 
-  SYCL_EXTERNAL double operator()();
+  /* Skips to the start of the next group of 4 dimensions */
+  SYCL_EXTERNAL void NextGroup() {
+    this->dimension_ = (this->dimension_ + 3) & ~3u;
+  }
+
+  /* Next dimension, constructing a sampler with it continues the sequence */
+  SYCL_EXTERNAL uint32_t Dimension() const { return this->dimension_; }
 };
 
-SYCL_EXTERNAL uint64_t Hash64(uint64_t i);
+/*  Owen-scrambled Sobol sequence with hash-based nested uniform scrambling
+    (Burley 2020). Dimensions are consumed in groups of 4 drawn from the
+    first 4 Sobol dimensions, each group with its own shuffled sample order
+    and scrambling seed per pixel. Every group is stratified on its own and
+    pixels are decorrelated */
+class SobolSampler {
+private:
+  uint32_t pixel_;
+  uint32_t sample_;
+  uint32_t dimension_;
+
+public:
+  SYCL_EXTERNAL SobolSampler(uint32_t pixel, uint32_t sample,
+                             uint32_t dimension = 0)
+      : pixel_(pixel), sample_(sample), dimension_(dimension) {};
+
+  SYCL_EXTERNAL float operator()();
+
+  /* Dimensions drawn together from one group are stratified together */
+  SYCL_EXTERNAL void NextGroup() {
+    this->dimension_ = (this->dimension_ + 3) & ~3u;
+  }
+
+  SYCL_EXTERNAL uint32_t Dimension() const { return this->dimension_; }
+};
+
+SYCL_EXTERNAL uint32_t Hash32(uint32_t x);
+
+/* Interleaves the bits of two 16 bit coordinates, `x` in the even bits */
+SYCL_EXTERNAL uint32_t Morton2D(uint32_t x, uint32_t y);
 };  // namespace miscutils
 
 namespace containerutils {
@@ -105,47 +159,121 @@ static constexpr std::size_t assert_in_variant() {
   return T_index;
 }
 
-/* No except vector that uses the stack and thus cannot be expanded */
-template <typename T, std::size_t N>
-class StackVector {
+/*  Vector in shared USM that grows on the host while a scene is filled and is
+    read on the host and the device afterwards. It is a plain handle, copies
+    share the allocation and the owner has to call `Free` */
+template <typename T>
+class UsmVector {
  private:
-  /* Uninitialized aligned storage for `T` */
-  std::aligned_storage_t<sizeof(T), alignof(T)> data_[N];
+  T* data_ = nullptr;
   std::size_t size_ = 0;
+  std::size_t capacity_ = 0;
 
  public:
-  SYCL_EXTERNAL StackVector() : size_(0){};
+  using value_type = T;
 
-  /* Returns false on unsuccessful operations */
-  SYCL_EXTERNAL bool push_back_if(T value) noexcept {
-    if (this->size_ >= N) return false;
+  /* Grows the allocation to hold at least `capacity` elements, returns false
+     if the allocation failed */
+  bool Reserve(sycl::queue& q, std::size_t capacity) {
+    if (capacity <= this->capacity_) return true;
 
-    this->at(this->size_++) = value;
+    T* data = sycl::malloc_shared<T>(capacity, q);
+    if (data == nullptr) return false;
+
+    std::uninitialized_copy(this->data_, this->data_ + this->size_, data);
+    if (this->data_ != nullptr) sycl::free(this->data_, q);
+    this->data_ = data;
+    this->capacity_ = capacity;
     return true;
   }
 
-  SYCL_EXTERNAL bool pop_if() noexcept {
-    if (this->size_ <= 0) return false;
+  /* Amortized constant time, the capacity doubles when full */
+  bool push_back(sycl::queue& q, const T& value) {
+    if (this->size_ == this->capacity_ &&
+        !this->Reserve(q, std::max<std::size_t>(16, 2 * this->capacity_))) {
+      return false;
+    }
 
-    --this->size_;
+    new (&this->data_[this->size_++]) T(value);
     return true;
   }
 
+  /* Overwrites the element at `index` */
+  void Set(std::size_t index, const T& value) { this->data_[index] = value; }
+
+  /* Drops the unused capacity and migrates the data to the device of `q`
+     ahead of the first kernel */
+  void Freeze(sycl::queue& q) {
+    if (this->size_ == 0) return;
+
+    if (this->size_ < this->capacity_) {
+      T* data = sycl::malloc_shared<T>(this->size_, q);
+      if (data != nullptr) {
+        std::uninitialized_copy(this->data_, this->data_ + this->size_, data);
+        sycl::free(this->data_, q);
+        this->data_ = data;
+        this->capacity_ = this->size_;
+      }
+    }
+    q.prefetch(this->data_, this->size_ * sizeof(T));
+  }
+
+  void Free(sycl::queue& q) {
+    if (this->data_ != nullptr) sycl::free(this->data_, q);
+    this->data_ = nullptr;
+    this->size_ = 0;
+    this->capacity_ = 0;
+  }
+
   SYCL_EXTERNAL const T& at(std::size_t index) const noexcept {
-    return *std::launder(reinterpret_cast<const T*>(&this->data_[index]));
+    return this->data_[index];
   }
   SYCL_EXTERNAL const T& operator[](std::size_t index) const noexcept {
-    return *std::launder(reinterpret_cast<const T*>(&this->data_[index]));
+    return this->data_[index];
   }
 
-  SYCL_EXTERNAL T& at(std::size_t index) noexcept {
-    return *std::launder(reinterpret_cast<T*>(&this->data_[index]));
-  }
+  SYCL_EXTERNAL T& at(std::size_t index) noexcept { return this->data_[index]; }
   SYCL_EXTERNAL T& operator[](std::size_t index) noexcept {
-    return *std::launder(reinterpret_cast<T*>(&this->data_[index]));
+    return this->data_[index];
   }
 
+  SYCL_EXTERNAL const T* data() const noexcept { return this->data_; }
   SYCL_EXTERNAL std::size_t size() const noexcept { return this->size_; }
+  SYCL_EXTERNAL std::size_t capacity() const noexcept {
+    return this->capacity_;
+  }
+};
+
+/*  Storage `VariantContainer` keeps the objects of type `T` in. Types can
+    bring their own storage, typically a structure of arrays, by declaring it
+    as `T::Storage`. It has to provide `value_type`, `at(index)` and `size()`
+    for the device, `Reserve`, `push_back`, `Freeze` and `Free` taking a
+    `sycl::queue&` and `Set(index, value)` for the host like `UsmVector`,
+    which is the default */
+template <typename T, typename = void>
+struct storage_of {
+  using type = UsmVector<T>;
+};
+
+template <typename T>
+struct storage_of<T, std::void_t<typename T::Storage>> {
+  using type = typename T::Storage;
+};
+
+/* `std::tuple` of the storages of all types in a `std::variant` */
+template <typename V>
+struct variant_storage;
+
+template <typename... Ts>
+struct variant_storage<std::variant<Ts...>> {
+  using type = std::tuple<typename storage_of<Ts>::type...>;
+};
+
+/* Addresses an object inside a `VariantContainer` by the index of its type in
+   the variant and its index among the objects of that type */
+struct ElementRef {
+  uint32_t type;
+  uint32_t index;
 };
 
 /*  Dynamic polymorphism with virtual functions is not allowed in SYCL and I had
@@ -153,22 +281,30 @@ class StackVector {
    `std::variant` with a function pointer-free approach. The solution is to
    implement a container that holds a `std::variant` type and to allow all types
    declared inside the given `std::variant` to be pushed or poped from the
-   container. Each type inside the given `std::variant` has each own
-   `std::vector` attached. All this is done to decrease the number of switch and
-   if-else statements (branches) later */
+   container. Each type inside the given `std::variant` has its own storage
+   attached, see `storage_of`. No `std::variant` is ever stored, so objects
+   are not padded to the largest type and types with a structure of arrays
+   storage keep their members in contiguous arrays. All this is done to
+   decrease the number of switch and if-else statements (branches) and the
+   memory traffic later.
+
+   The storages live in shared USM and grow without limit on the host. Once
+   the scene is complete the container is frozen, which trims and migrates
+   the storages to the device. Kernels only read a frozen container, the
+   container itself is placed in shared memory and passed by pointer */
 template <typename VARIANT>
 class VariantContainer {
  private:
-  /* Holding an individual vector for each type */
-  StackVector<VARIANT, kStackVectorCapacity>
-      data_[std::variant_size_v<VARIANT>];
+  /* Holding an individual storage for each type */
+  typename variant_storage<VARIANT>::type data_;
 
-  StackVector<VARIANT*, kStackVectorCapacity * std::variant_size_v<VARIANT>>
-      lookup_;
+  /* Insertion order of all objects, for `useAt` with a single index */
+  UsmVector<ElementRef> lookup_;
 
- public:
-  SYCL_EXTERNAL VariantContainer() : data_{}, lookup_{} {};
+  bool frozen_ = false;
 
+ public:
+  VariantContainer() : data_{}, lookup_{} {};
   /*  Because `std::get<T>` in `variant_iterator` has to accept a constexpr
       index we cannot simply use a for loop through to go through all types
       in the given variant and call the function we want. (NOTE that `F func`
@@ -193,10 +329,9 @@ class VariantContainer {
   template <typename F, std::size_t I = 0>
   SYCL_EXTERNAL void forEach(F&& func) const {
     if constexpr (I < std::variant_size_v<VARIANT>) {
-      for (std::size_t i = 0; i < this->data_[I].size(); i++) {
-        /* We use noexcept `std::get_if` because we can guarantee that variant
-         * indexes out of bounds are not possible */
-        func(*std::get_if<I>(&this->data_[I].at(i)));
+      const auto& storage = std::get<I>(this->data_);
+      for (std::size_t i = 0; i < storage.size(); i++) {
+        func(storage.at(i));
       }
       forEach<F, I + 1>(std::forward<F>(func));
     } else {
@@ -204,35 +339,132 @@ class VariantContainer {
     }
   }
 
+  /*  Same as `forEach` but `func` is called as `func(obj, type, index)` where
+      `type` is the index of the object type in the variant and `index` the
+      position of the object among the objects of the same type */
   template <typename F, std::size_t I = 0>
-  SYCL_EXTERNAL void useAt(F&& func, std::size_t index) {
+  SYCL_EXTERNAL void forEachIndexed(F&& func) const {
     if constexpr (I < std::variant_size_v<VARIANT>) {
-      if (std::get_if<I>(this->lookup_[index]) == nullptr) {
-        useAt<F, I+1>(std::forward<F>(func), index);
+      const auto& storage = std::get<I>(this->data_);
+      for (std::size_t i = 0; i < storage.size(); i++) {
+        func(storage.at(i), I, i);
+      }
+      forEachIndexed<F, I + 1>(std::forward<F>(func));
+    } else {
+      return;
+    }
+  }
+
+  /*  Calls `func` once per type with the whole storage of that type, for
+      loops that want to stream through a structure of arrays themselves */
+  template <typename F, std::size_t I = 0>
+  SYCL_EXTERNAL void forEachStorage(F&& func) const {
+    if constexpr (I < std::variant_size_v<VARIANT>) {
+      func(std::get<I>(this->data_));
+      forEachStorage<F, I + 1>(std::forward<F>(func));
+    } else {
+      return;
+    }
+  }
+
+  /* Calls `func` on the object addressed the same way as in `forEachIndexed` */
+  template <typename F, std::size_t I = 0>
+  SYCL_EXTERNAL void useAt(F&& func, std::size_t type,
+                           std::size_t index) const {
+    if constexpr (I < std::variant_size_v<VARIANT>) {
+      if (type == I) {
+        func(std::get<I>(this->data_).at(index));
+      } else {
+        useAt<F, I + 1>(std::forward<F>(func), type, index);
+      }
+    } else {
+      return;
+    }
+  }
+
+  /*  Calls `func` with the whole storage of the objects of type `type`, for
+      storages that test a single object without building it */
+  template <typename F, std::size_t I = 0>
+  SYCL_EXTERNAL void useStorage(F&& func, std::size_t type) const {
+    if constexpr (I < std::variant_size_v<VARIANT>) {
+      if (type == I) {
+        func(std::get<I>(this->data_));
       } else {
-        func(*std::get_if<I>(this->lookup_[index]));
+        useStorage<F, I + 1>(std::forward<F>(func), type);
       }
     } else {
       return;
     }
   }
 
+  /* Calls `func` on the `index`th object in insertion order */
+  template <typename F>
+  SYCL_EXTERNAL void useAt(F&& func, std::size_t index) const {
+    const ElementRef& ref = this->lookup_[index];
+    this->useAt(std::forward<F>(func), ref.type, ref.index);
+  }
+
   template <typename T>
   SYCL_EXTERNAL T at(std::size_t index) const {
-    std::size_t T_index = assert_in_variant<VARIANT, T>();
+    constexpr std::size_t T_index = assert_in_variant<VARIANT, T>();
 
-    /* Return the data from the corresponding vector */
-    return this->data_[T_index].at(index);
+    /* Return the data from the corresponding storage */
+    return std::get<T_index>(this->data_).at(index);
   }
 
+  /* Reserves room for `count` objects of type `T` in total, avoids repeated
+     reallocation when the number of objects is known up front */
   template <typename T>
-  SYCL_EXTERNAL void push_back(T value) {
-    std::size_t T_index = assert_in_variant<VARIANT, T>();
-    if (this->data_[T_index].push_back_if(value)) {
-      VARIANT &last = this->data_[T_index].at(this->data_[T_index].size()-1);
-      this->lookup_.push_back_if(std::addressof(last));
+  bool Reserve(sycl::queue& q, std::size_t count) {
+    constexpr std::size_t T_index = assert_in_variant<VARIANT, T>();
+    return std::get<T_index>(this->data_).Reserve(q, count);
+  }
+
+  /* Returns false and prints an error if the object could not be added */
+  template <typename T>
+  bool push_back(sycl::queue& q, T value) {
+    constexpr std::size_t T_index = assert_in_variant<VARIANT, T>();
+    if (this->frozen_) {
+      printf("Error: VariantContainer: push_back after Freeze\n");
+      return false;
+    }
+
+    auto& storage = std::get<T_index>(this->data_);
+    ElementRef ref{(uint32_t)T_index, (uint32_t)storage.size()};
+    if (!storage.push_back(q, value) || !this->lookup_.push_back(q, ref)) {
+      printf("Error: VariantContainer: out of memory after %zu objects\n",
+             this->lookup_.size());
+      return false;
     }
+    return true;
+  }
+
+  /*  Replaces the object of type `T` at `index` among the objects of its
+      type, also after `Freeze`, e.g. to move it. No kernel may read the
+      container meanwhile and BVHs over it have to be refit afterwards */
+  template <typename T>
+  void Set(std::size_t index, const T& value) {
+    constexpr std::size_t T_index = assert_in_variant<VARIANT, T>();
+    std::get<T_index>(this->data_).Set(index, value);
   }
+
+  /* Ends the host side filling, no objects can be added afterwards */
+  void Freeze(sycl::queue& q) {
+    std::apply([&q](auto&... storage) { (storage.Freeze(q), ...); },
+               this->data_);
+    this->lookup_.Freeze(q);
+    this->frozen_ = true;
+  }
+
+  /* Frees the storages, not the objects held in them */
+  void Free(sycl::queue& q) {
+    std::apply([&q](auto&... storage) { (storage.Free(q), ...); },
+               this->data_);
+    this->lookup_.Free(q);
+  }
+
+  /* Total number of objects of all types */
+  SYCL_EXTERNAL std::size_t size() const { return this->lookup_.size(); }
 };
 }  // namespace containerutils
 #endif
\ No newline at end of file
@@ -0,0 +1,110 @@
+#ifndef PATHTRACER_INCLUDE_WAVEFRONT_H_
+#define PATHTRACER_INCLUDE_WAVEFRONT_H_
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include <sycl/sycl.hpp>
+
+#include "include/integrator.h"
+#include "include/material.h"
+#include "include/ray.h"
+#include "include/render.h"
+#include "include/scene.h"
+
+/* Work group size of the 1D queue kernels */
+const int kWavefrontGroupSize = 64;
+/* Bits per axis of the origin cells continuation rays are sorted by */
+const int kRaySortCellBits = 3;
+/* Sort keys, the origin cells of all 8 direction octants */
+const uint32_t kRaySortBins = 8u << (3 * kRaySortCellBits);
+/* Queues shorter than this are not worth sorting */
+const uint32_t kRaySortMinPaths = 4096;
+
+namespace render {
+/*  Wavefront path tracer. Instead of one kernel running whole paths, every
+    bounce is split into stages that each run over a compacted queue of the
+    paths still alive:
+
+      generate   camera rays for every pixel, fills the first queue
+      extend     closest hit for every queued path, misses finish and hits
+                 are sorted into one queue per material family
+      shade      shading and continuation rays, one kernel specialized for
+                 each family, survivors are appended to the next queue
+      accumulate adds the finished samples to the frame
+
+    extend and shade repeat until the queue runs empty, so later bounces only
+    launch as many work items as there are live paths. One path exists per
+    pixel, its index is the pixel index.
+
+    Continuation rays point in random directions, so neighbouring work items
+    of extend would walk unrelated parts of the scene. With ray sorting
+    enabled, the queue is reordered between the bounces by direction octant
+    and by the Morton code of the origin's cell in the scene bounds, so rays
+    next to each other in the queue start close together and travel alike.
+
+    The buffers are members of a host object, so the stages copy the
+    pointers they need into locals before submitting: a kernel capturing
+    `this` would dereference host memory on the device. The other classes
+    submitting kernels, like `AdaptiveSampler` and `bvh::Refitter`, follow
+    the same rule */
+class Wavefront {
+ private:
+  int width_;
+  int height_;
+
+  /* Path state, all in device memory */
+  Ray* rays_;
+  sycl::vec<float, 3>* throughput_;
+  uint32_t* dimensions_; /* Next sampler dimension of the current sample */
+  sycl::vec<float, 3>* radiance_;
+  Features* features_;
+  stats::Counters* counters_;
+  std::optional<Intersector>* hits_;
+
+  /* Double buffered path queues and their lengths in shared memory */
+  uint32_t* queues_[2];
+  uint32_t* queue_sizes_;
+  /* Paths that hit a material of each family and their counts in shared
+     memory */
+  uint32_t* family_queues_[material::kFamilyCount];
+  uint32_t* family_sizes_;
+
+  /*  Sort key of every queued path, the sorted queue and the start of every
+      key in it, all in device memory. `nullptr` without ray sorting */
+  uint32_t* sort_keys_ = nullptr;
+  uint32_t* sorted_ = nullptr;
+  uint32_t* sort_bins_ = nullptr;
+
+  template <class Sampler>
+  sycl::event Submit(sycl::queue& q, const Scene& scene, const Frame& frame,
+                     const std::vector<sycl::event>& depends_on);
+
+  /*  Shades the paths queued for family `F` with their `sample` after
+      `extended` filled the queue, survivors are appended to `out`. `bound`
+      is at least the length of the queue */
+  template <material::Family F, class Sampler>
+  sycl::event SubmitShade(sycl::queue& q, const Scene& scene,
+                          uint32_t sample, uint32_t bound, uint32_t* out,
+                          uint32_t* out_size, sycl::event extended);
+
+  /*  Counting sort of the `count` paths of `queue` into `sorted_` by the
+      keys of their rays, paths of the same key keep no particular order */
+  sycl::event SortQueue(sycl::queue& q, const bvh::AABB& bounds,
+                        const uint32_t* queue, uint32_t count);
+
+ public:
+  /* `sort_rays` enables the sorting of continuation rays */
+  Wavefront(sycl::queue& q, int width, int height, bool sort_rays = false);
+
+  void Free(sycl::queue& q);
+
+  /* Same contract as `render::RenderSamples` */
+  sycl::event RenderSamples(sycl::queue& q, const Scene& scene,
+                            const Frame& frame,
+                            const std::vector<sycl::event>& depends_on = {});
+};
+}  // namespace render
+
+#endif
@@ -1,23 +1,44 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
 #include <iostream>
+#include <memory>
 #include <optional>
 #include <string>
+#include <vector>
 
 #include <cmath>
 #include <cstdint>
 
+#ifdef PATHTRACER_WITH_VIEWER
 #include <GL/glew.h>
 #include <GL/gl.h>
 #include <GLFW/glfw3.h>
 #include <cuda_runtime.h>
 #include <cuda_gl_interop.h>
+#endif
 #include <sycl/sycl.hpp>
 
+#include "include/adaptive.h"
 #include "include/camera.h"
+#include "include/cluster.h"
+#include "include/denoiser.h"
+#include "include/dynamic.h"
+#include "include/image.h"
 #include "include/object.h"
+#include "include/options.h"
 #include "include/ray.h"
 #include "include/material.h"
+#include "include/render.h"
+#include "include/scene.h"
+#include "include/scene_file.h"
+#include "include/stats.h"
 #include "include/utils.h"
+#include "include/texture.h"
+#include "include/tiles.h"
+#include "include/wavefront.h"
 
+#ifdef PATHTRACER_WITH_VIEWER
 #define checkCudaErrors(call)                                 \
   do {                                                        \
     cudaError_t err = call;                                   \
@@ -27,27 +48,540 @@
       exit(EXIT_FAILURE);                                     \
     }                                                         \
   } while (0)
+#endif
 
 
-using Objects = std::variant<Sphere, Plane>;
-using Material = material::MicrofacetMaterial<material::FresnelSchlick,
-  material::NormalGGX, material::GeometryGGXSchlick>;
+/* Fills `scene.objects` and `materials` with the built-in demo scene */
+static void FillDemoScene(sycl::queue &q, Scene &scene,
+                          std::vector<Material> &materials) {
+  materials.push_back(Material(sycl::vec<float, 3>{0.0f,0.0f,1.0f}, 0.2f, 0.5f, false,
+    0.0f, 0.0f));
 
-const int kImageWidth = 1024;
-const int kImageHeight = 512;
+  materials.push_back(Material(sycl::vec<float, 3>{1.0f,1.0f,1.0f}, 0.2f, 0.5f, false,
+    0.0f, 8.0f));
 
-/* Antialiasing block */
-const int kAABlockWidth = 2;
-const int kAABlockHeight = 2;
+  materials.push_back(Material(sycl::vec<float, 3>{1.0f,0.0f,0.0f}, 0.2f, 0.5f, false,
+    0.0f, 0.0f));
 
-const int kSamplesPerPixel = 1;
+  materials.push_back(Material(sycl::vec<float, 3>{0.0f,1.0f,0.0f}, 0.2f, 0.5f, false,
+    0.0f, 0.0f));
 
-const int kMaxRayDepth = 5;
+
+  /* Filling the scene with objects */
+  scene.objects->push_back(q,
+      Sphere(
+        sycl::vec<float, 3>(10.0f, 0.0f, 0.0f),
+        2.0f, 0));
+
+  scene.objects->push_back(q,
+      Sphere(
+        sycl::vec<float, 3>(10.0f, 5.0f, 0.0f),
+        1.0f, 1));
+
+  scene.objects->push_back(q,
+      Sphere(
+        sycl::vec<float, 3>(7.0f, 0.0f, 0.0f),
+        0.5f, 2));
+
+  scene.objects->push_back(q,
+      Plane(
+        sycl::vec<float, 3>(10.0f, 0.0f, -4.0f),
+        sycl::vec<float, 3>(0.0f, 0.0f, 1.0f),
+        0));
+  scene.objects->push_back(q,
+      Plane(
+        sycl::vec<float, 3>(15.0f, 0.0f, -4.0f),
+        sycl::vec<float, 3>(-1.0f, 0.0f, 0.0f),
+        3));
+}
+
+/* Allocates the scene in shared memory and fills it with objects, returns no
+   value if the requested assets could not be loaded */
+static std::optional<Scene> CreateScene(sycl::queue &q,
+                                        const Options &options) {
+  Scene scene;
+
+  /* SYCL memory allocation */
+  scene.camera = sycl::malloc_shared<Camera>(1, q);
+  scene.objects =
+    sycl::malloc_shared<containerutils::VariantContainer<Objects>>(1, q);
+
+  /* SYCL memory initialization */
+  new (scene.camera) Camera(sycl::vec<float, 3>(1.0f, 0.0f, 0.0f),
+    sycl::vec<float, 3>(0.0f, 0.0f, 0.0f),
+    sycl::vec<float, 3>(0.0f, 0.0f, 1.0f), 90.0f,
+    1.0f, options.width, options.height);
+
+  new (scene.objects) containerutils::VariantContainer<Objects>();
+  scene.max_depth = options.max_depth;
+  scene.sampler = options.sampler;
+  scene.ambient_occlusion = options.ambient_occlusion;
+
+  std::vector<Material> materials;
+  texture::HostAtlas textures;
+  std::vector<Mesh> geometries;
+  bool prebuilt = !options.scene.empty();
+  if (prebuilt) {
+    /* Camera, objects and BVH come ready to use */
+    auto start = std::chrono::steady_clock::now();
+    if (!SceneFile::Read(q, options.scene, *scene.camera, materials, textures,
+                         geometries, *scene.objects, scene.bvh)) {
+      sycl::free(scene.camera, q);
+      scene.objects->Free(q);
+      sycl::free(scene.objects, q);
+      return std::nullopt;
+    }
+    scene.camera->UpdateDimensions(options.width, options.height);
+    printf("Loaded %s in %.3f s\n", options.scene.c_str(),
+           std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start).count());
+  } else if (options.obj.empty()) {
+    FillDemoScene(q, scene, materials);
+  } else {
+    /* Places the model in front of the camera, centered around its height */
+    texture::Library library;
+    std::optional<Mesh> mesh = Mesh::Load(q, options.obj, materials, library,
+                                          sycl::vec<float, 3>(1.0f, 0.0f, -2.6f));
+    if (!mesh.has_value()) {
+      sycl::free(scene.camera, q);
+      scene.objects->Free(q);
+      sycl::free(scene.objects, q);
+      return std::nullopt;
+    }
+    scene.objects->push_back(q, *mesh);
+    textures = library.Build();
+  }
+
+  scene.textures = texture::Upload(q, textures);
+  scene.materials = sycl::malloc_shared<Material>(materials.size(), q);
+  std::uninitialized_copy(materials.begin(), materials.end(), scene.materials);
+  if (!geometries.empty()) {
+    scene.geometries = sycl::malloc_shared<Mesh>(geometries.size(), q);
+    std::uninitialized_copy(geometries.begin(), geometries.end(),
+                            scene.geometries);
+    scene.geometry_count = geometries.size();
+  }
+
+  if (!prebuilt) {
+    scene.bvh = BuildSceneBVH(q, *scene.objects);
+  }
+  if (options.nee) {
+    scene.emitters = BuildEmitterList(q, *scene.objects, materials);
+  }
+  scene.objects->Freeze(q);
+
+  return scene;
+}
+
+static void FreeScene(Scene &scene, sycl::queue &q) {
+  scene.objects->forEach([&q](const auto &obj) {
+    if constexpr (std::is_same_v<std::decay_t<decltype(obj)>, Mesh>) {
+      Mesh mesh = obj;
+      mesh.Free(q);
+    }
+  });
+  /* Instances only hold handles to these */
+  for (uint32_t i = 0; i < scene.geometry_count; i++) {
+    scene.geometries[i].Free(q);
+  }
+  if (scene.geometries != nullptr) sycl::free(scene.geometries, q);
+
+  FreeSceneBVH(scene.bvh, q);
+  FreeEmitterList(scene.emitters, q);
+  texture::Free(scene.textures, q);
+  sycl::free(scene.camera, q);
+  sycl::free(scene.materials, q);
+  scene.objects->Free(q);
+  sycl::free(scene.objects, q);
+}
+
+static sycl::device SelectDevice(const std::string &name) {
+  if (name == "cpu") {
+    return sycl::device(sycl::cpu_selector_v);
+  }
+  if (name == "gpu") {
+    return sycl::device(sycl::gpu_selector_v);
+  }
+  return sycl::device(sycl::default_selector_v);
+}
+
+
+/* Render pipeline selected on the command line, the plain megakernel if
+   both are `nullptr` */
+struct Pipeline {
+  render::Wavefront *wavefront = nullptr;
+  render::TileScheduler *tiles = nullptr;
+};
+
+/* Submits one sample batch to `pipeline` */
+static sycl::event RenderBatch(sycl::queue &q, const Scene &scene,
+                               const render::Frame &frame,
+                               const Pipeline &pipeline,
+                               const std::vector<sycl::event> &depends_on) {
+  if (pipeline.wavefront != nullptr) {
+    return pipeline.wavefront->RenderSamples(q, scene, frame, depends_on);
+  }
+  if (pipeline.tiles != nullptr) {
+    return pipeline.tiles->RenderSamples(q, scene, frame, depends_on);
+  }
+  return render::RenderSamples(q, scene, frame, depends_on);
+}
+
+/* `path` without its extension, `render.ppm` becomes `render` */
+static std::string OutputStem(const std::string &path) {
+  std::size_t dot = path.find_last_of('.');
+  std::size_t slash = path.find_last_of('/');
+  if (dot == std::string::npos ||
+      (slash != std::string::npos && dot < slash)) {
+    return path;
+  }
+  return path.substr(0, dot);
+}
+
+/* Renders `options.samples` samples per pixel without any window or graphics
+   interop and writes the result to `options.output` */
+static int RenderHeadless(sycl::queue &q, const Options &options,
+                          const Scene &scene, const Pipeline &pipeline) {
+  float* image = sycl::malloc_device<float>(
+      (std::size_t)options.width*options.height*3, q);
+
+  render::Frame frame;
+  frame.width = options.width;
+  frame.height = options.height;
+  frame.image = image;
+  frame.framebuffer = nullptr;
+  frame.executed_samples = 0;
+  frame.total_executed_samples = 0;
+
+  std::optional<render::AdaptiveSampler> adaptive;
+  if (options.adaptive_error > 0.0f) {
+    adaptive.emplace(q, options.width, options.height, options.adaptive_error);
+    adaptive->Attach(frame);
+  }
+  /* The feature buffers are only filled if a denoiser is attached */
+  std::optional<render::Denoiser> denoiser;
+  if (options.denoise || options.aovs) {
+    denoiser.emplace(q, options.width, options.height);
+    denoiser->Attach(frame);
+  }
+  std::optional<stats::Heatmap> heatmap;
+  if (options.stats) {
+    heatmap.emplace(q, options.width, options.height);
+    heatmap->Attach(frame);
+  }
+
+  /* Batches are chained through their events and only waited for once,
+     unless adaptive sampling needs to know whether tiles are left */
+  auto start = std::chrono::steady_clock::now();
+  sycl::event rendered;
+  if (adaptive) {
+    rendered = adaptive->Reset(q);
+  }
+  while (frame.executed_samples < options.samples) {
+    rendered = RenderBatch(q, scene, frame, pipeline, {rendered});
+    frame.executed_samples += kSamplesPerPixel;
+    frame.total_executed_samples += kSamplesPerPixel;
+
+    if (adaptive && frame.executed_samples >= kAdaptiveMinSamples &&
+        frame.executed_samples % kAdaptiveInterval == 0) {
+      rendered = adaptive->Update(q, frame, {rendered});
+      rendered.wait_and_throw();
+      if (adaptive->ActiveTiles() == 0) {
+        break;
+      }
+    }
+  }
+  float* denoised = nullptr;
+  if (denoiser) {
+    if (options.denoise) {
+      denoised = sycl::malloc_device<float>(
+          (std::size_t)options.width*options.height*3, q);
+    }
+    rendered = denoiser->Denoise(q, frame, frame.executed_samples, denoised,
+                                 {rendered});
+  }
+  rendered.wait_and_throw();
+  auto end = std::chrono::steady_clock::now();
+
+  std::size_t pixel_count = (std::size_t)options.width*options.height;
+  std::vector<float> pixels(pixel_count*3);
+  q.memcpy(pixels.data(), denoised ? denoised : image,
+           pixels.size()*sizeof(float)).wait();
+  sycl::free(image, q);
+  sycl::free(denoised, q);
+
+  std::vector<float> albedo, normal, depth;
+  if (denoiser) {
+    if (options.aovs) {
+      denoiser->ReadFeatures(q, albedo, normal, depth);
+    }
+    denoiser->Free(q);
+  }
+
+  /* One heatmap per counter, drawn before adaptive sampling releases the
+     per pixel sample counts */
+  std::vector<std::vector<float>> heatmaps;
+  std::array<uint64_t, stats::kCounterCount> totals{};
+  if (heatmap) {
+    float* colors = sycl::malloc_device<float>(pixel_count*3, q);
+    for (int i = 0; i < stats::kCounterCount; i++) {
+      heatmaps.emplace_back(pixel_count*3);
+      heatmap->Draw(q, frame, (stats::Counter)i, frame.executed_samples,
+                    colors).wait_and_throw();
+      q.memcpy(heatmaps.back().data(), colors,
+               pixel_count*3*sizeof(float)).wait();
+    }
+    sycl::free(colors, q);
+    totals = heatmap->Totals(q);
+    heatmap->Free(q);
+  }
+
+  /* Pixel samples actually taken, fewer than requested if pixels converged */
+  double samples = (double)pixel_count*frame.executed_samples;
+  int image_samples = frame.executed_samples;
+  if (adaptive) {
+    std::vector<uint32_t> counts(pixel_count);
+    q.memcpy(counts.data(), frame.sample_counts,
+             counts.size()*sizeof(uint32_t)).wait();
+    adaptive->Free(q);
+
+    /* Pixels have different sample counts, store the means instead */
+    samples = 0.0;
+    for (std::size_t i = 0; i < pixel_count; i++) {
+      samples += counts[i];
+      for (int c = 0; c < 3; c++) {
+        if (!denoised) pixels[i*3+c] /= std::max(counts[i], 1u);
+      }
+    }
+    image_samples = 1;
+  }
+  /* The denoiser already wrote means */
+  if (denoised) {
+    image_samples = 1;
+  }
+
+  double seconds = std::chrono::duration<double>(end - start).count();
+  printf("Rendered %d samples per pixel in %.3f s (%.2f Msamples/s)\n",
+         frame.executed_samples, seconds, samples / seconds * 1e-6);
+  if (adaptive) {
+    printf("Adaptive sampling took %.1f%% of the samples of a uniform "
+           "render\n",
+           100.0*samples / ((double)pixel_count*frame.executed_samples));
+  }
+  if (heatmap) {
+    using stats::Counter;
+    auto total = [&totals](Counter counter) {
+      return (double)totals[(int)counter];
+    };
+    printf("Traced %.2f rays per sample, %.1f intersection tests and %.1f "
+           "BVH nodes per ray, %.2f bounces per sample\n",
+           total(Counter::kRays) / samples,
+           total(Counter::kPrimitiveTests) / total(Counter::kRays),
+           total(Counter::kNodesVisited) / total(Counter::kRays),
+           total(Counter::kBounces) / samples);
+  }
+
+  if (!imageutils::WriteImage(options.output, pixels.data(), options.width,
+                              options.height, image_samples)) {
+    printf("Could not write image to %s\n", options.output.c_str());
+    return -1;
+  }
+
+  if (options.aovs) {
+    /* `render.ppm` gets `render.albedo.pfm` and so on */
+    std::string stem = OutputStem(options.output);
+    for (auto [name, aov] : {std::make_pair(".albedo.pfm", &albedo),
+                             std::make_pair(".normal.pfm", &normal),
+                             std::make_pair(".depth.pfm", &depth)}) {
+      if (!imageutils::WritePFM(stem + name, aov->data(), options.width,
+                                options.height, 1)) {
+        printf("Could not write image to %s\n", (stem + name).c_str());
+        return -1;
+      }
+    }
+  }
+
+  /* `render.ppm` gets `render.rays.ppm` and so on */
+  for (std::size_t i = 0; i < heatmaps.size(); i++) {
+    std::string stem = OutputStem(options.output);
+    std::string path = stem + "." + stats::CounterName((stats::Counter)i) +
+                       options.output.substr(stem.size());
+    if (!imageutils::WriteImage(path, heatmaps[i].data(), options.width,
+                                options.height, 1)) {
+      printf("Could not write image to %s\n", path.c_str());
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/*  Renders `options.animate` frames of `animation` with `options.samples`
+    samples each to `OUTPUT.0000` and so on, updating the scene BVH through
+    `dynamic` between the frames */
+static int RenderAnimation(sycl::queue &q, const Options &options,
+                           const Scene &scene, const Pipeline &pipeline,
+                           DynamicScene &dynamic, const Animation &animation) {
+  float* image = sycl::malloc_device<float>(
+      (std::size_t)options.width*options.height*3, q);
+  std::vector<float> pixels((std::size_t)options.width*options.height*3);
+  std::string stem = OutputStem(options.output);
+  printf("Animating %zu objects\n", animation.size());
+
+  double render_seconds = 0.0;
+  int total_executed_samples = 0;
+  for (int i = 0; i < options.animate; i++) {
+    /* No kernel runs in between frames, objects may move */
+    animation.Apply(dynamic, i / kAnimationFrameRate);
+    dynamic.Update(q);
+
+    render::Frame frame;
+    frame.width = options.width;
+    frame.height = options.height;
+    frame.image = image;
+    frame.framebuffer = nullptr;
+    frame.executed_samples = 0;
+    /* Continues the sample sequence so frames do not share their noise */
+    frame.total_executed_samples = total_executed_samples;
+
+    auto start = std::chrono::steady_clock::now();
+    sycl::event rendered;
+    while (frame.executed_samples < options.samples) {
+      rendered = RenderBatch(q, scene, frame, pipeline, {rendered});
+      frame.executed_samples += kSamplesPerPixel;
+      frame.total_executed_samples += kSamplesPerPixel;
+    }
+    rendered.wait_and_throw();
+    render_seconds += std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    total_executed_samples = frame.total_executed_samples;
+
+    q.memcpy(pixels.data(), image, pixels.size()*sizeof(float)).wait();
+    char number[16];
+    snprintf(number, sizeof(number), ".%04d", i);
+    std::string path = stem + number + options.output.substr(stem.size());
+    if (!imageutils::WriteImage(path, pixels.data(), options.width,
+                                options.height, frame.executed_samples)) {
+      printf("Could not write image to %s\n", path.c_str());
+      sycl::free(image, q);
+      return -1;
+    }
+  }
+  sycl::free(image, q);
+
+  printf("Rendered %d frames in %.3f s (%.2f frames/s)\n", options.animate,
+         render_seconds, options.animate / render_seconds);
+  printf("Refit the BVH %u times in %.3f ms on average, rebuilt it %u times "
+         "in %.3f ms on average, final relative cost %.2f\n",
+         dynamic.Refits(),
+         dynamic.Refits() ? 1e3 * dynamic.RefitSeconds() / dynamic.Refits()
+                          : 0.0,
+         dynamic.Rebuilds(),
+         dynamic.Rebuilds() ? 1e3 * dynamic.RebuildSeconds() /
+                                  dynamic.Rebuilds()
+                            : 0.0,
+         dynamic.RelativeCost());
+  return 0;
+}
+
+
+/* Cluster job of `options` without its sample range */
+static cluster::Job JobSettings(const Options &options) {
+  cluster::Job job = {};
+  job.width = options.width;
+  job.height = options.height;
+  job.max_depth = options.max_depth;
+  job.sampler = (uint32_t)options.sampler;
+  job.nee = options.nee;
+  job.ambient_occlusion = options.ambient_occlusion;
+  if (!options.scene.empty()) {
+    job.scene_hash = cluster::HashFile(options.scene);
+  } else if (!options.obj.empty()) {
+    job.scene_hash = cluster::HashFile(options.obj);
+  }
+  return job;
+}
+
+/*  Renders the sample range of a coordinator's job into `pixels`, if it was
+    set up like `own`, the `JobSettings` of the worker */
+static bool RenderJob(sycl::queue &q, const Options &options,
+                      const Scene &scene, const Pipeline &pipeline,
+                      const cluster::Job &own, const cluster::Job &job,
+                      std::vector<float> &pixels) {
+  if ((int)job.width != options.width || (int)job.height != options.height ||
+      job.samples == 0) {
+    printf("Cannot render %u samples of %ux%u pixels, the worker renders "
+           "%dx%d\n", job.samples, job.width, job.height, options.width,
+           options.height);
+    return false;
+  }
+  if (job.max_depth != own.max_depth || job.sampler != own.sampler ||
+      job.nee != own.nee || job.ambient_occlusion != own.ambient_occlusion) {
+    printf("Cannot render a job with other --max-depth, --sampler, --no-nee "
+           "or --ao options than the worker\n");
+    return false;
+  }
+  if (job.scene_hash != own.scene_hash) {
+    printf("Cannot render a job of another scene than the worker's\n");
+    return false;
+  }
+
+  float* image = sycl::malloc_device<float>(
+      (std::size_t)options.width*options.height*3, q);
+  render::Frame frame;
+  frame.width = options.width;
+  frame.height = options.height;
+  frame.image = image;
+  frame.framebuffer = nullptr;
+  frame.executed_samples = 0;
+  /* Sample indices drive the seeding, so the range lines up with the other
+     workers' ones */
+  frame.total_executed_samples = job.first_sample;
+
+  sycl::event rendered;
+  while (frame.executed_samples < (int)job.samples) {
+    rendered = RenderBatch(q, scene, frame, pipeline, {rendered});
+    frame.executed_samples += kSamplesPerPixel;
+    frame.total_executed_samples += kSamplesPerPixel;
+  }
+  rendered.wait_and_throw();
+
+  pixels.resize((std::size_t)options.width*options.height*3);
+  q.memcpy(pixels.data(), image, pixels.size()*sizeof(float)).wait();
+  sycl::free(image, q);
+  return true;
+}
+
+/* Splits `options.samples` over `options.workers` and writes the merged
+   image to `options.output`. Needs no device and only reads the scene file
+   to identify it */
+static int RenderCoordinator(const Options &options) {
+  auto start = std::chrono::steady_clock::now();
+  std::vector<float> pixels;
+  if (!cluster::RenderDistributed(options.workers, JobSettings(options),
+                                  options.samples, pixels)) {
+    return -1;
+  }
+  double seconds = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+  printf("Rendered %d samples per pixel on %zu workers in %.3f s "
+         "(%.2f Msamples/s)\n", options.samples, options.workers.size(),
+         seconds,
+         (double)options.width*options.height*options.samples / seconds * 1e-6);
+
+  if (!imageutils::WriteImage(options.output, pixels.data(), options.width,
+                              options.height, options.samples)) {
+    printf("Could not write image to %s\n", options.output.c_str());
+    return -1;
+  }
+  return 0;
+}
 
 
+#ifdef PATHTRACER_WITH_VIEWER
 Camera* camera_glb;
-int* executed_samples_glb;
-int* total_executed_samples_glb;
+int executed_samples_glb;
+/* Counter shown as heatmap instead of the image, -1 for none */
+int heatmap_glb = -1;
 
 /* Camera movement variables */
 const float kCameraMoveStep = 0.1f;
@@ -58,8 +592,17 @@ float camera_yrot = M_PI_2;
 static void camera_keyback([[maybe_unused]] GLFWwindow *window, int key,
   [[maybe_unused]] int scancode, [[maybe_unused]] int action,
   [[maybe_unused]] int mods) {
-  
-  *executed_samples_glb = 0;
+
+  /* H cycles through the heatmaps without restarting the accumulation */
+  if (key == GLFW_KEY_H) {
+    if (action == GLFW_PRESS && stats::kEnabled) {
+      heatmap_glb = heatmap_glb + 1 < stats::kCounterCount ? heatmap_glb + 1
+                                                           : -1;
+    }
+    return;
+  }
+
+  executed_samples_glb = 0;
 
   switch (key) {
   case GLFW_KEY_W:
@@ -106,7 +649,13 @@ static void camera_keyback([[maybe_unused]] GLFWwindow *window, int key,
 }
 
 
-int main() {
+/*  Interactive rendering into a GLFW window through CUDA-OpenGL interop. The
+    objects move along `animation` if it is not `nullptr` */
+static int RenderWindowed(sycl::queue &q, const Options &options,
+                          const Scene &scene, const Pipeline &pipeline,
+                          DynamicScene *dynamic, const Animation *animation) {
+  const int width = options.width;
+  const int height = options.height;
   GLFWwindow* window;
 
   /* Initialize the library */
@@ -116,7 +665,7 @@ int main() {
   }
 
   /* Create a windowed mode window and its OpenGL context */
-  window = glfwCreateWindow(kImageWidth, kImageHeight, "SYCL Pathtracer", NULL, NULL);
+  window = glfwCreateWindow(width, height, "SYCL Pathtracer", NULL, NULL);
   if (!window) {
     printf("GLFW error: Could not create a window\n");
     glfwTerminate();
@@ -133,16 +682,21 @@ int main() {
     return -1;
   }
 
-  GLuint pbo, tex, fbo;
+  /*  Two pixel buffer objects, the device renders the next sample batch into
+      one while the other one is presented */
+  GLuint pbos[2], tex, fbo;
   /* Pixel buffer object initialization */
-  glGenBuffers(1, &pbo);
-  glBindBuffer(GL_ARRAY_BUFFER, pbo);
-  glBufferData(GL_ARRAY_BUFFER, kImageWidth*kImageHeight*3, NULL, GL_DYNAMIC_DRAW);
+  glGenBuffers(2, pbos);
+  for (GLuint pbo : pbos) {
+    glBindBuffer(GL_ARRAY_BUFFER, pbo);
+    glBufferData(GL_ARRAY_BUFFER, (std::size_t)width*height*3, NULL,
+                 GL_DYNAMIC_DRAW);
+  }
   glBindBuffer(GL_ARRAY_BUFFER, 0);
 
   glGenTextures(1, &tex);
   glBindTexture(GL_TEXTURE_2D, tex);
-  glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGB8, kImageWidth, kImageHeight);
+  glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGB8, width, height);
   glBindTexture(GL_TEXTURE_2D, 0);
 
   /* Framebuffer object initialization */
@@ -157,189 +711,147 @@ int main() {
   glBindFramebuffer(GL_FRAMEBUFFER, 0);
   glFinish();
 
-  /* Construct objects that are shared between host and device */
-  sycl::device gpu(sycl::gpu_selector_v);
-  sycl::queue q(gpu);
-
   CUstream custream = sycl::get_native<sycl::backend::ext_oneapi_cuda>(q);
 
-  cudaGraphicsResource *gresource;
-  void *gresource_ptr;
-  size_t gresource_size;
-  checkCudaErrors(cudaGraphicsGLRegisterBuffer(&gresource, pbo, cudaGraphicsRegisterFlagsWriteDiscard));
-  checkCudaErrors(cudaGraphicsMapResources(1, &gresource, custream));
-  checkCudaErrors(cudaGraphicsResourceGetMappedPointer(&gresource_ptr, &gresource_size, gresource));
+  cudaGraphicsResource *gresources[2];
+  uint8_t *framebuffers[2];
+  for (int i = 0; i < 2; i++) {
+    void *gresource_ptr;
+    size_t gresource_size;
+    checkCudaErrors(cudaGraphicsGLRegisterBuffer(&gresources[i], pbos[i], cudaGraphicsRegisterFlagsWriteDiscard));
+    checkCudaErrors(cudaGraphicsMapResources(1, &gresources[i], custream));
+    checkCudaErrors(cudaGraphicsResourceGetMappedPointer(&gresource_ptr, &gresource_size, gresources[i]));
+    framebuffers[i] = reinterpret_cast<uint8_t*>(gresource_ptr);
+  }
 
-  /* SYCL memory allocation */
-  Camera* camera = sycl::malloc_shared<Camera>(1, q);
-  Material* materials = sycl::malloc_shared<Material>(4, q);
-  containerutils::VariantContainer<Objects>* objects =
-    sycl::malloc_shared<containerutils::VariantContainer<Objects>>(1, q);
-  float* image = sycl::malloc_device<float>(kImageWidth*kImageHeight*3, q);
-  int* executed_samples = sycl::malloc_shared<int>(1, q);
-  int* total_executed_samples = sycl::malloc_shared<int>(1, q);
+  float* image = sycl::malloc_device<float>((std::size_t)width*height*3, q);
 
   /* Shared (unified) memory reflection to globals */
-  camera_glb = camera;
-  executed_samples_glb = executed_samples;
-  total_executed_samples_glb = total_executed_samples;
-
-  /* SYCL memory initialization */
-  new (camera) Camera(sycl::vec<float, 3>(1.0f, 0.0f, 0.0f),
-    sycl::vec<float, 3>(0.0f, 0.0f, 0.0f),
-    sycl::vec<float, 3>(0.0f, 0.0f, 1.0f), 90.0f,
-    1.0f, kImageWidth, kImageHeight);
-
-  new (&materials[0]) Material(sycl::vec<float, 3>{0.0f,0.0f,1.0f}, 0.2f, 0.5f, false,
-    0.0f, 0.0f);
-
-  new (&materials[1]) Material(sycl::vec<float, 3>{4.0f,4.0f,4.0f}, 0.2f, 0.5f, false,
-    0.0f, 0.0f);
+  camera_glb = scene.camera;
+  executed_samples_glb = 0;
+  int total_executed_samples = 0;
 
-  new (&materials[2]) Material(sycl::vec<float, 3>{1.0f,0.0f,0.0f}, 0.2f, 0.5f, false,
-    0.0f, 0.0f);
-
-  new (&materials[3]) Material(sycl::vec<float, 3>{0.0f,1.0f,0.0f}, 0.2f, 0.5f, false,
-    0.0f, 0.0f);
-
-  new (objects) containerutils::VariantContainer<Objects>();
-
-
-  /* Filling the scene with objects */
-  objects->push_back(
-      Sphere(
-        sycl::vec<float, 3>(10.0f, 0.0f, 0.0f),
-        2.0f, 0));
-
-  objects->push_back(
-      Sphere(
-        sycl::vec<float, 3>(10.0f, 5.0f, 0.0f),
-        1.0f, 1));
-
-  objects->push_back(
-      Sphere(
-        sycl::vec<float, 3>(7.0f, 0.0f, 0.0f),
-        0.5f, 2));
-
-  objects->push_back(
-      Plane(
-        sycl::vec<float, 3>(10.0f, 0.0f, -4.0f),
-        sycl::vec<float, 3>(0.0f, 0.0f, 1.0f),
-        0));
-  objects->push_back(
-      Plane(
-        sycl::vec<float, 3>(15.0f, 0.0f, -4.0f),
-        sycl::vec<float, 3>(-1.0f, 0.0f, 0.0f),
-        3));
-
-
-  /* Path tracer program */
-  auto pathtracer = [=](sycl::nd_item<2> it) {
-    auto w = it.get_global_id(0);
-    auto h = it.get_global_id(1);
-
-    sycl::device_ptr<uint8_t> framebuffer = reinterpret_cast<uint8_t*>(gresource_ptr);
-
-    Ray global_ray, ray;
-    camera->GenerateRay(w, h, global_ray);
-
-    float &ir = image[(kImageWidth*h+w)*3+0];
-    float &ig = image[(kImageWidth*h+w)*3+1];
-    float &ib = image[(kImageWidth*h+w)*3+2];
-
-    uint8_t &fr = framebuffer[(kImageWidth*h+w)*3+0];
-    uint8_t &fg = framebuffer[(kImageWidth*h+w)*3+1]; 
-    uint8_t &fb = framebuffer[(kImageWidth*h+w)*3+2];  
+  std::optional<render::AdaptiveSampler> adaptive;
+  if (options.adaptive_error > 0.0f) {
+    adaptive.emplace(q, width, height, options.adaptive_error);
+  }
+  /* Every presented batch is filtered, so few samples already look clean */
+  std::optional<render::Denoiser> denoiser;
+  if (options.denoise) {
+    denoiser.emplace(q, width, height);
+  }
+  /* Counted whenever the build counts, H switches the heatmaps on */
+  std::optional<stats::Heatmap> heatmap;
+  if (stats::kEnabled) {
+    heatmap.emplace(q, width, height);
+  }
+  int shown_heatmap = -1;
+
+  /*  Batch `N` renders into `framebuffers[N % 2]`. It is submitted right
+      after batch `N - 1`, which it depends on through its event, and batch
+      `N - 1` is presented while it runs. Before a buffer is rendered into
+      again, the texture upload reading it has to be finished */
+  sycl::event rendered[2];
+  GLsync uploaded[2] = {nullptr, nullptr};
+  int current = 0;
+  bool presentable = false;
+  auto animation_start = std::chrono::steady_clock::now();
+  while (!glfwWindowShouldClose(window))
+  {
+      if (animation != nullptr) {
+        /* Objects may only move while no batch reads them, which gives up
+           the overlap with the presented batch */
+        rendered[1 - current].wait_and_throw();
+        animation->Apply(*dynamic, std::chrono::duration<float>(
+            std::chrono::steady_clock::now() - animation_start).count());
+        dynamic->Update(q);
+        executed_samples_glb = 0;
+      }
 
-    if (*executed_samples == 0) {
-      ir = 0.0f;
-      ig = 0.0f;
-      ib = 0.0f;
-    }
+      if (uploaded[current] != nullptr) {
+        while (glClientWaitSync(uploaded[current], GL_SYNC_FLUSH_COMMANDS_BIT,
+                                1000000000) == GL_TIMEOUT_EXPIRED) {}
+        glDeleteSync(uploaded[current]);
+        uploaded[current] = nullptr;
+      }
 
-    /* Good seed? */
-    uint64_t seed = 0;
-    seed |= (h & 0xFFFF) << 48;
-    seed |= (w & 0xFFFF) << 32;
-    seed |= *total_executed_samples & 0xFFFFFFFF;
-    /* If seed not hashed, artifacts appear */
-    miscutils::XorShiftPRNG random(miscutils::Hash64(seed));
-
-    for (int s = 0; s < kSamplesPerPixel; s++) {
-      ray = global_ray;
-      float mu = 1.0f;
-      while (ray.depth < kMaxRayDepth) {
-        auto obj = closest_obj(ray, *objects);
-        if (!obj.has_value()) {
-          ir += mu*0.6f;
-          ig += mu*0.6f;
-          ib += mu*0.6f;
-          break;
+      render::Frame frame;
+      frame.width = width;
+      frame.height = height;
+      frame.image = image;
+      frame.framebuffer = framebuffers[current];
+      frame.executed_samples = executed_samples_glb;
+      frame.total_executed_samples = total_executed_samples;
+
+      sycl::event ready = rendered[1 - current];
+      if (adaptive) {
+        adaptive->Attach(frame);
+        /* Moving the camera restarts the accumulation of every tile */
+        if (frame.executed_samples == 0) {
+          ready = adaptive->Reset(q, {ready});
         }
-
-        const Intersector &intersection = *obj;
-
-        const sycl::vec<float, 3> &n = intersection.normal;
-        Material &material = materials[intersection.material_id];
-        sycl::vec<float,3> f = mu*material.base_color;
-        ir += f.x();
-        ig += f.y();
-        ib += f.z();
-
-        
-        sycl::vec<float, 3> h, l;
-        material.Sample(random, ray.dir, n, h, l);
-        // printf("n:%f,%f,%f\n", h.x(), h.y(), h.z());
-        // mu *= (0.8f*M_1_PI+0.2f*material.Eval(l, ray.dir, n, h))*sycl::clamp(sycl::dot(n,l), 0.0f, 1.0f);
-        mu *= 2 * 0.18f * sycl::dot(n,l);
-        ray.depth += 1;
-        ray.origin += ray.dir * intersection.t;
-        ray.origin += intersection.normal*0.1f;
-        ray.dir = l;
       }
-    }
-
-    /* Gamma correction */
-    float kGamma = 1.0f/2.2f;
-    fr = sycl::pow(sycl::clamp(ir/(*executed_samples+1),0.0f,1.0f),kGamma)*255;
-    fg = sycl::pow(sycl::clamp(ig/(*executed_samples+1),0.0f,1.0f),kGamma)*255;
-    fb = sycl::pow(sycl::clamp(ib/(*executed_samples+1),0.0f,1.0f),kGamma)*255;
-  };
-
+      if (denoiser) {
+        denoiser->Attach(frame);
+      }
+      if (heatmap) {
+        heatmap->Attach(frame);
+      }
 
+      rendered[current] = RenderBatch(q, scene, frame, pipeline, {ready});
+      executed_samples_glb += kSamplesPerPixel;
+      total_executed_samples += kSamplesPerPixel;
 
+      if (adaptive && executed_samples_glb >= kAdaptiveMinSamples &&
+          executed_samples_glb % kAdaptiveInterval == 0) {
+        rendered[current] = adaptive->Update(q, frame, {rendered[current]});
+      }
+      if (denoiser) {
+        /* Overwrites the framebuffer the batch wrote */
+        rendered[current] = denoiser->Denoise(q, frame, executed_samples_glb,
+                                              nullptr, {rendered[current]});
+      }
+      if (heatmap && heatmap_glb >= 0) {
+        rendered[current] = heatmap->Draw(q, frame,
+                                          (stats::Counter)heatmap_glb,
+                                          executed_samples_glb, nullptr,
+                                          {rendered[current]});
+      }
+      if (shown_heatmap != heatmap_glb) {
+        shown_heatmap = heatmap_glb;
+        std::string title = "SYCL Pathtracer";
+        if (shown_heatmap >= 0) {
+          title += std::string(" - ") +
+                   stats::CounterName((stats::Counter)shown_heatmap);
+        }
+        glfwSetWindowTitle(window, title.c_str());
+      }
 
-  
-  while (!glfwWindowShouldClose(window))
-  {
-      /* NOTE here how `sycl::nd_range` is used instead of `sycl::range`. This part is
-       * is important since it specifies the work group size. If the work group is not
-       * specified explicitely, this may result in bugs where the workers process data
-       * outside of the given range!!!!!!!
-       */
-      q.submit([&](sycl::handler& h) {
-        sycl::range<2> global_range{kImageWidth, kImageHeight};
-        sycl::range<2> local_range{kAABlockWidth, kAABlockHeight};
-        h.parallel_for(sycl::nd_range{global_range,local_range}, pathtracer);
-      }).wait_and_throw();
-      *executed_samples_glb += kSamplesPerPixel;
-      *total_executed_samples_glb += kSamplesPerPixel;
-      // printf("Done rendering frame\n");
+      /* Present the previous batch while the current one renders */
+      int previous = 1 - current;
+      current = previous;
+      if (!presentable) {
+        presentable = true;
+        glfwPollEvents();
+        continue;
+      }
+      rendered[previous].wait_and_throw();
 
       glBindTexture(GL_TEXTURE_2D, tex);
-      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
-      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, kImageWidth, kImageHeight, GL_RGB,
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos[previous]);
+      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGB,
         GL_UNSIGNED_BYTE, NULL);
       glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
       glBindTexture(GL_TEXTURE_2D, 0);
+      uploaded[previous] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
 
 
       glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
       glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
 
       glBlitFramebuffer(
-          0, 0, kImageWidth, kImageHeight,
-          0, 0, kImageWidth, kImageHeight,
+          0, 0, width, height,
+          0, 0, width, height,
           GL_COLOR_BUFFER_BIT, GL_NEAREST);
 
       glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
@@ -352,19 +864,147 @@ int main() {
       glfwPollEvents();
   }
   glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+  q.wait_and_throw();
+  if (adaptive) {
+    adaptive->Free(q);
+  }
+  if (denoiser) {
+    denoiser->Free(q);
+  }
+  if (heatmap) {
+    heatmap->Free(q);
+  }
 
-  checkCudaErrors(cudaGraphicsUnmapResources(1, &gresource, custream));
-  glDeleteBuffers(1, &pbo);
+  for (int i = 0; i < 2; i++) {
+    if (uploaded[i] != nullptr) glDeleteSync(uploaded[i]);
+  }
+  checkCudaErrors(cudaGraphicsUnmapResources(2, gresources, custream));
+  glDeleteBuffers(2, pbos);
   glDeleteTextures(1, &tex);
   glDeleteFramebuffers(1, &fbo);
   glfwTerminate();
 
-  sycl::free(camera, q);
-  sycl::free(materials, q);
-  sycl::free(objects, q);
   sycl::free(image, q);
-  sycl::free(executed_samples, q);
-  sycl::free(total_executed_samples, q);
-
   return 0;
-}
\ No newline at end of file
+}
+#endif
+
+
+int main(int argc, char** argv) {
+  Options options;
+  if (!ParseOptions(argc, argv, options)) {
+    return -1;
+  }
+
+  if (!options.workers.empty()) {
+    if (options.adaptive_error > 0.0f) {
+      printf("Adaptive sampling cannot be split over workers\n");
+      return -1;
+    }
+    return RenderCoordinator(options);
+  }
+  if (!options.worker.empty()) {
+    options.headless = true;
+  }
+  if (options.sort_rays && !options.wavefront) {
+    printf("--sort-rays needs --wavefront\n");
+    return -1;
+  }
+
+#ifndef PATHTRACER_WITH_VIEWER
+  /* Built without the viewer, there is nothing to render into but files */
+  options.headless = true;
+#else
+  /* The viewer shares its pixel buffer with the device through CUDA */
+  if (!options.headless) {
+    options.device = "gpu";
+  }
+#endif
+
+  if (options.animate > 0 && options.headless &&
+      (options.adaptive_error > 0.0f || options.denoise || options.aovs ||
+       options.stats || !options.worker.empty())) {
+    printf("Animations are rendered without adaptive sampling, denoising, "
+           "AOVs and stats and cannot be served as a worker\n");
+    return -1;
+  }
+
+  /* Construct objects that are shared between host and device */
+  sycl::device device;
+  try {
+    device = SelectDevice(options.device);
+  } catch (const sycl::exception &e) {
+    printf("SYCL error: No %s device available: %s\n", options.device.c_str(),
+           e.what());
+    return -1;
+  }
+  sycl::queue q(device);
+  printf("Rendering on %s\n",
+         device.get_info<sycl::info::device::name>().c_str());
+
+  std::optional<Scene> created = CreateScene(q, options);
+  if (!created.has_value()) {
+    return -1;
+  }
+  Scene &scene = *created;
+
+  std::optional<render::Wavefront> wavefront;
+  if (options.wavefront) {
+    wavefront.emplace(q, options.width, options.height, options.sort_rays);
+  }
+  /* Whole tiles per compute unit keep CPU cores busy and their caches warm */
+  std::optional<render::TileScheduler> tiles;
+  if (!options.wavefront && options.tiles && device.is_cpu()) {
+    tiles.emplace(q, options.width, options.height, options.tile_size);
+    printf("Scheduling %u tiles of %d pixels over %u workers\n",
+           tiles->TileCount(), options.tile_size, tiles->Workers());
+  }
+
+  Pipeline pipeline;
+  pipeline.wavefront = wavefront ? &*wavefront : nullptr;
+  pipeline.tiles = tiles ? &*tiles : nullptr;
+
+  std::optional<DynamicScene> dynamic;
+  std::optional<Animation> animation;
+  if (options.animate > 0) {
+    dynamic.emplace(q, scene, options.rebuild_threshold);
+    animation.emplace(scene);
+  }
+
+  int status;
+  if (!options.worker.empty()) {
+    /* Serves until killed, only returns if the socket could not be set up */
+    cluster::Job own = JobSettings(options);
+    cluster::ServeWorker(options.worker,
+                         [&](const cluster::Job &job,
+                             std::vector<float> &pixels) {
+      return RenderJob(q, options, scene, pipeline, own, job, pixels);
+    });
+    status = -1;
+  } else
+#ifdef PATHTRACER_WITH_VIEWER
+  if (!options.headless) {
+    status = RenderWindowed(q, options, scene, pipeline,
+                            dynamic ? &*dynamic : nullptr,
+                            animation ? &*animation : nullptr);
+  } else
+#endif
+  if (animation) {
+    status = RenderAnimation(q, options, scene, pipeline, *dynamic,
+                             *animation);
+  } else {
+    status = RenderHeadless(q, options, scene, pipeline);
+  }
+
+  if (wavefront) {
+    wavefront->Free(q);
+  }
+  if (tiles) {
+    tiles->Free(q);
+  }
+  if (dynamic) {
+    dynamic->Free(q);
+  }
+  FreeScene(scene, q);
+  return status;
+}
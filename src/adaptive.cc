@@ -0,0 +1,110 @@
+#include "include/adaptive.h"
+
+#include "include/utils.h"
+
+/* Work group size of the per tile kernel */
+static const int kAdaptiveGroupSize = 64;
+
+render::AdaptiveSampler::AdaptiveSampler(sycl::queue& q, int width,
+                                         int height, float threshold)
+    : width_(width),
+      height_(height),
+      tiles_x_((width + kAdaptiveTileSize - 1) / kAdaptiveTileSize),
+      tiles_y_((height + kAdaptiveTileSize - 1) / kAdaptiveTileSize),
+      threshold_(threshold) {
+  std::size_t pixels = (std::size_t)width * height;
+  this->squares_ = sycl::malloc_device<float>(pixels, q);
+  this->sample_counts_ = sycl::malloc_device<uint32_t>(pixels, q);
+  this->active_tiles_ = sycl::malloc_device<uint8_t>(this->TileCount(), q);
+  this->active_count_ = sycl::malloc_shared<uint32_t>(1, q);
+  *this->active_count_ = this->TileCount();
+}
+
+void render::AdaptiveSampler::Free(sycl::queue& q) {
+  sycl::free(this->squares_, q);
+  sycl::free(this->sample_counts_, q);
+  sycl::free(this->active_tiles_, q);
+  sycl::free(this->active_count_, q);
+}
+
+void render::AdaptiveSampler::Attach(Frame& frame) const {
+  frame.squares = this->squares_;
+  frame.sample_counts = this->sample_counts_;
+  frame.active_tiles = this->active_tiles_;
+}
+
+sycl::event render::AdaptiveSampler::Reset(
+    sycl::queue& q, const std::vector<sycl::event>& depends_on) {
+  return q.submit([&](sycl::handler& h) {
+    h.depends_on(depends_on);
+    h.fill(this->active_tiles_, (uint8_t)1, this->TileCount());
+  });
+}
+
+sycl::event render::AdaptiveSampler::Update(
+    sycl::queue& q, const Frame& frame,
+    const std::vector<sycl::event>& depends_on) {
+  const float* image = frame.image;
+  const float* squares = this->squares_;
+  const uint32_t* sample_counts = this->sample_counts_;
+  uint8_t* active_tiles = this->active_tiles_;
+  uint32_t* active_count = this->active_count_;
+  const int width = this->width_, height = this->height_;
+  const int tiles_x = this->tiles_x_;
+  const uint32_t tiles = this->TileCount();
+  const float threshold = this->threshold_;
+
+  sycl::event cleared = q.submit([&](sycl::handler& h) {
+    h.depends_on(depends_on);
+    h.fill(active_count, 0u, 1);
+  });
+
+  std::size_t groups = (tiles + kAdaptiveGroupSize - 1) / kAdaptiveGroupSize;
+  return q.submit([&](sycl::handler& h) {
+    h.depends_on(cleared);
+    h.parallel_for(sycl::nd_range<1>{sycl::range<1>{groups * kAdaptiveGroupSize},
+                                     sycl::range<1>{kAdaptiveGroupSize}},
+                   [=](sycl::nd_item<1> it) {
+      uint32_t tile = it.get_global_id(0);
+      if (tile >= tiles) return;
+
+      int x0 = (tile % tiles_x) * kAdaptiveTileSize;
+      int y0 = (tile / tiles_x) * kAdaptiveTileSize;
+      float worst = 0.0f;
+      for (int y = y0; y < sycl::min(y0 + kAdaptiveTileSize, height); y++) {
+        for (int x = x0; x < sycl::min(x0 + kAdaptiveTileSize, width); x++) {
+          uint32_t index = width * y + x;
+          /* The statistics are over batch means, see `AccumulatePixel` */
+          float batches = (float)sample_counts[index] / kSamplesPerPixel;
+          if (batches < 2.0f) {
+            worst = INFINITY;
+            continue;
+          }
+
+          const float* pixel = &image[index*3];
+          float mean = vecutils::Luminance(sycl::vec<float, 3>{
+                           pixel[0], pixel[1], pixel[2]}) /
+                       (float)sample_counts[index];
+          float variance = sycl::fmax(
+              (squares[index] / batches - mean * mean) * batches /
+                  (batches - 1.0f),
+              0.0f);
+          /* Relative to the mean, dark pixels are held to an absolute
+             error instead */
+          float error = sycl::sqrt(variance / batches) / (mean + 0.01f);
+          worst = sycl::fmax(worst, error);
+        }
+      }
+
+      bool active = worst > threshold;
+      active_tiles[tile] = active;
+      if (active) {
+        sycl::atomic_ref<uint32_t, sycl::memory_order::relaxed,
+                         sycl::memory_scope::device,
+                         sycl::access::address_space::global_space>
+            count(*active_count);
+        count.fetch_add(1u);
+      }
+    });
+  });
+}
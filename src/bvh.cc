@@ -0,0 +1,294 @@
+#include "include/bvh.h"
+
+#include <algorithm>
+
+/* Relative cost of one traversal step compared to one primitive test */
+const float kBVHTraversalCost = 1.0f;
+
+namespace {
+struct BuildPrimitive {
+  bvh::AABB bounds;
+  sycl::vec<float, 3> centroid;
+  uint32_t index;
+};
+
+struct Bin {
+  bvh::AABB bounds;
+  uint32_t count = 0;
+};
+
+void SetBounds(bvh::Node& node, const bvh::AABB& bounds) {
+  for (int i = 0; i < 3; i++) {
+    node.min[i] = bounds.min[i];
+    node.max[i] = bounds.max[i];
+  }
+}
+
+void MakeLeaf(bvh::Node& node, const bvh::AABB& bounds, uint32_t begin,
+              uint32_t end) {
+  SetBounds(node, bounds);
+  node.offset = begin;
+  node.count = end - begin;
+}
+
+/* Returns the index of the built node */
+uint32_t BuildRecursive(std::vector<bvh::Node>& nodes,
+                        std::vector<BuildPrimitive>& prims, uint32_t begin,
+                        uint32_t end, int depth, int leaf_width) {
+  uint32_t node_index = nodes.size();
+  nodes.emplace_back();
+
+  bvh::AABB bounds, centroid_bounds;
+  for (uint32_t i = begin; i < end; i++) {
+    bounds.Grow(prims[i].bounds);
+    centroid_bounds.Grow(prims[i].centroid);
+  }
+
+  uint32_t count = end - begin;
+  /* Leaves deeper than this would overflow the traversal stack */
+  if (count <= 1 || depth >= kBVHMaxDepth - 1) {
+    MakeLeaf(nodes[node_index], bounds, begin, end);
+    return node_index;
+  }
+
+  /* Find the cheapest split plane over all axes and bin boundaries */
+  float best_cost = INFINITY;
+  int best_axis = -1;
+  int best_split = 0;
+  for (int axis = 0; axis < 3; axis++) {
+    float cmin = centroid_bounds.min[axis];
+    float cmax = centroid_bounds.max[axis];
+    if (cmax <= cmin) continue;
+
+    Bin bins[kBVHBins];
+    float scale = kBVHBins / (cmax - cmin);
+    for (uint32_t i = begin; i < end; i++) {
+      int b = std::min(kBVHBins - 1,
+                       (int)((prims[i].centroid[axis] - cmin) * scale));
+      bins[b].bounds.Grow(prims[i].bounds);
+      bins[b].count++;
+    }
+
+    /* Sweep from the right to get the cost of every right side first */
+    float right_area[kBVHBins - 1];
+    uint32_t right_count[kBVHBins - 1];
+    bvh::AABB right_bounds;
+    uint32_t right_sum = 0;
+    for (int b = kBVHBins - 1; b > 0; b--) {
+      right_bounds.Grow(bins[b].bounds);
+      right_sum += bins[b].count;
+      right_area[b - 1] = right_bounds.SurfaceArea();
+      right_count[b - 1] = right_sum;
+    }
+
+    bvh::AABB left_bounds;
+    uint32_t left_sum = 0;
+    for (int b = 0; b < kBVHBins - 1; b++) {
+      left_bounds.Grow(bins[b].bounds);
+      left_sum += bins[b].count;
+      if (left_sum == 0 || right_count[b] == 0) continue;
+
+      float cost = left_bounds.SurfaceArea() *
+                       ((left_sum + leaf_width - 1) / leaf_width) +
+                   right_area[b] * ((right_count[b] + leaf_width - 1) /
+                                    leaf_width);
+      if (cost < best_cost) {
+        best_cost = cost;
+        best_axis = axis;
+        best_split = b;
+      }
+    }
+  }
+
+  float area = bounds.SurfaceArea();
+  float split_cost = area > 0.0f ? kBVHTraversalCost + best_cost / area
+                                 : INFINITY;
+  uint32_t batches = (count + leaf_width - 1) / leaf_width;
+  if (best_axis == -1 ||
+      (batches <= kBVHMaxLeafSize && split_cost >= batches)) {
+    /* Either cheaper as a leaf or all centroids coincide */
+    MakeLeaf(nodes[node_index], bounds, begin, end);
+    return node_index;
+  }
+
+  float cmin = centroid_bounds.min[best_axis];
+  float scale = kBVHBins / (centroid_bounds.max[best_axis] - cmin);
+  auto middle = std::partition(
+      prims.begin() + begin, prims.begin() + end,
+      [=](const BuildPrimitive& prim) {
+        int b = std::min(kBVHBins - 1,
+                         (int)((prim.centroid[best_axis] - cmin) * scale));
+        return b <= best_split;
+      });
+  uint32_t mid = middle - prims.begin();
+
+  BuildRecursive(nodes, prims, begin, mid, depth + 1, leaf_width);
+  uint32_t right =
+      BuildRecursive(nodes, prims, mid, end, depth + 1, leaf_width);
+
+  /* `nodes` may have been reallocated by the recursion */
+  bvh::Node& node = nodes[node_index];
+  SetBounds(node, bounds);
+  node.offset = right;
+  node.count = 0;
+  return node_index;
+}
+}  // namespace
+
+void bvh::Build(const std::vector<AABB>& bounds, std::vector<Node>& nodes,
+                std::vector<uint32_t>& order, int leaf_width) {
+  nodes.clear();
+  order.clear();
+  if (bounds.empty()) return;
+
+  std::vector<BuildPrimitive> prims(bounds.size());
+  for (std::size_t i = 0; i < bounds.size(); i++) {
+    prims[i].bounds = bounds[i];
+    prims[i].centroid = bounds[i].Centroid();
+    prims[i].index = i;
+  }
+
+  nodes.reserve(2 * bounds.size() - 1);
+  BuildRecursive(nodes, prims, 0, prims.size(), 0, leaf_width);
+
+  order.resize(prims.size());
+  for (std::size_t i = 0; i < prims.size(); i++) {
+    order[i] = prims[i].index;
+  }
+}
+
+bvh::BVH bvh::Upload(sycl::queue& q, const std::vector<Node>& nodes) {
+  BVH bvh;
+  bvh.node_count = nodes.size();
+  if (nodes.empty()) return bvh;
+
+  bvh.nodes = sycl::malloc_shared<Node>(nodes.size(), q);
+  std::copy(nodes.begin(), nodes.end(), bvh.nodes);
+  return bvh;
+}
+
+void bvh::Free(BVH& bvh, sycl::queue& q) {
+  if (bvh.nodes != nullptr) sycl::free(bvh.nodes, q);
+  bvh.nodes = nullptr;
+  bvh.node_count = 0;
+}
+
+bvh::Refitter::Refitter(sycl::queue& q, const BVH& tree) {
+  this->cost_ = sycl::malloc_shared<float>(1, q);
+  this->level_offsets_.push_back(0);
+  if (tree.node_count == 0) return;
+
+  /* Depth of every node, parents always come before their children */
+  std::vector<uint32_t> depths(tree.node_count, 0);
+  uint32_t max_depth = 0;
+  for (uint32_t i = 0; i < tree.node_count; i++) {
+    const Node& node = tree.nodes[i];
+    max_depth = std::max(max_depth, depths[i]);
+    if (node.count > 0) {
+      this->primitive_count_ =
+          std::max(this->primitive_count_, node.offset + node.count);
+    } else {
+      depths[i + 1] = depths[i] + 1;
+      depths[node.offset] = depths[i] + 1;
+    }
+  }
+
+  /* Counting sort of the nodes by depth */
+  this->level_offsets_.assign(max_depth + 2, 0);
+  for (uint32_t depth : depths) {
+    this->level_offsets_[depth + 1]++;
+  }
+  for (uint32_t d = 0; d <= max_depth; d++) {
+    this->level_offsets_[d + 1] += this->level_offsets_[d];
+  }
+  std::vector<uint32_t> levels(tree.node_count);
+  std::vector<uint32_t> next(this->level_offsets_.begin(),
+                             this->level_offsets_.end() - 1);
+  for (uint32_t i = 0; i < tree.node_count; i++) {
+    levels[next[depths[i]]++] = i;
+  }
+
+  this->levels_ = sycl::malloc_device<uint32_t>(levels.size(), q);
+  q.memcpy(this->levels_, levels.data(), levels.size() * sizeof(uint32_t));
+  this->bounds_ = sycl::malloc_device<AABB>(this->primitive_count_, q);
+  q.wait();
+}
+
+void bvh::Refitter::Free(sycl::queue& q) {
+  if (this->levels_ != nullptr) sycl::free(this->levels_, q);
+  if (this->bounds_ != nullptr) sycl::free(this->bounds_, q);
+  sycl::free(this->cost_, q);
+}
+
+sycl::event bvh::Refitter::Refit(sycl::queue& q, const BVH& tree,
+                                 const std::vector<sycl::event>& depends_on) {
+  Node* nodes = tree.nodes;
+  const uint32_t* levels = this->levels_;
+  const AABB* bounds = this->bounds_;
+
+  sycl::event refit;
+  bool first = true;
+  for (std::size_t d = this->level_offsets_.size() - 1; d-- > 0;) {
+    uint32_t begin = this->level_offsets_[d];
+    uint32_t count = this->level_offsets_[d + 1] - begin;
+    refit = q.submit([&](sycl::handler& h) {
+      if (first) {
+        h.depends_on(depends_on);
+      } else {
+        h.depends_on(refit);
+      }
+      h.parallel_for(sycl::range<1>(count), [=](sycl::id<1> i) {
+        uint32_t index = levels[begin + i];
+        Node& node = nodes[index];
+
+        AABB box;
+        if (node.count > 0) {
+          for (uint32_t p = node.offset; p < node.offset + node.count; p++) {
+            box.Grow(bounds[p]);
+          }
+        } else {
+          for (uint32_t child : {index + 1, node.offset}) {
+            const Node& c = nodes[child];
+            box.Grow(AABB({c.min[0], c.min[1], c.min[2]},
+                          {c.max[0], c.max[1], c.max[2]}));
+          }
+        }
+        for (int a = 0; a < 3; a++) {
+          node.min[a] = box.min[a];
+          node.max[a] = box.max[a];
+        }
+      });
+    });
+    first = false;
+  }
+  return refit;
+}
+
+float bvh::Refitter::Cost(sycl::queue& q, const BVH& tree,
+                          const std::vector<sycl::event>& depends_on) {
+  if (tree.node_count == 0) return 0.0f;
+
+  const Node* nodes = tree.nodes;
+  float* cost = this->cost_;
+  *cost = 0.0f;
+  q.submit([&](sycl::handler& h) {
+    h.depends_on(depends_on);
+    h.parallel_for(sycl::range<1>(tree.node_count), [=](sycl::id<1> i) {
+      auto area = [](const Node& node) {
+        return AABB({node.min[0], node.min[1], node.min[2]},
+                    {node.max[0], node.max[1], node.max[2]}).SurfaceArea();
+      };
+      float root_area = area(nodes[0]);
+      if (root_area <= 0.0f) return;
+
+      /* Probability of a ray through the root hitting the node, times the
+         work done there */
+      const Node& node = nodes[i];
+      float work = node.count > 0 ? (float)node.count : kBVHTraversalCost;
+      sycl::atomic_ref<float, sycl::memory_order::relaxed,
+                       sycl::memory_scope::device>(*cost)
+          .fetch_add(area(node) / root_area * work);
+    });
+  }).wait_and_throw();
+  return *cost;
+}
@@ -48,7 +48,7 @@ Camera::Camera(sycl::vec<float, 3> dir, sycl::vec<float, 3> origin,
   this->LookAt(dir, up);
 }
 
-void Camera::GenerateRay(int w, int h, Ray& ray) const {
+void Camera::GenerateRay(float w, float h, Ray& ray) const {
   /* OpenGL buffers start from bottom left corner */
   h = this->pheight_ - h;
 
@@ -58,6 +58,9 @@ void Camera::GenerateRay(int w, int h, Ray& ray) const {
 
   ray.dir = sycl::normalize(dir);
   ray.origin = this->origin_;
+  /* A pinhole, the cone opens by the angle of a pixel */
+  ray.cone_width = 0.0f;
+  ray.cone_spread = this->h_factor_ / this->focal_length_;
 }
 
 void Camera::UpdateFOV(float fov) {
@@ -0,0 +1,233 @@
+#include "include/cluster.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+const char kJobMagic[4] = {'P', 'T', 'J', 'B'};
+const char kImageMagic[4] = {'P', 'T', 'I', 'M'};
+const uint32_t kProtocolVersion = 2;
+
+struct JobMessage {
+  char magic[4];
+  uint32_t version;
+  cluster::Job job;
+};
+
+/* Followed by `width*height*3` floats if `ok` */
+struct ImageMessage {
+  char magic[4];
+  uint32_t ok;
+  uint32_t width;
+  uint32_t height;
+};
+
+bool SendAll(int socket, const void* data, std::size_t size) {
+  const char* bytes = static_cast<const char*>(data);
+  while (size > 0) {
+    ssize_t sent = send(socket, bytes, size, MSG_NOSIGNAL);
+    if (sent <= 0) return false;
+    bytes += sent;
+    size -= sent;
+  }
+  return true;
+}
+
+bool ReceiveAll(int socket, void* data, std::size_t size) {
+  char* bytes = static_cast<char*>(data);
+  while (size > 0) {
+    ssize_t received = recv(socket, bytes, size, 0);
+    if (received <= 0) return false;
+    bytes += received;
+    size -= received;
+  }
+  return true;
+}
+
+/*  Resolves `host:port`. An empty host is the loopback interface, to connect
+    to as well as to listen on. Returns `nullptr` after printing the reason if
+    it does not resolve */
+addrinfo* Resolve(const std::string& address) {
+  std::size_t colon = address.rfind(':');
+  if (colon == std::string::npos) {
+    printf("Cluster error: %s: Expected host:port\n", address.c_str());
+    return nullptr;
+  }
+  std::string host = address.substr(0, colon);
+  std::string port = address.substr(colon + 1);
+
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* result = nullptr;
+  int error = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(),
+                          &hints, &result);
+  if (error != 0) {
+    printf("Cluster error: %s: %s\n", address.c_str(), gai_strerror(error));
+    return nullptr;
+  }
+  return result;
+}
+
+/* Connected socket to the worker at `address`, -1 on failure */
+int Connect(const std::string& address) {
+  addrinfo* candidates = Resolve(address);
+  int fd = -1;
+  for (addrinfo* a = candidates; a != nullptr && fd < 0; a = a->ai_next) {
+    fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+    if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  if (candidates != nullptr) {
+    freeaddrinfo(candidates);
+    if (fd < 0) printf("Cluster error: %s: Cannot connect\n", address.c_str());
+  }
+  return fd;
+}
+
+/* Serves jobs on one coordinator connection until it is closed */
+void ServeConnection(int connection, const cluster::JobRenderer& render) {
+  JobMessage request;
+  while (ReceiveAll(connection, &request, sizeof(request))) {
+    if (std::memcmp(request.magic, kJobMagic, sizeof(kJobMagic)) != 0 ||
+        request.version != kProtocolVersion) {
+      printf("Cluster error: Unknown message, closing the connection\n");
+      return;
+    }
+
+    const cluster::Job& job = request.job;
+    printf("Rendering samples %u to %u\n", job.first_sample,
+           job.first_sample + job.samples - 1);
+    std::vector<float> image;
+    bool ok = render(job, image) &&
+              image.size() == (std::size_t)job.width * job.height * 3;
+    /* Workers usually log into files */
+    fflush(stdout);
+
+    ImageMessage reply;
+    std::memcpy(reply.magic, kImageMagic, sizeof(kImageMagic));
+    reply.ok = ok;
+    reply.width = job.width;
+    reply.height = job.height;
+    if (!SendAll(connection, &reply, sizeof(reply)) ||
+        (ok && !SendAll(connection, image.data(),
+                        image.size() * sizeof(float)))) {
+      return;
+    }
+  }
+}
+}  // namespace
+
+uint64_t cluster::HashFile(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) return 0;
+  uint64_t hash = 0xCBF29CE484222325ull;
+  char buffer[1 << 16];
+  while (file.read(buffer, sizeof(buffer)) || file.gcount() > 0) {
+    for (std::streamsize i = 0; i < file.gcount(); i++) {
+      hash = (hash ^ (unsigned char)buffer[i]) * 0x100000001B3ull;
+    }
+  }
+  return hash;
+}
+
+void cluster::ServeWorker(const std::string& address,
+                          const JobRenderer& render) {
+  addrinfo* candidates = Resolve(address);
+  if (candidates == nullptr) return;
+
+  int listener = -1;
+  for (addrinfo* a = candidates; a != nullptr && listener < 0;
+       a = a->ai_next) {
+    listener = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+    int reuse = 1;
+    if (listener >= 0 &&
+        (setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse,
+                    sizeof(reuse)) != 0 ||
+         bind(listener, a->ai_addr, a->ai_addrlen) != 0 ||
+         listen(listener, 4) != 0)) {
+      close(listener);
+      listener = -1;
+    }
+  }
+  freeaddrinfo(candidates);
+  if (listener < 0) {
+    printf("Cluster error: %s: Cannot listen\n", address.c_str());
+    return;
+  }
+
+  printf("Worker listening on %s\n", address.c_str());
+  fflush(stdout);
+  while (true) {
+    int connection = accept(listener, nullptr, nullptr);
+    if (connection < 0) continue;
+    int no_delay = 1;
+    setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, &no_delay,
+               sizeof(no_delay));
+    ServeConnection(connection, render);
+    close(connection);
+  }
+}
+
+bool cluster::RenderDistributed(const std::vector<std::string>& addresses,
+                                const Job& settings, uint32_t samples,
+                                std::vector<float>& image) {
+  uint32_t width = settings.width, height = settings.height;
+  /* Every worker gets at least one sample */
+  uint32_t count = std::min<std::size_t>(addresses.size(), samples);
+  std::vector<int> connections;
+  bool ok = true;
+  for (uint32_t i = 0; i < count; i++) {
+    int connection = Connect(addresses[i]);
+    ok = ok && connection >= 0;
+    connections.push_back(connection);
+  }
+
+  /* All workers render at the same time, their replies are collected in
+     order afterwards */
+  for (uint32_t i = 0; ok && i < count; i++) {
+    JobMessage request;
+    std::memcpy(request.magic, kJobMagic, sizeof(kJobMagic));
+    request.version = kProtocolVersion;
+    request.job = settings;
+    request.job.first_sample = (uint64_t)samples * i / count;
+    request.job.samples = (uint64_t)samples * (i + 1) / count -
+                          request.job.first_sample;
+    if (!SendAll(connections[i], &request, sizeof(request))) {
+      printf("Cluster error: %s: Cannot send job\n", addresses[i].c_str());
+      ok = false;
+    }
+  }
+
+  image.assign((std::size_t)width * height * 3, 0.0f);
+  std::vector<float> part(image.size());
+  for (uint32_t i = 0; ok && i < count; i++) {
+    ImageMessage reply;
+    ok = ReceiveAll(connections[i], &reply, sizeof(reply)) &&
+         std::memcmp(reply.magic, kImageMagic, sizeof(kImageMagic)) == 0 &&
+         reply.ok && reply.width == width && reply.height == height &&
+         ReceiveAll(connections[i], part.data(), part.size() * sizeof(float));
+    if (!ok) {
+      printf("Cluster error: %s: Job failed\n", addresses[i].c_str());
+      break;
+    }
+    for (std::size_t p = 0; p < image.size(); p++) {
+      image[p] += part[p];
+    }
+  }
+
+  for (int connection : connections) {
+    if (connection >= 0) close(connection);
+  }
+  return ok;
+}
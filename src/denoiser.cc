@@ -0,0 +1,196 @@
+#include "include/denoiser.h"
+
+#include "include/integrator.h"
+#include "include/utils.h"
+
+/* Keeps black albedos from turning the irradiance infinite */
+static const float kAlbedoEpsilon = 0.01f;
+/* Color difference the first pass still averages over, halved every pass */
+static const float kSigmaColor = 0.5f;
+/* Sharpness of the normal weight, the exponent of the normals' cosine */
+static const float kNormalPower = 8.0f;
+/* Depth difference relative to the center depth tolerated per pixel step */
+static const float kSigmaDepth = 0.03f;
+
+/* B3 spline filter taps */
+static const float kKernel[5] = {1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4,
+                                 1.0f / 16};
+
+render::Denoiser::Denoiser(sycl::queue& q, int width, int height)
+    : width_(width), height_(height) {
+  std::size_t pixels = (std::size_t)width * height;
+  this->albedo_ = sycl::malloc_device<float>(pixels * 3, q);
+  this->normal_ = sycl::malloc_device<float>(pixels * 3, q);
+  this->depth_ = sycl::malloc_device<float>(pixels, q);
+  this->mean_albedo_ = sycl::malloc_device<sycl::vec<float, 3>>(pixels, q);
+  this->mean_normal_ = sycl::malloc_device<sycl::vec<float, 3>>(pixels, q);
+  this->mean_depth_ = sycl::malloc_device<float>(pixels, q);
+  this->irradiance_[0] = sycl::malloc_device<sycl::vec<float, 3>>(pixels, q);
+  this->irradiance_[1] = sycl::malloc_device<sycl::vec<float, 3>>(pixels, q);
+}
+
+void render::Denoiser::Free(sycl::queue& q) {
+  sycl::free(this->albedo_, q);
+  sycl::free(this->normal_, q);
+  sycl::free(this->depth_, q);
+  sycl::free(this->mean_albedo_, q);
+  sycl::free(this->mean_normal_, q);
+  sycl::free(this->mean_depth_, q);
+  sycl::free(this->irradiance_[0], q);
+  sycl::free(this->irradiance_[1], q);
+}
+
+void render::Denoiser::Attach(Frame& frame) const {
+  frame.albedo = this->albedo_;
+  frame.normal = this->normal_;
+  frame.depth = this->depth_;
+}
+
+sycl::event render::Denoiser::Denoise(
+    sycl::queue& q, const Frame& frame, int samples, float* output,
+    const std::vector<sycl::event>& depends_on) {
+  sycl::vec<float, 3>* mean_albedo = this->mean_albedo_;
+  sycl::vec<float, 3>* mean_normal = this->mean_normal_;
+  float* mean_depth = this->mean_depth_;
+  const int width = this->width_, height = this->height_;
+
+  sycl::range<2> global_range{(size_t)width, (size_t)height};
+  sycl::range<2> local_range{kAABlockWidth, kAABlockHeight};
+  sycl::nd_range<2> pixels{global_range, local_range};
+
+  /* Means of the color and the features, the color divided by the albedo */
+  sycl::vec<float, 3>* first = this->irradiance_[0];
+  sycl::event filtered = q.submit([&](sycl::handler& h) {
+    h.depends_on(depends_on);
+    h.parallel_for(pixels, [=](sycl::nd_item<2> it) {
+      uint32_t index = width * it.get_global_id(1) + it.get_global_id(0);
+      float count = frame.sample_counts != nullptr
+                        ? sycl::fmax((float)frame.sample_counts[index], 1.0f)
+                        : (float)samples;
+
+      auto mean = [&](const float* sums) {
+        return sycl::vec<float, 3>{sums[index*3], sums[index*3+1],
+                                   sums[index*3+2]} / count;
+      };
+      sycl::vec<float, 3> albedo = mean(frame.albedo);
+      sycl::vec<float, 3> normal = mean(frame.normal);
+      float length = sycl::length(normal);
+
+      mean_albedo[index] = albedo;
+      mean_normal[index] = length > 0.0f ? normal / length : normal;
+      mean_depth[index] = frame.depth[index] / count;
+      first[index] = mean(frame.image) / (albedo + kAlbedoEpsilon);
+    });
+  });
+
+  for (int pass = 0; pass < kDenoiserPasses; pass++) {
+    const sycl::vec<float, 3>* in = this->irradiance_[pass % 2];
+    sycl::vec<float, 3>* out = this->irradiance_[1 - pass % 2];
+    const int step = 1 << pass;
+    const float sigma_color = kSigmaColor / step;
+
+    filtered = q.submit([&](sycl::handler& h) {
+      h.depends_on(filtered);
+      h.parallel_for(pixels, [=](sycl::nd_item<2> it) {
+        int x = it.get_global_id(0);
+        int y = it.get_global_id(1);
+        uint32_t center = width * y + x;
+
+        /* Colors are compared after compressing their dynamic range, so
+           bright and dark regions are smoothed alike */
+        auto compress = [](const sycl::vec<float, 3>& c) {
+          return c / (1.0f + vecutils::Luminance(c));
+        };
+        sycl::vec<float, 3> color = compress(in[center]);
+        sycl::vec<float, 3> normal = mean_normal[center];
+        float depth = mean_depth[center];
+        bool miss = depth == 0.0f;
+
+        sycl::vec<float, 3> sum{0.0f, 0.0f, 0.0f};
+        float weights = 0.0f;
+        for (int dy = -2; dy <= 2; dy++) {
+          int ty = y + dy * step;
+          if (ty < 0 || ty >= height) continue;
+          for (int dx = -2; dx <= 2; dx++) {
+            int tx = x + dx * step;
+            if (tx < 0 || tx >= width) continue;
+            uint32_t tap = width * ty + tx;
+
+            sycl::vec<float, 3> difference = compress(in[tap]) - color;
+            float w_color = sycl::exp(-sycl::dot(difference, difference) /
+                                      (sigma_color * sigma_color));
+
+            /* Misses have no normal and depth, they only blend together */
+            float tap_depth = mean_depth[tap];
+            float w_geometry;
+            if (miss || tap_depth == 0.0f) {
+              w_geometry = miss == (tap_depth == 0.0f) ? 1.0f : 0.0f;
+            } else {
+              float cosine =
+                  sycl::fmax(sycl::dot(normal, mean_normal[tap]), 0.0f);
+              /* Depth may change more the farther away the tap is */
+              float distance = step * sycl::max(sycl::abs(dx), sycl::abs(dy));
+              w_geometry = sycl::pow(cosine, kNormalPower) *
+                           sycl::exp(-sycl::fabs(depth - tap_depth) /
+                                     (kSigmaDepth * depth *
+                                      sycl::fmax(distance, 1.0f)));
+            }
+
+            float weight = kKernel[dx + 2] * kKernel[dy + 2] * w_color *
+                           w_geometry;
+            sum += in[tap] * weight;
+            weights += weight;
+          }
+        }
+        /* The center tap always has weight */
+        out[center] = sum / weights;
+      });
+    });
+  }
+
+  /* Multiply the albedo back in */
+  const sycl::vec<float, 3>* last = this->irradiance_[kDenoiserPasses % 2];
+  return q.submit([&](sycl::handler& h) {
+    h.depends_on(filtered);
+    h.parallel_for(pixels, [=](sycl::nd_item<2> it) {
+      uint32_t index = width * it.get_global_id(1) + it.get_global_id(0);
+      sycl::vec<float, 3> color =
+          last[index] * (mean_albedo[index] + kAlbedoEpsilon);
+
+      for (int c = 0; c < 3; c++) {
+        if (output != nullptr) {
+          output[index*3+c] = color[c];
+        }
+        if (frame.framebuffer != nullptr) {
+          sycl::device_ptr<uint8_t> framebuffer = frame.framebuffer;
+          framebuffer[index*3+c] = ToDisplay(color[c], 1.0f);
+        }
+      }
+    });
+  });
+}
+
+void render::Denoiser::ReadFeatures(sycl::queue& q, std::vector<float>& albedo,
+                                    std::vector<float>& normal,
+                                    std::vector<float>& depth) {
+  std::size_t pixels = (std::size_t)this->width_ * this->height_;
+  std::vector<sycl::vec<float, 3>> albedos(pixels), normals(pixels);
+  std::vector<float> depths(pixels);
+  q.memcpy(albedos.data(), this->mean_albedo_,
+           pixels * sizeof(sycl::vec<float, 3>));
+  q.memcpy(normals.data(), this->mean_normal_,
+           pixels * sizeof(sycl::vec<float, 3>));
+  q.memcpy(depths.data(), this->mean_depth_, pixels * sizeof(float));
+  q.wait();
+
+  albedo.resize(pixels * 3);
+  normal.resize(pixels * 3);
+  depth.resize(pixels * 3);
+  for (std::size_t i = 0; i < pixels; i++) {
+    for (int c = 0; c < 3; c++) {
+      albedo[i*3+c] = albedos[i][c];
+      normal[i*3+c] = normals[i][c];
+      depth[i*3+c] = depths[i];
+    }
+  }
+}
@@ -0,0 +1,109 @@
+#include "include/dynamic.h"
+
+#include <chrono>
+#include <cmath>
+
+/* Orbit radius of the animation relative to the half diagonal of an object */
+static const float kOrbitScale = 1.5f;
+/* Angular speed of the orbits in radians per second */
+static const float kOrbitSpeed = 1.0f;
+/* Phase offset between consecutive objects, the golden angle */
+static const float kOrbitPhase = 2.39996323f;
+
+DynamicScene::DynamicScene(sycl::queue& q, Scene& scene,
+                           float rebuild_threshold)
+    : scene_(&scene), refitter_(q, scene.bvh.tree),
+      rebuild_threshold_(rebuild_threshold) {
+  this->built_cost_ = this->refitter_.Cost(q, scene.bvh.tree);
+  this->cost_ = this->built_cost_;
+}
+
+void DynamicScene::Free(sycl::queue& q) {
+  this->refitter_.Free(q);
+}
+
+bool DynamicScene::Update(sycl::queue& q) {
+  if (!this->moved_) return false;
+  this->moved_ = false;
+
+  auto start = std::chrono::steady_clock::now();
+  sycl::event refit = RefitSceneBVH(q, *this->scene_->objects,
+                                    this->scene_->bvh, this->refitter_);
+  this->cost_ = this->refitter_.Cost(q, this->scene_->bvh.tree, {refit});
+  auto refitted = std::chrono::steady_clock::now();
+  this->refit_seconds_ +=
+      std::chrono::duration<double>(refitted - start).count();
+  this->refits_++;
+
+  if (this->cost_ <= this->rebuild_threshold_ * this->built_cost_) {
+    return false;
+  }
+
+  /* The tree got too loose, start over from the current bounds */
+  this->refitter_.Free(q);
+  FreeSceneBVH(this->scene_->bvh, q);
+  this->scene_->bvh = BuildSceneBVH(q, *this->scene_->objects);
+  this->refitter_ = bvh::Refitter(q, this->scene_->bvh.tree);
+  this->built_cost_ = this->refitter_.Cost(q, this->scene_->bvh.tree);
+  this->cost_ = this->built_cost_;
+  this->rebuild_seconds_ += std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - refitted).count();
+  this->rebuilds_++;
+  return true;
+}
+
+/* Half the diagonal of `bounds` */
+static float Extent(const bvh::AABB& bounds) {
+  return 0.5f * sycl::length(bounds.max - bounds.min);
+}
+
+Animation::Animation(const Scene& scene) {
+  auto sampled = [&scene](material::Id material_id) {
+    return scene.emitters.count > 0 && scene.emitters.Sampled(material_id);
+  };
+
+  scene.objects->forEachIndexed([&](const auto& obj,
+                                    [[maybe_unused]] std::size_t type,
+                                    std::size_t index) {
+    using T = std::decay_t<decltype(obj)>;
+    if constexpr (std::is_same_v<T, Sphere>) {
+      if (!sampled(obj.MaterialId())) {
+        this->spheres_.emplace_back(index, obj);
+      }
+    } else if constexpr (std::is_same_v<T, Instance>) {
+      const Mesh& mesh = obj.Geometry();
+      for (uint32_t i = 0; i < mesh.TriangleCount(); i++) {
+        if (sampled(mesh.Triangle(i).MaterialId())) return;
+      }
+      this->instances_.emplace_back(index, obj);
+    }
+  });
+}
+
+void Animation::Apply(DynamicScene& dynamic, float time) const {
+  std::size_t n = 0;
+  /* Offset from the loaded place, zero at time 0 */
+  auto offset = [&n, time](float radius) {
+    float phase = kOrbitPhase * n++;
+    float angle = kOrbitSpeed * time + phase;
+    return sycl::vec<float, 3>{
+        radius * (std::cos(angle) - std::cos(phase)),
+        radius * (std::sin(angle) - std::sin(phase)), 0.0f};
+  };
+
+  for (const auto& [index, sphere] : this->spheres_) {
+    sycl::vec<float, 3> moved = offset(kOrbitScale * Extent(sphere.Bounds()));
+    dynamic.Move(index, Sphere(sphere.Origin() + moved, sphere.Radius(),
+                               sphere.MaterialId()));
+  }
+  for (const auto& [index, instance] : this->instances_) {
+    sycl::vec<float, 3> moved =
+        offset(kOrbitScale * Extent(instance.Bounds()));
+    Transform to_world = instance.ToWorld();
+    for (int r = 0; r < 3; r++) {
+      to_world.rows[r][3] += moved[r];
+    }
+    dynamic.Move(index, Instance(instance.Geometry(),
+                                 instance.GeometryIndex(), to_world));
+  }
+}
@@ -0,0 +1,214 @@
+#include "include/emitter.h"
+
+#include <algorithm>
+
+EmitterList BuildEmitterList(
+    sycl::queue& q, const containerutils::VariantContainer<Objects>& objects,
+    const std::vector<Material>& materials) {
+  std::vector<Emitter> emitters;
+  std::vector<float> power;
+  std::vector<bool> sampled(materials.size(), false);
+
+  /*  Whether hits on a material add its emission is decided per material, so
+      the emissive materials of planes stay unsampled on every object */
+  std::vector<bool> on_plane(materials.size(), false);
+  objects.forEach([&](const auto& obj) {
+    using T = std::decay_t<decltype(obj)>;
+    if constexpr (std::is_same_v<T, Plane>) {
+      on_plane[obj.MaterialId()] = true;
+    }
+  });
+
+  auto emission = [&](material::Id material_id) {
+    if (on_plane[material_id]) return 0.0f;
+    return vecutils::Luminance(materials[material_id].Emission());
+  };
+
+  /* Emissive triangles of `mesh`, moved into the world by `to_world` */
+  auto add_triangles = [&](const Mesh& mesh, const Transform& to_world) {
+    for (uint32_t i = 0; i < mesh.TriangleCount(); i++) {
+      MeshTriangle triangle = mesh.Triangle(i);
+      sycl::vec<float, 3> edge1 = to_world.Vector(triangle.Edge1());
+      sycl::vec<float, 3> edge2 = to_world.Vector(triangle.Edge2());
+      float luminance = emission(triangle.MaterialId());
+      float area = 0.5f * sycl::length(sycl::cross(edge1, edge2));
+      /* Also skips the unused packet slots, they have no area */
+      if (luminance <= 0.0f || area <= 0.0f) continue;
+
+      Emitter emitter{};
+      emitter.shape = Emitter::kTriangle;
+      emitter.material_id = triangle.MaterialId();
+      emitter.origin = to_world.Point(triangle.A());
+      emitter.edge1 = edge1;
+      emitter.edge2 = edge2;
+      emitters.push_back(emitter);
+      power.push_back(luminance * area);
+      sampled[triangle.MaterialId()] = true;
+    }
+  };
+
+  objects.forEach([&](const auto& obj) {
+    using T = std::decay_t<decltype(obj)>;
+    if constexpr (std::is_same_v<T, Sphere>) {
+      float luminance = emission(obj.MaterialId());
+      if (luminance <= 0.0f) return;
+
+      Emitter emitter{};
+      emitter.shape = Emitter::kSphere;
+      emitter.material_id = obj.MaterialId();
+      emitter.origin = obj.Origin();
+      emitter.radius = obj.Radius();
+      emitters.push_back(emitter);
+      power.push_back(luminance * 4.0f * M_PI * obj.Radius() * obj.Radius());
+      sampled[obj.MaterialId()] = true;
+    } else if constexpr (std::is_same_v<T, Mesh>) {
+      add_triangles(obj, Transform());
+    } else if constexpr (std::is_same_v<T, Instance>) {
+      add_triangles(obj.Geometry(), obj.ToWorld());
+    }
+  });
+
+  EmitterList list;
+  if (emitters.empty()) {
+    return list;
+  }
+
+  /* Normalized running sum of the emitted power */
+  double total = 0.0;
+  for (float p : power) total += p;
+  std::vector<float> cdf(power.size());
+  double sum = 0.0;
+  for (std::size_t i = 0; i < power.size(); i++) {
+    sum += power[i];
+    cdf[i] = (float)(sum / total);
+  }
+  cdf.back() = 1.0f;
+
+  list.count = emitters.size();
+  list.emitters = sycl::malloc_shared<Emitter>(emitters.size(), q);
+  std::copy(emitters.begin(), emitters.end(), list.emitters);
+  list.cdf = sycl::malloc_shared<float>(cdf.size(), q);
+  std::copy(cdf.begin(), cdf.end(), list.cdf);
+  std::size_t words = 0;
+  for (std::size_t i = 0; i < sampled.size(); i++) {
+    if (sampled[i]) words = i / 32 + 1;
+  }
+  list.sampled_words = words;
+  list.sampled_materials = sycl::malloc_shared<uint32_t>(words, q);
+  std::fill(list.sampled_materials, list.sampled_materials + words, 0u);
+  for (std::size_t i = 0; i < sampled.size(); i++) {
+    if (sampled[i]) list.sampled_materials[i / 32] |= 1u << (i % 32);
+  }
+  return list;
+}
+
+void FreeEmitterList(EmitterList& emitters, sycl::queue& q) {
+  if (emitters.emitters != nullptr) sycl::free(emitters.emitters, q);
+  if (emitters.cdf != nullptr) sycl::free(emitters.cdf, q);
+  if (emitters.sampled_materials != nullptr) {
+    sycl::free(emitters.sampled_materials, q);
+  }
+  emitters = EmitterList();
+}
+
+/*  Uniform direction inside the cone the sphere subtends from `p`. The
+    density is constant over the cone, so the whole visible cap is covered
+    without wasting samples on its back side */
+static bool SampleSphere(const Emitter& emitter, const sycl::vec<float, 3>& p,
+                         float u1, float u2, EmitterSample& sample,
+                         float& pdf) {
+  sycl::vec<float, 3> to_center = emitter.origin - p;
+  float distance_sq = sycl::dot(to_center, to_center);
+  float radius_sq = emitter.radius * emitter.radius;
+  if (distance_sq <= radius_sq) {
+    return false;
+  }
+
+  float distance = sycl::sqrt(distance_sq);
+  sycl::vec<float, 3> w = to_center / distance;
+  float sin_max_sq = radius_sq / distance_sq;
+  float cos_max = sycl::sqrt(1.0f - sin_max_sq);
+  /* 1 - cos_max without cancellation for small or far spheres */
+  float one_minus_cos_max = sin_max_sq / (1.0f + cos_max);
+
+  float cos_theta = 1.0f - u1 * one_minus_cos_max;
+  float sin_theta = sycl::sqrt(sycl::fmax(0.0f, 1.0f - cos_theta * cos_theta));
+  float phi = 2.0f * M_PI * u2;
+
+  sycl::vec<float, 3> u, v;
+  vecutils::PlaneVectors(w, u, v);
+  sample.dir = u * (sin_theta * sycl::cos(phi)) +
+               v * (sin_theta * sycl::sin(phi)) + w * cos_theta;
+
+  /* Nearest intersection of the direction with the sphere */
+  float b = distance * cos_theta;
+  float c = distance_sq - radius_sq;
+  sample.distance = b - sycl::sqrt(sycl::fmax(0.0f, b * b - c));
+
+  pdf = 1.0f / (2.0f * M_PI * one_minus_cos_max);
+  return true;
+}
+
+/* Uniform point on the triangle, the area density converted to solid angle */
+static bool SampleTriangle(const Emitter& emitter, const sycl::vec<float, 3>& p,
+                           float u1, float u2, EmitterSample& sample,
+                           float& pdf) {
+  float su = sycl::sqrt(u1);
+  sycl::vec<float, 3> point = emitter.origin +
+                              emitter.edge1 * (su * (1.0f - u2)) +
+                              emitter.edge2 * (su * u2);
+
+  sycl::vec<float, 3> to_point = point - p;
+  float distance_sq = sycl::dot(to_point, to_point);
+  sample.distance = sycl::sqrt(distance_sq);
+  if (sample.distance <= 0.0f) {
+    return false;
+  }
+  sample.dir = to_point / sample.distance;
+
+  sycl::vec<float, 3> cross = sycl::cross(emitter.edge1, emitter.edge2);
+  float double_area = sycl::length(cross);
+  /* Only the side the winding normal points to emits, see `Shade` */
+  float cos_light = -sycl::dot(cross, sample.dir) / double_area;
+  if (cos_light <= 0.0f) {
+    return false;
+  }
+
+  pdf = distance_sq / (0.5f * double_area * cos_light);
+  return true;
+}
+
+bool SampleEmitter(const EmitterList& emitters, const Material* materials,
+                   const sycl::vec<float, 3>& p, float u0, float u1, float u2,
+                   EmitterSample& sample) {
+  if (emitters.count == 0) {
+    return false;
+  }
+
+  /* First CDF entry above `u0` */
+  uint32_t low = 0, high = emitters.count - 1;
+  while (low < high) {
+    uint32_t middle = (low + high) / 2;
+    if (emitters.cdf[middle] <= u0) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  float pick = emitters.cdf[low] - (low > 0 ? emitters.cdf[low - 1] : 0.0f);
+  if (pick <= 0.0f) {
+    return false;
+  }
+
+  const Emitter& emitter = emitters.emitters[low];
+  float pdf;
+  bool valid = emitter.shape == Emitter::kSphere
+                   ? SampleSphere(emitter, p, u1, u2, sample, pdf)
+                   : SampleTriangle(emitter, p, u1, u2, sample, pdf);
+  if (!valid) {
+    return false;
+  }
+
+  sample.radiance = materials[emitter.material_id].Emission() / (pick * pdf);
+  return true;
+}
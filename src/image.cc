@@ -0,0 +1,61 @@
+#include "include/image.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+bool imageutils::WritePPM(const std::string& path, const float* rgb, int width,
+                          int height, int samples) {
+  FILE* file = std::fopen(path.c_str(), "wb");
+  if (file == nullptr) {
+    return false;
+  }
+
+  std::fprintf(file, "P6\n%d %d\n255\n", width, height);
+
+  const float kGamma = 1.0f / 2.2f;
+  std::vector<uint8_t> row(width * 3);
+  /* PPM is stored top row first while the accumulation buffer is not */
+  for (int h = height - 1; h >= 0; h--) {
+    for (int i = 0; i < width * 3; i++) {
+      float value = rgb[(std::size_t)width * 3 * h + i] / samples;
+      value = std::fmin(std::fmax(value, 0.0f), 1.0f);
+      row[i] = (uint8_t)(std::pow(value, kGamma) * 255);
+    }
+    std::fwrite(row.data(), 1, row.size(), file);
+  }
+
+  return std::fclose(file) == 0;
+}
+
+bool imageutils::WritePFM(const std::string& path, const float* rgb, int width,
+                          int height, int samples) {
+  FILE* file = std::fopen(path.c_str(), "wb");
+  if (file == nullptr) {
+    return false;
+  }
+
+  /* Negative scale marks little endian data */
+  std::fprintf(file, "PF\n%d %d\n-1.0\n", width, height);
+
+  /* PFM is stored bottom row first, same as the accumulation buffer */
+  std::vector<float> row(width * 3);
+  for (int h = 0; h < height; h++) {
+    for (int i = 0; i < width * 3; i++) {
+      row[i] = rgb[(std::size_t)width * 3 * h + i] / samples;
+    }
+    std::fwrite(row.data(), sizeof(float), row.size(), file);
+  }
+
+  return std::fclose(file) == 0;
+}
+
+bool imageutils::WriteImage(const std::string& path, const float* rgb,
+                            int width, int height, int samples) {
+  std::size_t dot = path.find_last_of('.');
+  if (dot != std::string::npos && path.substr(dot) == ".pfm") {
+    return WritePFM(path, rgb, width, height, samples);
+  }
+  return WritePPM(path, rgb, width, height, samples);
+}
@@ -1,28 +1,280 @@
 #include "include/object.h"
 
+#include <algorithm>
+#include <vector>
+
+/* Storages of objects, like `SphereArray` */
+template <typename T, typename = void>
+struct has_value_type : std::false_type {};
+
+template <typename T>
+struct has_value_type<T, std::void_t<typename T::value_type>>
+    : std::true_type {};
+
+/* Intersection tests `obj.Intersect` runs. Meshes, also instanced ones,
+ * count their triangle tests themselves and storages intersected at once
+ * test every object */
+template <typename T>
+static uint32_t PrimitiveTests(const T &obj) {
+  if constexpr (std::is_same_v<T, Mesh> || std::is_same_v<T, Instance>) {
+    return 0;
+  } else if constexpr (has_value_type<T>::value) {
+    return obj.size();
+  } else {
+    return 1;
+  }
+}
+
+/* Closest hit of a search over a container and the object it is on */
+struct ClosestHit {
+  Hit hit;
+  PrimitiveRef ref;
+  bool found = false;
+};
+
+/* Returns a lambda that moves `closest` to the object `obj` at `ref` if its
+ * closest intersection is closer than the previous one. Only distances are
+ * compared, see `Attributes` */
+static auto ClosestEvaluator(const Ray &ray, ClosestHit &closest) {
+  return [&ray, &closest](const auto &obj, PrimitiveRef ref) {
+    PATHTRACER_COUNT(ray, primitive_tests, PrimitiveTests(obj));
+    if (!obj.Intersect(ray, closest.hit))
+      return;
+
+    /* Storages report the object they hit as the primitive */
+    if constexpr (has_value_type<std::decay_t<decltype(obj)>>::value) {
+      ref.index = closest.hit.primitive;
+    }
+    closest.ref = ref;
+    closest.found = true;
+  };
+}
+
+/* Storages with a bulk `Intersect(ray, hit)` finding the closest hit among
+ * their objects, like `SphereArray` */
+template <typename S, typename = void>
+struct has_bulk_intersect : std::false_type {};
+
+template <typename S>
+struct has_bulk_intersect<
+    S, std::void_t<decltype(std::declval<const S &>().Intersect(
+           std::declval<const Ray &>(), std::declval<Hit &>()))>>
+    : std::true_type {};
+
+/* Runs `evaluator` on every object of `storage`, or once on the storage itself
+ * if it can find its closest hit in a single pass */
+template <typename S, typename E>
+static void EvaluateStorage(const S &storage, E &evaluator) {
+  constexpr uint32_t type =
+      containerutils::variant_index<Objects, typename S::value_type>();
+  if constexpr (has_bulk_intersect<S>::value) {
+    evaluator(storage, PrimitiveRef{type, 0});
+  } else {
+    for (std::size_t i = 0; i < storage.size(); i++) {
+      evaluator(storage.at(i), PrimitiveRef{type, (uint32_t)i});
+    }
+  }
+}
+
+/* Storages with an indexed `IntersectAt(index, ray, hit)` */
+template <typename S, typename = void>
+struct has_indexed_intersect : std::false_type {};
+
+template <typename S>
+struct has_indexed_intersect<
+    S, std::void_t<decltype(std::declval<const S &>().IntersectAt(
+           std::size_t{}, std::declval<const Ray &>(), std::declval<Hit &>()))>>
+    : std::true_type {};
+
+/* Runs `evaluator` on the object at `ref` of a scene BVH leaf. Storages with
+ * indexed tests read the object's members in place instead of building it */
+template <typename S, typename E>
+static void EvaluateAt(const S &storage, PrimitiveRef ref, const Ray &ray,
+                       ClosestHit &closest, E &evaluator) {
+  if constexpr (has_indexed_intersect<S>::value) {
+    PATHTRACER_COUNT(ray, primitive_tests, 1);
+    if (storage.IntersectAt(ref.index, ray, closest.hit)) {
+      closest.ref = ref;
+      closest.found = true;
+    }
+  } else {
+    evaluator(storage.at(ref.index), ref);
+  }
+}
+
+/* Normal, material and texture coordinates of the closest hit, derived once
+ * the search is over */
+static std::optional<Intersector> Attributes(
+    const Ray &ray, const containerutils::VariantContainer<Objects> &objects,
+    const ClosestHit &closest) {
+  std::optional<Intersector> intersection{};
+  if (closest.found) {
+    objects.useAt([&](const auto &obj) {
+      intersection = obj.Attributes(ray, closest.hit);
+    }, closest.ref.type, closest.ref.index);
+  }
+  return intersection;
+}
+
 /* Returns the closest intersection for the ray in the vector of given objects,
  * if exists */
 std::optional<Intersector> closest_obj(
     const Ray &ray, const containerutils::VariantContainer<Objects> &objects) {
-  std::optional<Intersector> global_intersection{};
-  /* Lambda that checks and overwrites `global_intersection` if the given object
-   * has a closer intersection than the previous one */
-  auto evaluator = [&ray, &global_intersection](const auto &obj) {
-    std::optional<Intersector> intersection = obj.Intersect(ray);
-    if (!intersection.has_value())
-      return;
+  PATHTRACER_COUNT(ray, rays, 1);
+  ClosestHit closest;
+  auto evaluator = ClosestEvaluator(ray, closest);
+  objects.forEachStorage(
+      [&evaluator](const auto &storage) { EvaluateStorage(storage, evaluator); });
+  return Attributes(ray, objects, closest);
+}
 
-    if (!global_intersection.has_value()) {
-      global_intersection = intersection;
-      return;
+std::optional<Intersector> closest_obj(
+    const Ray &ray, const containerutils::VariantContainer<Objects> &objects,
+    const SceneBVH &bvh) {
+  PATHTRACER_COUNT(ray, rays, 1);
+  ClosestHit closest;
+  auto evaluator = ClosestEvaluator(ray, closest);
+
+  /* Unbounded objects first, their hits already cull parts of the tree */
+  objects.forEachStorage([&evaluator](const auto &storage) {
+    using T = typename std::decay_t<decltype(storage)>::value_type;
+    if constexpr (!is_bounded_v<T>) {
+      EvaluateStorage(storage, evaluator);
     }
+  });
+
+  bvh.tree.Traverse(ray, closest.hit.t, [&](uint32_t i, float &limit) {
+    const PrimitiveRef &ref = bvh.refs[i];
+    objects.useStorage([&](const auto &storage) {
+      EvaluateAt(storage, ref, ray, closest, evaluator);
+    }, ref.type);
+    limit = sycl::fmin(limit, closest.hit.t);
+  });
+
+  return Attributes(ray, objects, closest);
+}
 
-    /* Overwrite if a closer intersection was found */
-    if (global_intersection->t > intersection->t) {
-      global_intersection = intersection;
+/* Storages with a bulk `Occludes(ray, tmax)` over all their objects */
+template <typename S, typename = void>
+struct has_bulk_occludes : std::false_type {};
+
+template <typename S>
+struct has_bulk_occludes<
+    S, std::void_t<decltype(std::declval<const S &>().Occludes(
+           std::declval<const Ray &>(), 0.0f))>> : std::true_type {};
+
+/* Storages with an indexed `OccludesAt(index, ray, tmax)` */
+template <typename S, typename = void>
+struct has_indexed_occludes : std::false_type {};
+
+template <typename S>
+struct has_indexed_occludes<
+    S, std::void_t<decltype(std::declval<const S &>().OccludesAt(
+           std::size_t{}, std::declval<const Ray &>(), 0.0f))>>
+    : std::true_type {};
+
+/* Runs `test` on the objects of `storage` until one of them occludes */
+template <typename S, typename E>
+static bool AnyInStorage(const S &storage, E &test) {
+  if constexpr (has_bulk_occludes<S>::value) {
+    return test(storage);
+  } else {
+    for (std::size_t i = 0; i < storage.size(); i++) {
+      if (test(storage.at(i))) return true;
     }
+    return false;
+  }
+}
+
+bool occluded(const Ray &ray,
+              const containerutils::VariantContainer<Objects> &objects,
+              const SceneBVH &bvh, float tmax) {
+  PATHTRACER_COUNT(ray, rays, 1);
+  auto test = [&ray, tmax](const auto &obj) {
+    PATHTRACER_COUNT(ray, primitive_tests, PrimitiveTests(obj));
+    return obj.Occludes(ray, tmax);
   };
 
-  objects.forEach(evaluator);
-  return global_intersection;
-}
\ No newline at end of file
+  bool hit = false;
+  objects.forEachStorage([&hit, &test](const auto &storage) {
+    using T = typename std::decay_t<decltype(storage)>::value_type;
+    if constexpr (!is_bounded_v<T>) {
+      hit = hit || AnyInStorage(storage, test);
+    }
+  });
+  if (hit) {
+    return true;
+  }
+
+  return bvh.tree.TraverseAny(ray, tmax, [&](uint32_t i) {
+    const PrimitiveRef &ref = bvh.refs[i];
+    bool leaf_hit = false;
+    objects.useStorage([&](const auto &storage) {
+      using S = std::decay_t<decltype(storage)>;
+      if constexpr (has_indexed_occludes<S>::value) {
+        PATHTRACER_COUNT(ray, primitive_tests, 1);
+        leaf_hit = storage.OccludesAt(ref.index, ray, tmax);
+      } else {
+        leaf_hit = test(storage.at(ref.index));
+      }
+    }, ref.type);
+    return leaf_hit;
+  });
+}
+
+SceneBVH BuildSceneBVH(
+    sycl::queue &q, const containerutils::VariantContainer<Objects> &objects) {
+  std::vector<bvh::AABB> bounds;
+  std::vector<PrimitiveRef> refs;
+  objects.forEachIndexed([&](const auto &obj, std::size_t type,
+                             std::size_t index) {
+    if constexpr (is_bounded_v<std::decay_t<decltype(obj)>>) {
+      bounds.push_back(obj.Bounds());
+      refs.push_back(PrimitiveRef{(uint32_t)type, (uint32_t)index});
+    }
+  });
+
+  std::vector<bvh::Node> nodes;
+  std::vector<uint32_t> order;
+  bvh::Build(bounds, nodes, order);
+
+  SceneBVH bvh;
+  bvh.tree = bvh::Upload(q, nodes);
+  if (!order.empty()) {
+    /* Store the references in leaf order so leaves index them directly */
+    bvh.refs = sycl::malloc_shared<PrimitiveRef>(order.size(), q);
+    for (std::size_t i = 0; i < order.size(); i++) {
+      bvh.refs[i] = refs[order[i]];
+    }
+  }
+  return bvh;
+}
+
+sycl::event RefitSceneBVH(
+    sycl::queue &q, const containerutils::VariantContainer<Objects> &objects,
+    const SceneBVH &bvh, bvh::Refitter &refitter,
+    const std::vector<sycl::event> &depends_on) {
+  const containerutils::VariantContainer<Objects> *container = &objects;
+  const PrimitiveRef *refs = bvh.refs;
+  bvh::AABB *bounds = refitter.PrimitiveBounds();
+
+  sycl::event gathered = q.submit([&](sycl::handler &h) {
+    h.depends_on(depends_on);
+    h.parallel_for(sycl::range<1>(refitter.PrimitiveCount()),
+                   [=](sycl::id<1> i) {
+      const PrimitiveRef &ref = refs[i];
+      container->useAt([&](const auto &obj) {
+        if constexpr (is_bounded_v<std::decay_t<decltype(obj)>>) {
+          bounds[i] = obj.Bounds();
+        }
+      }, ref.type, ref.index);
+    });
+  });
+  return refitter.Refit(q, bvh.tree, {gathered});
+}
+
+void FreeSceneBVH(SceneBVH &bvh, sycl::queue &q) {
+  bvh::Free(bvh.tree, q);
+  if (bvh.refs != nullptr) sycl::free(bvh.refs, q);
+  bvh.refs = nullptr;
+}
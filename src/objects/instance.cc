@@ -0,0 +1,109 @@
+#include "include/objects/instance.h"
+
+#include <cmath>
+
+Transform Transform::Compose(const sycl::vec<float, 3>& translation,
+                             const sycl::vec<float, 3>& rotation,
+                             float scale) {
+  sycl::vec<float, 3> radians = rotation * (float)(M_PI / 180.0);
+  float cx = std::cos(radians.x()), sx = std::sin(radians.x());
+  float cy = std::cos(radians.y()), sy = std::sin(radians.y());
+  float cz = std::cos(radians.z()), sz = std::sin(radians.z());
+
+  /* Rz * Ry * Rx */
+  float m[3][3] = {
+      {cz * cy, cz * sy * sx - sz * cx, cz * sy * cx + sz * sx},
+      {sz * cy, sz * sy * sx + cz * cx, sz * sy * cx - cz * sx},
+      {-sy, cy * sx, cy * cx}};
+
+  Transform transform;
+  for (int r = 0; r < 3; r++) {
+    transform.rows[r] = sycl::vec<float, 4>{m[r][0] * scale, m[r][1] * scale,
+                                            m[r][2] * scale, translation[r]};
+  }
+  return transform;
+}
+
+Transform Transform::Inverse() const {
+  float m[3][3], t[3];
+  for (int r = 0; r < 3; r++) {
+    m[r][0] = this->rows[r].x();
+    m[r][1] = this->rows[r].y();
+    m[r][2] = this->rows[r].z();
+    t[r] = this->rows[r].w();
+  }
+
+  /* Adjugate over the determinant */
+  float inverse[3][3];
+  for (int r = 0; r < 3; r++) {
+    for (int c = 0; c < 3; c++) {
+      int r1 = (c + 1) % 3, r2 = (c + 2) % 3;
+      int c1 = (r + 1) % 3, c2 = (r + 2) % 3;
+      inverse[r][c] = m[r1][c1] * m[r2][c2] - m[r1][c2] * m[r2][c1];
+    }
+  }
+  float determinant = m[0][0] * inverse[0][0] + m[0][1] * inverse[1][0] +
+                      m[0][2] * inverse[2][0];
+
+  Transform result;
+  for (int r = 0; r < 3; r++) {
+    float row[3];
+    for (int c = 0; c < 3; c++) {
+      row[c] = inverse[r][c] / determinant;
+    }
+    /* The inverse undoes the translation after the linear part */
+    float w = -(row[0] * t[0] + row[1] * t[1] + row[2] * t[2]);
+    result.rows[r] = sycl::vec<float, 4>{row[0], row[1], row[2], w};
+  }
+  return result;
+}
+
+Instance::Instance(const Mesh& mesh, uint32_t geometry,
+                   const Transform& to_world)
+    : mesh_(mesh), to_world_(to_world), to_object_(to_world.Inverse()),
+      geometry_(geometry) {
+  /* World bounds around the transformed corners of the mesh bounds */
+  bvh::AABB local = mesh.Bounds();
+  for (int corner = 0; corner < 8; corner++) {
+    sycl::vec<float, 3> p{corner & 1 ? local.max.x() : local.min.x(),
+                          corner & 2 ? local.max.y() : local.min.y(),
+                          corner & 4 ? local.max.z() : local.min.z()};
+    this->bounds_.Grow(to_world.Point(p));
+  }
+
+  /* Mean scale of the linear part, the cube root of its determinant */
+  sycl::vec<float, 3> x = to_world.Vector({1.0f, 0.0f, 0.0f}),
+                      y = to_world.Vector({0.0f, 1.0f, 0.0f}),
+                      z = to_world.Vector({0.0f, 0.0f, 1.0f});
+  float determinant = sycl::dot(x, sycl::cross(y, z));
+  this->lod_bias_ = -std::log2(std::fabs(determinant)) / 3.0f;
+}
+
+/* Same ray in object space, keeps depth and counters of the world ray */
+static Ray ObjectRay(const Ray& ray, const Transform& to_object) {
+  Ray local = ray;
+  local.origin = to_object.Point(ray.origin);
+  local.dir = to_object.Vector(ray.dir);
+  return local;
+}
+
+bool Instance::Intersect(const Ray& ray, Hit& hit) const {
+  return this->mesh_.Intersect(ObjectRay(ray, this->to_object_), hit);
+}
+
+Intersector Instance::Attributes(const Ray& ray, const Hit& hit) const {
+  Intersector intersection =
+      this->mesh_.Attributes(ObjectRay(ray, this->to_object_), hit);
+  intersection.normal = sycl::normalize(
+      this->to_object_.TransposedVector(intersection.normal));
+  intersection.lod += this->lod_bias_;
+  return intersection;
+}
+
+bool Instance::Occludes(const Ray& ray, float tmax) const {
+  return this->mesh_.Occludes(ObjectRay(ray, this->to_object_), tmax);
+}
+
+bvh::AABB Instance::Bounds() const {
+  return this->bounds_;
+}
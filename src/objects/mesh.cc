@@ -1,109 +1,366 @@
 #include "include/objects/mesh.h"
 
-#include <sycl/sycl.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
 
-/* Ray-triangle intersection */
-std::optional<Intersector> MeshTriangle::Intersect(const Ray& ray) const {
-  std::optional<Intersector> intersection;
-  sycl::vec<float, 3> P, C, edge, vp;
-  float ndotdir, d, t;
+#include <sycl/sycl.hpp>
 
-  ndotdir = sycl::dot(this->normal_, ray.dir);
-  if (ndotdir == 0.0f) {
-    /* Empty intersection, no value */
-    return intersection;
-  }
+#include "rapidobj/rapidobj.hpp"
 
-  d = -sycl::dot(this->normal_, this->a_);
-  t = -(sycl::dot(this->normal_, ray.origin) + d) / ndotdir;
+/* Moeller-Trumbore ray-triangle intersection */
+bool MeshTriangle::Intersect(const Ray& ray, Hit& hit) const {
+  sycl::vec<float, 3> p, s, q;
+  float det, inv_det, u, v, t;
 
-  if (t < 0.0f) {
-    /* Behind triangle return empty intersection */
-    return intersection;
+  p = sycl::cross(ray.dir, this->edge2_);
+  det = sycl::dot(this->edge1_, p);
+  if (det == 0.0f) {
+    /* Ray parallel to the triangle, no hit */
+    return false;
   }
+  inv_det = 1.0f / det;
 
-  P = ray.origin + t * ray.dir;
-
-  /* First edge check if outside or inside triangle */
-  edge = this->b_ - this->a_;
-  vp = P - this->a_;
-  C = sycl::cross(edge, vp);
-  if (sycl::dot(this->normal_, C) < 0.0f) {
-    /* On right side of triangle, return empty intersection */
-    return intersection;
+  /* Barycentric coordinates of the hit on the triangle's plane */
+  s = ray.origin - this->a_;
+  u = sycl::dot(s, p) * inv_det;
+  if (u < 0.0f || u > 1.0f) {
+    return false;
   }
 
-  edge = this->c_ - this->b_;
-  vp = P - this->b_;
-  C = sycl::cross(edge, vp);
-  if (sycl::dot(this->normal_, C) < 0.0f) {
-    /* On left side of triangle, return empty intersection */
-    return intersection;
+  q = sycl::cross(s, this->edge1_);
+  v = sycl::dot(ray.dir, q) * inv_det;
+  if (v < 0.0f || u + v > 1.0f) {
+    return false;
   }
 
-  edge = this->a_ - this->c_;
-  vp = P - this->c_;
-  C = sycl::cross(edge, vp);
-  if (sycl::dot(this->normal_, C) < 0.0f) {
-    /* On right side of triangle, return empty intersection */
-    return intersection;
+  t = sycl::dot(this->edge2_, q) * inv_det;
+  if (t <= 0.0f || t >= hit.t) {
+    /* Behind the ray's origin or not closer than the current hit */
+    return false;
   }
 
-  /* If inside data, initialize the struct with the intersection and face data
-   */
-  Intersector data(t, this->normal_, this->material_id_);
-  intersection = data;
+  hit.t = t;
+  return true;
+}
 
-  return intersection;
+Intersector MeshTriangle::Attributes(const Ray& ray, const Hit& hit) const {
+  (void)ray;
+  return Intersector(hit.t, this->normal_, this->material_id_);
 }
 
-Mesh::Mesh(const rapidobj::Shape& shape,
-           const rapidobj::Attributes& attributes) {
-  for (std::size_t i = 0; i < shape.mesh.indices.size(); i += 3) {
-    int pindex1 = shape.mesh.indices[i + 0].position_index;
-    int pindex2 = shape.mesh.indices[i + 1].position_index;
-    int pindex3 = shape.mesh.indices[i + 2].position_index;
+/* Maps an MTL material onto the microfacet model */
+static Material MaterialFromMtl(const rapidobj::Material& mtl) {
+  sycl::vec<float, 3> base_color{mtl.diffuse[0], mtl.diffuse[1],
+                                 mtl.diffuse[2]};
+  /* Phong exponent to GGX roughness */
+  float roughness = std::sqrt(2.0f / (mtl.shininess + 2.0f));
+  float emitance =
+      std::max(mtl.emission[0], std::max(mtl.emission[1], mtl.emission[2]));
 
-    sycl::vec<float, 3> a, b, c, normal;
-    a = sycl::vec<float, 3>(attributes.positions[pindex1 + 0],
-                            attributes.positions[pindex1 + 1],
-                            attributes.positions[pindex1 + 2]);
+  /* Illumination models with refraction are glass, the ones with ray traced
+     reflections metal tinted by the specular color */
+  switch (mtl.illum) {
+    case 4:
+    case 6:
+    case 7:
+    case 9:
+      return Material(base_color, 0.0f, roughness, true,
+                      material::ReflectanceForIor(mtl.ior > 1.0f ? mtl.ior
+                                                                 : 1.5f),
+                      emitance);
+    case 3:
+    case 5:
+      return Material(sycl::vec<float, 3>{mtl.specular[0], mtl.specular[1],
+                                          mtl.specular[2]},
+                      1.0f, roughness, false, 0.0f, emitance);
+    default:
+      return Material(base_color, 0.0f, roughness, false, 0.0f, emitance);
+  }
+}
 
-    b = sycl::vec<float, 3>(attributes.positions[pindex2 + 0],
-                            attributes.positions[pindex2 + 1],
-                            attributes.positions[pindex2 + 2]);
+/* Shared memory copy of a host vector */
+template <typename T>
+static T* UploadBuffer(sycl::queue& q, const std::vector<T>& host) {
+  T* buffer = sycl::malloc_shared<T>(host.size(), q);
+  std::copy(host.begin(), host.end(), buffer);
+  return buffer;
+}
 
-    c = sycl::vec<float, 3>(attributes.positions[pindex3 + 0],
-                            attributes.positions[pindex3 + 1],
-                            attributes.positions[pindex3 + 2]);
+std::optional<Mesh> Mesh::Load(sycl::queue& q, const std::string& path,
+                               std::vector<Material>& materials,
+                               texture::Library& textures,
+                               const sycl::vec<float, 3>& translation) {
+  rapidobj::Result result = rapidobj::ParseFile(path);
+  if (result.error || !rapidobj::Triangulate(result)) {
+    printf("OBJ error: %s: %s\n", path.c_str(),
+           result.error.code.message().c_str());
+    return std::nullopt;
+  }
 
-    normal = sycl::cross(b - a, c - a);
-    normal = sycl::normalize(normal);
+  /* One extra material for faces without any */
+  std::size_t material_offset = materials.size();
+  std::size_t default_material = material_offset + result.materials.size();
+  if (default_material >= material::kMaxMaterials) {
+    printf("OBJ error: %s: Too many materials\n", path.c_str());
+    return std::nullopt;
+  }
+  /* Texture paths are relative to the OBJ file, missing textures are left
+     out */
+  std::string directory = path.substr(0, path.find_last_of('/') + 1);
+  auto map = [&](const std::string& name, bool color) {
+    if (name.empty()) return texture::kNone;
+    return textures.Add(name[0] == '/' ? name : directory + name, color);
+  };
+  for (const rapidobj::Material& mtl : result.materials) {
+    Material material = MaterialFromMtl(mtl);
+    material.albedo_texture = map(mtl.diffuse_texname, true);
+    material.roughness_texture = map(mtl.roughness_texname, false);
+    material.metallic_texture = map(mtl.metallic_texname, false);
+    /* A metallic map without `Pm` is the metallic parameter itself */
+    if (material.metallic_texture != texture::kNone &&
+        material.metallic == 0.0f) {
+      material.metallic = 1.0f;
+    }
+    materials.push_back(material);
+  }
+  materials.push_back(Material(sycl::vec<float, 3>{0.8f, 0.8f, 0.8f}, 0.0f,
+                               0.5f, false, 0.0f, 0.0f));
 
-    this->faces_.push_back(
-        MeshTriangle(a, b, c, normal, shape.mesh.material_ids[i / 3]));
+  /* Rotate from Y-up, -Z forward into Z-up, +X forward */
+  const rapidobj::Array<float>& positions = result.attributes.positions;
+  std::vector<sycl::vec<float, 3>> vertices(positions.size() / 3);
+  for (std::size_t i = 0; i < vertices.size(); i++) {
+    vertices[i] = sycl::vec<float, 3>(-positions[3 * i + 2],
+                                      -positions[3 * i + 0],
+                                      positions[3 * i + 1]) + translation;
   }
+
+  /* Corners without texture coordinates get (0, 0) */
+  const rapidobj::Array<float>& texcoords = result.attributes.texcoords;
+  std::vector<uint32_t> indices;
+  std::vector<material::Id> material_ids;
+  std::vector<sycl::vec<float, 2>> face_texcoords;
+  for (const rapidobj::Shape& shape : result.shapes) {
+    const rapidobj::Mesh& mesh = shape.mesh;
+    for (std::size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+      for (int k = 0; k < 3; k++) {
+        indices.push_back(mesh.indices[i + k].position_index);
+        if (!texcoords.empty()) {
+          int t = mesh.indices[i + k].texcoord_index;
+          face_texcoords.push_back(
+              t < 0 ? sycl::vec<float, 2>(0.0f, 0.0f)
+                    : sycl::vec<float, 2>(texcoords[2 * t],
+                                          texcoords[2 * t + 1]));
+        }
+      }
+
+      int material_id = mesh.material_ids[i / 3];
+      material_ids.push_back(material_id < 0 ? default_material
+                                             : material_offset + material_id);
+    }
+  }
+
+  std::optional<Mesh> mesh =
+      Create(q, vertices, indices, material_ids, face_texcoords);
+  if (!mesh.has_value()) {
+    printf("OBJ error: %s: No triangles\n", path.c_str());
+  }
+  return mesh;
 }
 
-/*  Loop through every triangular face in the mesh and find the closest
-    intersection if there is any. */
-std::optional<Intersector> Mesh::Intersect(const Ray& ray) const {
-  std::optional<Intersector> intersection;
-  for (const auto& face : this->faces_) {
-    std::optional<Intersector> new_intersection = face.Intersect(ray);
-    if (!new_intersection.has_value()) {
+std::optional<Mesh> Mesh::Create(
+    sycl::queue& q, const std::vector<sycl::vec<float, 3>>& vertices,
+    const std::vector<uint32_t>& face_indices,
+    const std::vector<material::Id>& face_material_ids,
+    const std::vector<sycl::vec<float, 2>>& face_texcoords) {
+  std::vector<uint32_t> indices;
+  std::vector<sycl::vec<float, 3>> normals;
+  std::vector<material::Id> material_ids;
+  std::vector<FaceTexcoords> texcoords;
+  std::vector<bvh::AABB> bounds;
+  for (std::size_t i = 0; i < face_material_ids.size(); i++) {
+    const uint32_t* face = &face_indices[3 * i];
+    const sycl::vec<float, 3> &a = vertices[face[0]], &b = vertices[face[1]],
+                              &c = vertices[face[2]];
+    sycl::vec<float, 3> normal = sycl::cross(b - a, c - a);
+    if (sycl::length(normal) == 0.0f) {
+      /* Degenerate faces can never be hit */
       continue;
     }
 
-    if (!intersection.has_value()) {
-      intersection = new_intersection;
-      continue;
+    indices.insert(indices.end(), face, face + 3);
+    normals.push_back(sycl::normalize(normal));
+    material_ids.push_back(face_material_ids[i]);
+    if (!face_texcoords.empty()) {
+      FaceTexcoords corners;
+      for (int k = 0; k < 3; k++) {
+        corners.uv[k] = face_texcoords[3 * i + k];
+      }
+      /* Both cross products are twice the areas */
+      sycl::vec<float, 2> du = corners.uv[1] - corners.uv[0],
+                          dv = corners.uv[2] - corners.uv[0];
+      float uv_area = std::fabs(du.x() * dv.y() - du.y() * dv.x());
+      corners.lod = 0.5f * std::log2(uv_area / sycl::length(normal));
+      texcoords.push_back(corners);
     }
 
-    if (new_intersection->t < intersection->t) {
-      intersection = new_intersection;
+    bvh::AABB box;
+    box.Grow(a);
+    box.Grow(b);
+    box.Grow(c);
+    bounds.push_back(box);
+  }
+
+  if (bounds.empty()) {
+    return std::nullopt;
+  }
+
+  std::vector<bvh::Node> nodes;
+  std::vector<uint32_t> order;
+  bvh::Build(bounds, nodes, order, kTrianglePacketWidth);
+
+  /*  Pack the faces of every leaf into as few packets as possible and let the
+      leaf address its packets instead of the faces */
+  std::vector<MeshPacket> packets;
+  std::vector<uint32_t> sorted_indices;
+  std::vector<sycl::vec<float, 3>> sorted_normals;
+  std::vector<material::Id> sorted_material_ids;
+  std::vector<FaceTexcoords> sorted_texcoords;
+  Mesh mesh;
+  for (bvh::Node& node : nodes) {
+    if (node.count == 0) continue;
+
+    uint32_t first_packet = packets.size();
+    for (uint32_t i = 0; i < node.count; i++) {
+      int lane = i % kTrianglePacketWidth;
+      if (lane == 0) {
+        packets.emplace_back();
+        /* Unused lanes point at the first vertex and are never hit */
+        sorted_indices.resize(packets.size() * kTrianglePacketWidth * 3, 0);
+        sorted_normals.resize(packets.size() * kTrianglePacketWidth,
+                              sycl::vec<float, 3>(0.0f, 0.0f, 0.0f));
+        sorted_material_ids.resize(packets.size() * kTrianglePacketWidth, 0);
+        if (!texcoords.empty()) {
+          sorted_texcoords.resize(packets.size() * kTrianglePacketWidth,
+                                  FaceTexcoords{});
+        }
+      }
+
+      uint32_t face = order[node.offset + i];
+      uint32_t slot = (packets.size() - 1) * kTrianglePacketWidth + lane;
+      for (int k = 0; k < 3; k++) {
+        sorted_indices[3 * slot + k] = indices[3 * face + k];
+      }
+      sorted_normals[slot] = normals[face];
+      sorted_material_ids[slot] = material_ids[face];
+      if (!texcoords.empty()) {
+        sorted_texcoords[slot] = texcoords[face];
+      }
+      packets.back().Set(lane, vertices[indices[3 * face + 0]],
+                         vertices[indices[3 * face + 1]],
+                         vertices[indices[3 * face + 2]]);
+      mesh.bounds_.Grow(bounds[face]);
     }
+
+    node.offset = first_packet;
+    node.count = packets.size() - first_packet;
   }
 
+  mesh.vertices_ = UploadBuffer(q, vertices);
+  mesh.indices_ = UploadBuffer(q, sorted_indices);
+  mesh.normals_ = UploadBuffer(q, sorted_normals);
+  mesh.material_ids_ = UploadBuffer(q, sorted_material_ids);
+  mesh.packets_ = UploadBuffer(q, packets);
+  if (!texcoords.empty()) {
+    mesh.texcoords_ = UploadBuffer(q, sorted_texcoords);
+  }
+  mesh.vertex_count_ = vertices.size();
+  mesh.triangle_count_ = sorted_material_ids.size();
+  mesh.bvh_ = bvh::Upload(q, nodes);
+
+  return mesh;
+}
+
+void Mesh::Free(sycl::queue& q) {
+  sycl::free(this->vertices_, q);
+  sycl::free(this->indices_, q);
+  sycl::free(this->normals_, q);
+  sycl::free(this->material_ids_, q);
+  sycl::free(this->packets_, q);
+  if (this->texcoords_ != nullptr) sycl::free(this->texcoords_, q);
+  bvh::Free(this->bvh_, q);
+
+  this->vertices_ = nullptr;
+  this->indices_ = nullptr;
+  this->normals_ = nullptr;
+  this->material_ids_ = nullptr;
+  this->packets_ = nullptr;
+  this->texcoords_ = nullptr;
+  this->vertex_count_ = 0;
+  this->triangle_count_ = 0;
+}
+
+MeshTriangle Mesh::Triangle(uint32_t index) const {
+  const uint32_t* face = &this->indices_[3 * index];
+  return MeshTriangle(this->vertices_[face[0]], this->vertices_[face[1]],
+                      this->vertices_[face[2]], this->normals_[index],
+                      this->material_ids_[index]);
+}
+
+/*  Walk the BVH of the mesh and test the face packets in the visited leaves.
+    Starting from `hit.t` culls every node behind hits found elsewhere
+    before, e.g. in other instances */
+bool Mesh::Intersect(const Ray& ray, Hit& hit) const {
+  bool found = false;
+  this->bvh_.Traverse(ray, hit.t, [&](uint32_t i, float& tmax) {
+    PATHTRACER_COUNT(ray, primitive_tests, kTrianglePacketWidth);
+    int lane = this->packets_[i].Intersect(ray, tmax);
+    if (lane < 0) {
+      return;
+    }
+
+    hit.t = tmax;
+    hit.primitive = i * kTrianglePacketWidth + lane;
+    found = true;
+  });
+  return found;
+}
+
+Intersector Mesh::Attributes(const Ray& ray, const Hit& hit) const {
+  Intersector intersection(hit.t, this->normals_[hit.primitive],
+                           this->material_ids_[hit.primitive]);
+  if (this->texcoords_ != nullptr) {
+    /* Barycentric coordinates of the hit point in the face */
+    MeshTriangle triangle = this->Triangle(hit.primitive);
+    sycl::vec<float, 3> p = ray.origin + hit.t * ray.dir - triangle.A();
+    const sycl::vec<float, 3> &e1 = triangle.Edge1(), &e2 = triangle.Edge2();
+    float d11 = sycl::dot(e1, e1), d12 = sycl::dot(e1, e2),
+          d22 = sycl::dot(e2, e2);
+    float p1 = sycl::dot(p, e1), p2 = sycl::dot(p, e2);
+    float inv_det = 1.0f / (d11 * d22 - d12 * d12);
+    float b = (d22 * p1 - d12 * p2) * inv_det;
+    float c = (d11 * p2 - d12 * p1) * inv_det;
+
+    const FaceTexcoords& corners = this->texcoords_[hit.primitive];
+    intersection.uv = corners.uv[0] * (1.0f - b - c) + corners.uv[1] * b +
+                      corners.uv[2] * c;
+    intersection.lod = corners.lod;
+  }
   return intersection;
-}
\ No newline at end of file
+}
+
+bool Mesh::Occludes(const Ray& ray, float tmax) const {
+  return this->bvh_.TraverseAny(ray, tmax, [&](uint32_t i) {
+    PATHTRACER_COUNT(ray, primitive_tests, kTrianglePacketWidth);
+    return this->packets_[i].Occludes(ray, tmax);
+  });
+}
+
+bvh::AABB Mesh::Bounds() const {
+  return this->bounds_;
+}
+
+uint32_t Mesh::TriangleCount() const {
+  return this->triangle_count_;
+}
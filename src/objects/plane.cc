@@ -1,25 +1,149 @@
 #include "include/objects/plane.h"
 
+#include <algorithm>
+
 #include <sycl/sycl.hpp>
 
-std::optional<Intersector> Plane::Intersect(const Ray& ray) const {
-  std::optional<Intersector> intersection;
+/*  Texture coordinates of `hit` on the plane through `point`, one texture
+    repeat per unit of length along the plane vectors of `normal` */
+static sycl::vec<float, 2> PlaneTexcoords(const sycl::vec<float, 3>& point,
+                                          const sycl::vec<float, 3>& normal,
+                                          const sycl::vec<float, 3>& hit) {
+  sycl::vec<float, 3> x, y;
+  vecutils::PlaneVectors(normal, x, y);
+  return sycl::vec<float, 2>{sycl::dot(hit - point, x),
+                             sycl::dot(hit - point, y)};
+}
+
+bool Plane::Intersect(const Ray& ray, Hit& hit) const {
   float determinant, t;
 
   determinant = sycl::dot(this->normal_, ray.dir);
   if (determinant == 0.0f) {
-    /* If the ray and plane are paralell, return empty intersection */
-    return intersection;
+    /* If the ray and plane are paralell, the ray misses */
+    return false;
   }
 
   t = sycl::dot(this->point_ - ray.origin, this->normal_) / determinant;
-  if (t <= 0.0f) {
-    /*  If the intersection point is on the opposite of ray direction
-        return an empty intersection. */
-    return intersection;
+  if (t <= 0.0f || t >= hit.t) {
+    /*  If the intersection point is on the opposite of ray direction or not
+        closer than the current hit, keep the current hit */
+    return false;
+  }
+
+  hit.t = t;
+  return true;
+}
+
+Intersector Plane::Attributes(const Ray& ray, const Hit& hit) const {
+  sycl::vec<float, 3> point = ray.origin + hit.t * ray.dir;
+  return Intersector(hit.t, this->normal_, this->material_id_,
+                     PlaneTexcoords(this->point_, this->normal_, point));
+}
+
+bool Plane::Occludes(const Ray& ray, float tmax) const {
+  float determinant = sycl::dot(this->normal_, ray.dir);
+  float t = sycl::dot(this->point_ - ray.origin, this->normal_) / determinant;
+  return determinant != 0.0f && t > 0.0f && t < tmax;
+}
+
+bool PlaneArray::Reserve(sycl::queue& q, std::size_t capacity) {
+  return this->px_.Reserve(q, capacity) &&
+         this->py_.Reserve(q, capacity) &&
+         this->pz_.Reserve(q, capacity) &&
+         this->nx_.Reserve(q, capacity) &&
+         this->ny_.Reserve(q, capacity) &&
+         this->nz_.Reserve(q, capacity) &&
+         this->material_id_.Reserve(q, capacity);
+}
+
+bool PlaneArray::push_back(sycl::queue& q, const Plane& plane) {
+  /* Grows all arrays together so the pushes below cannot fail */
+  if (this->px_.size() == this->px_.capacity() &&
+      !this->Reserve(q, std::max<std::size_t>(16, 2 * this->px_.capacity()))) {
+    return false;
+  }
+
+  this->px_.push_back(q, plane.point_.x());
+  this->py_.push_back(q, plane.point_.y());
+  this->pz_.push_back(q, plane.point_.z());
+  this->nx_.push_back(q, plane.normal_.x());
+  this->ny_.push_back(q, plane.normal_.y());
+  this->nz_.push_back(q, plane.normal_.z());
+  this->material_id_.push_back(q, plane.material_id_);
+  return true;
+}
+
+void PlaneArray::Set(std::size_t index, const Plane& plane) {
+  this->px_.Set(index, plane.point_.x());
+  this->py_.Set(index, plane.point_.y());
+  this->pz_.Set(index, plane.point_.z());
+  this->nx_.Set(index, plane.normal_.x());
+  this->ny_.Set(index, plane.normal_.y());
+  this->nz_.Set(index, plane.normal_.z());
+  this->material_id_.Set(index, plane.material_id_);
+}
+
+void PlaneArray::Freeze(sycl::queue& q) {
+  this->px_.Freeze(q);
+  this->py_.Freeze(q);
+  this->pz_.Freeze(q);
+  this->nx_.Freeze(q);
+  this->ny_.Freeze(q);
+  this->nz_.Freeze(q);
+  this->material_id_.Freeze(q);
+}
+
+void PlaneArray::Free(sycl::queue& q) {
+  this->px_.Free(q);
+  this->py_.Free(q);
+  this->pz_.Free(q);
+  this->nx_.Free(q);
+  this->ny_.Free(q);
+  this->nz_.Free(q);
+  this->material_id_.Free(q);
+}
+
+bool PlaneArray::Occludes(const Ray& ray, float tmax) const {
+  for (std::size_t i = 0; i < this->px_.size(); i++) {
+    if (this->at(i).Occludes(ray, tmax)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+Plane PlaneArray::at(std::size_t index) const noexcept {
+  return Plane(sycl::vec<float, 3>(this->px_[index], this->py_[index],
+                                   this->pz_[index]),
+               sycl::vec<float, 3>(this->nx_[index], this->ny_[index],
+                                   this->nz_[index]),
+               this->material_id_[index]);
+}
+
+bool PlaneArray::Intersect(const Ray& ray, Hit& hit) const {
+  const float ox = ray.origin.x(), oy = ray.origin.y(), oz = ray.origin.z();
+  const float dx = ray.dir.x(), dy = ray.dir.y(), dz = ray.dir.z();
+
+  /* Branch free so the loop vectorizes, same math as `Plane::Intersect` */
+  float closest = hit.t;
+  int closest_index = -1;
+  for (std::size_t i = 0; i < this->px_.size(); i++) {
+    float determinant =
+        this->nx_[i] * dx + this->ny_[i] * dy + this->nz_[i] * dz;
+    float t = ((this->px_[i] - ox) * this->nx_[i] +
+               (this->py_[i] - oy) * this->ny_[i] +
+               (this->pz_[i] - oz) * this->nz_[i]) / determinant;
+
+    bool found = determinant != 0.0f && t > 0.0f && t < closest;
+    closest = found ? t : closest;
+    closest_index = found ? (int)i : closest_index;
   }
 
-  Intersector data(t, this->normal_, this->material_id_);
-  intersection = data;
-  return intersection;
-}
\ No newline at end of file
+  if (closest_index < 0) {
+    return false;
+  }
+  hit.t = closest;
+  hit.primitive = closest_index;
+  return true;
+}
@@ -1,24 +1,42 @@
 #include "include/objects/sphere.h"
 
+#include <algorithm>
+#include <cmath>
+
 #include <sycl/sycl.hpp>
 
-std::optional<Intersector> Sphere::Intersect(const Ray& ray) const {
-  std::optional<Intersector> intersection{};
+/*  Latitude-longitude texture coordinates of the point with outward `normal`
+    on a sphere, v = 0 at the bottom pole */
+static sycl::vec<float, 2> SphereTexcoords(const sycl::vec<float, 3>& normal) {
+  return sycl::vec<float, 2>{
+      sycl::atan2(normal.y(), normal.x()) * (float)(0.5 * M_1_PI) + 0.5f,
+      sycl::asin(sycl::clamp(normal.z(), -1.0f, 1.0f)) * (float)M_1_PI +
+          0.5f};
+}
+
+/* `Intersector::lod` of a sphere, the texture covers its area once */
+static float SphereLod(float radius) {
+  return -0.5f * sycl::log2(4.0f * (float)M_PI) - sycl::log2(radius);
+}
 
-  sycl::vec<float, 3> v, normal;
+/*  Ray test of `Sphere::Intersect` on the sphere around `origin`, shared
+    with the indexed tests of `SphereArray` */
+static bool IntersectSphere(const sycl::vec<float, 3>& origin, float radius,
+                            const Ray& ray, Hit& hit) {
+  sycl::vec<float, 3> v;
   float a, b, c, D, t;
 
-  v = ray.origin - this->origin_;
+  v = ray.origin - origin;
 
   a = sycl::dot(ray.dir, ray.dir);
   b = sycl::dot(2.0f * v, ray.dir);
-  c = sycl::dot(v, v) - this->radius_ * this->radius_;
+  c = sycl::dot(v, v) - radius * radius;
 
   D = b * b - 4 * a * c;
 
   if (D < 0.0f) {
-    /* If determinant = 0.0f, return an empty intersection */
-    return intersection;
+    /* If determinant = 0.0f, the ray misses */
+    return false;
   }
 
   D = sycl::sqrt(D);
@@ -27,17 +45,157 @@ std::optional<Intersector> Sphere::Intersect(const Ray& ray) const {
       ray-sphere intersection point infront of the ray's origin */
   t = ((-b - D) / (2.0f * a) < 0) ? (-b + D) / (2.0f * a)
                                   : (-b - D) / (2.0f * a);
-  if (t <= 0.0f) {
-    /*  If the intersection point is still behind the ray's origin,
-        return an empty intersection */
-    return intersection;
+  if (t <= 0.0f || t >= hit.t) {
+    /*  If the intersection point is still behind the ray's origin or not
+        closer than the current hit, keep the current hit */
+    return false;
+  }
+
+  hit.t = t;
+  return true;
+}
+
+bool Sphere::Intersect(const Ray& ray, Hit& hit) const {
+  return IntersectSphere(this->origin_, this->radius_, ray, hit);
+}
+
+Intersector Sphere::Attributes(const Ray& ray, const Hit& hit) const {
+  sycl::vec<float, 3> normal =
+      sycl::normalize(ray.origin + hit.t * ray.dir - this->origin_);
+  return Intersector(hit.t, normal, this->material_id_,
+                     SphereTexcoords(normal), SphereLod(this->radius_));
+}
+
+/*  Same roots as `Intersect`, but nothing is derived from the hit and either
+    root in range will do */
+static bool OccludesSphere(const sycl::vec<float, 3>& origin, float radius,
+                           const Ray& ray, float tmax) {
+  sycl::vec<float, 3> v = ray.origin - origin;
+  float a = sycl::dot(ray.dir, ray.dir);
+  float b = sycl::dot(2.0f * v, ray.dir);
+  float c = sycl::dot(v, v) - radius * radius;
+  float D = b * b - 4 * a * c;
+  if (D < 0.0f) {
+    return false;
+  }
+
+  D = sycl::sqrt(D);
+  float near = (-b - D) / (2.0f * a), far = (-b + D) / (2.0f * a);
+  return (near > 0.0f && near < tmax) || (far > 0.0f && far < tmax);
+}
+
+bool Sphere::Occludes(const Ray& ray, float tmax) const {
+  return OccludesSphere(this->origin_, this->radius_, ray, tmax);
+}
+
+bvh::AABB Sphere::Bounds() const {
+  sycl::vec<float, 3> extent{this->radius_, this->radius_, this->radius_};
+  return bvh::AABB(this->origin_ - extent, this->origin_ + extent);
+}
+
+bool SphereArray::Reserve(sycl::queue& q, std::size_t capacity) {
+  return this->x_.Reserve(q, capacity) &&
+         this->y_.Reserve(q, capacity) &&
+         this->z_.Reserve(q, capacity) &&
+         this->radius_.Reserve(q, capacity) &&
+         this->material_id_.Reserve(q, capacity);
+}
+
+bool SphereArray::push_back(sycl::queue& q, const Sphere& sphere) {
+  /* Grows all arrays together so the pushes below cannot fail */
+  if (this->x_.size() == this->x_.capacity() &&
+      !this->Reserve(q, std::max<std::size_t>(16, 2 * this->x_.capacity()))) {
+    return false;
+  }
+
+  this->x_.push_back(q, sphere.origin_.x());
+  this->y_.push_back(q, sphere.origin_.y());
+  this->z_.push_back(q, sphere.origin_.z());
+  this->radius_.push_back(q, sphere.radius_);
+  this->material_id_.push_back(q, sphere.material_id_);
+  return true;
+}
+
+void SphereArray::Set(std::size_t index, const Sphere& sphere) {
+  this->x_.Set(index, sphere.origin_.x());
+  this->y_.Set(index, sphere.origin_.y());
+  this->z_.Set(index, sphere.origin_.z());
+  this->radius_.Set(index, sphere.radius_);
+  this->material_id_.Set(index, sphere.material_id_);
+}
+
+void SphereArray::Freeze(sycl::queue& q) {
+  this->x_.Freeze(q);
+  this->y_.Freeze(q);
+  this->z_.Freeze(q);
+  this->radius_.Freeze(q);
+  this->material_id_.Freeze(q);
+}
+
+void SphereArray::Free(sycl::queue& q) {
+  this->x_.Free(q);
+  this->y_.Free(q);
+  this->z_.Free(q);
+  this->radius_.Free(q);
+  this->material_id_.Free(q);
+}
+
+bool SphereArray::Occludes(const Ray& ray, float tmax) const {
+  for (std::size_t i = 0; i < this->x_.size(); i++) {
+    if (this->at(i).Occludes(ray, tmax)) {
+      return true;
+    }
   }
+  return false;
+}
 
-  normal = ray.origin + t * ray.dir - this->origin_;
-  normal = sycl::normalize(normal);
+bool SphereArray::IntersectAt(std::size_t index, const Ray& ray,
+                              Hit& hit) const {
+  return IntersectSphere(sycl::vec<float, 3>(this->x_[index], this->y_[index],
+                                             this->z_[index]),
+                         this->radius_[index], ray, hit);
+}
 
-  Intersector data(t, normal, this->material_id_);
-  intersection = data;
+bool SphereArray::OccludesAt(std::size_t index, const Ray& ray,
+                             float tmax) const {
+  return OccludesSphere(sycl::vec<float, 3>(this->x_[index], this->y_[index],
+                                            this->z_[index]),
+                        this->radius_[index], ray, tmax);
+}
 
-  return intersection;
-}
\ No newline at end of file
+Sphere SphereArray::at(std::size_t index) const noexcept {
+  return Sphere(sycl::vec<float, 3>(this->x_[index], this->y_[index],
+                                    this->z_[index]),
+                this->radius_[index], this->material_id_[index]);
+}
+
+bool SphereArray::Intersect(const Ray& ray, Hit& hit) const {
+  const float ox = ray.origin.x(), oy = ray.origin.y(), oz = ray.origin.z();
+  const float dx = ray.dir.x(), dy = ray.dir.y(), dz = ray.dir.z();
+  const float a = dx * dx + dy * dy + dz * dz;
+
+  /* Branch free so the loop vectorizes, same math as `Sphere::Intersect` */
+  float closest = hit.t;
+  int closest_index = -1;
+  for (std::size_t i = 0; i < this->x_.size(); i++) {
+    float vx = ox - this->x_[i], vy = oy - this->y_[i], vz = oz - this->z_[i];
+    float b = 2.0f * (vx * dx + vy * dy + vz * dz);
+    float c = vx * vx + vy * vy + vz * vz - this->radius_[i] * this->radius_[i];
+    float D = b * b - 4 * a * c;
+
+    float sqrt_D = sycl::sqrt(sycl::fmax(D, 0.0f));
+    float near = (-b - sqrt_D) / (2.0f * a);
+    float t = near < 0.0f ? (-b + sqrt_D) / (2.0f * a) : near;
+
+    bool found = D >= 0.0f && t > 0.0f && t < closest;
+    closest = found ? t : closest;
+    closest_index = found ? (int)i : closest_index;
+  }
+
+  if (closest_index < 0) {
+    return false;
+  }
+  hit.t = closest;
+  hit.primitive = closest_index;
+  return true;
+}
@@ -0,0 +1,189 @@
+#include "include/options.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "include/stats.h"
+
+static void PrintUsage(const char* program) {
+  printf("Usage: %s [options]\n"
+         "  --headless          Render to a file without opening a window\n"
+         "  --device NAME       SYCL device: default, cpu or gpu\n"
+         "  --wavefront         Use the wavefront pipeline instead of the megakernel\n"
+         "  --sort-rays         Sort wavefront rays by origin and direction per bounce\n"
+         "  --no-tiles          Launch one work item per pixel on CPU devices too\n"
+         "  --tile-size N       Tile edge length on CPU devices (default %d)\n"
+         "  --no-nee            Only reach lights through random bounces\n"
+         "  --obj PATH          Render an OBJ file instead of the built-in scene\n"
+         "  --scene PATH        Load a scene written by pathtracer_convert\n"
+         "  --width N           Image width, multiple of %d up to 65535\n"
+         "  --height N          Image height, multiple of %d up to 65535\n"
+         "  --max-depth N       Maximum bounces per path (default %d)\n"
+         "  --sampler NAME      Random numbers: sobol (default) or philox\n"
+         "  --ao DISTANCE       Render ambient occlusion within DISTANCE\n"
+         "  --samples N         Samples per pixel in headless mode\n"
+         "  --adaptive ERROR    Stop sampling pixels below this relative error\n"
+         "  --output PATH       Headless output file (.ppm or .pfm)\n"
+         "  --denoise           Filter the image guided by albedo, normal and depth\n"
+         "  --aovs              Also write OUTPUT.albedo/.normal/.depth.pfm\n"
+         "  --stats             Print cost counters, write OUTPUT.rays/.tests/\n"
+         "                      .nodes/.bounces heatmaps (PATHTRACER_STATS builds)\n"
+         "  --animate N         Move the objects, headless renders N frames to\n"
+         "                      OUTPUT.0000 and so on\n"
+         "  --rebuild-threshold X\n"
+         "                      Rebuild the BVH once refits made it X times as\n"
+         "                      expensive (default %.1f)\n"
+         "  --worker HOST:PORT  Serve sample ranges to a coordinator, on the\n"
+         "                      loopback interface if HOST is empty\n"
+         "  --workers LIST      Split the samples over comma separated workers\n"
+         "  --help              Show this message\n",
+         program, kDefaultTileSize, kAABlockWidth, kAABlockHeight,
+         kMaxRayDepth, kDefaultRebuildThreshold);
+}
+
+/* Parses a strictly positive integer, returns false on garbage */
+static bool ParsePositive(const char* str, int& value) {
+  char* end;
+  long parsed = std::strtol(str, &end, 10);
+  if (*end != '\0' || parsed <= 0 || parsed > 1 << 20) {
+    return false;
+  }
+  value = (int)parsed;
+  return true;
+}
+
+/*  Parses an image dimension, a multiple of `block` that fits the 16 bit
+    dimensions of `Camera` */
+static bool ParseDimension(const char* str, int block, int& value) {
+  return ParsePositive(str, value) && value <= UINT16_MAX &&
+         value % block == 0;
+}
+
+/* Parses a strictly positive float, returns false on garbage */
+static bool ParsePositive(const char* str, float& value) {
+  char* end;
+  float parsed = std::strtof(str, &end);
+  if (*end != '\0' || !(parsed > 0.0f) || parsed > 1e6f) {
+    return false;
+  }
+  value = parsed;
+  return true;
+}
+
+bool ParseOptions(int argc, char** argv, Options& options) {
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    /* Value of an option taking an argument, `nullptr` if missing */
+    const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+    bool ok = true;
+
+    if (std::strcmp(arg, "--headless") == 0) {
+      options.headless = true;
+      continue;
+    }
+    if (std::strcmp(arg, "--wavefront") == 0) {
+      options.wavefront = true;
+      continue;
+    }
+    if (std::strcmp(arg, "--sort-rays") == 0) {
+      options.sort_rays = true;
+      continue;
+    }
+    if (std::strcmp(arg, "--no-tiles") == 0) {
+      options.tiles = false;
+      continue;
+    }
+    if (std::strcmp(arg, "--no-nee") == 0) {
+      options.nee = false;
+      continue;
+    }
+    if (std::strcmp(arg, "--denoise") == 0) {
+      options.denoise = true;
+      continue;
+    }
+    if (std::strcmp(arg, "--aovs") == 0) {
+      options.aovs = true;
+      continue;
+    }
+    if (std::strcmp(arg, "--stats") == 0) {
+      if (!stats::kEnabled) {
+        printf("--stats needs a build with PATHTRACER_STATS\n");
+        return false;
+      }
+      options.stats = true;
+      continue;
+    }
+    if (std::strcmp(arg, "--help") == 0) {
+      PrintUsage(argv[0]);
+      return false;
+    }
+
+    if (value == nullptr) {
+      ok = false;
+    } else if (std::strcmp(arg, "--device") == 0) {
+      options.device = value;
+      ok = options.device == "default" || options.device == "cpu" ||
+           options.device == "gpu";
+    } else if (std::strcmp(arg, "--obj") == 0) {
+      options.obj = value;
+    } else if (std::strcmp(arg, "--scene") == 0) {
+      options.scene = value;
+    } else if (std::strcmp(arg, "--tile-size") == 0) {
+      ok = ParsePositive(value, options.tile_size);
+    } else if (std::strcmp(arg, "--width") == 0) {
+      ok = ParseDimension(value, kAABlockWidth, options.width);
+    } else if (std::strcmp(arg, "--height") == 0) {
+      ok = ParseDimension(value, kAABlockHeight, options.height);
+    } else if (std::strcmp(arg, "--max-depth") == 0) {
+      ok = ParsePositive(value, options.max_depth);
+    } else if (std::strcmp(arg, "--sampler") == 0) {
+      if (std::strcmp(value, "sobol") == 0) {
+        options.sampler = miscutils::SamplerType::kSobol;
+      } else if (std::strcmp(value, "philox") == 0) {
+        options.sampler = miscutils::SamplerType::kPhilox;
+      } else {
+        ok = false;
+      }
+    } else if (std::strcmp(arg, "--ao") == 0) {
+      ok = ParsePositive(value, options.ambient_occlusion);
+    } else if (std::strcmp(arg, "--samples") == 0) {
+      ok = ParsePositive(value, options.samples);
+    } else if (std::strcmp(arg, "--adaptive") == 0) {
+      ok = ParsePositive(value, options.adaptive_error);
+    } else if (std::strcmp(arg, "--animate") == 0) {
+      ok = ParsePositive(value, options.animate);
+    } else if (std::strcmp(arg, "--rebuild-threshold") == 0) {
+      ok = ParsePositive(value, options.rebuild_threshold) &&
+           options.rebuild_threshold >= 1.0f;
+    } else if (std::strcmp(arg, "--output") == 0) {
+      options.output = value;
+    } else if (std::strcmp(arg, "--worker") == 0) {
+      options.worker = value;
+    } else if (std::strcmp(arg, "--workers") == 0) {
+      options.workers.clear();
+      std::string list = value;
+      std::size_t begin = 0;
+      while (begin <= list.size()) {
+        std::size_t end = std::min(list.find(',', begin), list.size());
+        options.workers.push_back(list.substr(begin, end - begin));
+        ok = ok && !options.workers.back().empty();
+        begin = end + 1;
+      }
+    } else {
+      ok = false;
+    }
+
+    if (!ok) {
+      printf("Invalid argument: %s%s%s\n", arg, value ? " " : "",
+             value ? value : "");
+      PrintUsage(argv[0]);
+      return false;
+    }
+    i++;
+  }
+
+  return true;
+}
@@ -0,0 +1,42 @@
+#include "include/render.h"
+
+#include "include/integrator.h"
+#include "include/ray.h"
+
+namespace render {
+/* Megakernel drawing its random numbers from `Sampler` */
+template <class Sampler>
+static sycl::event SubmitSamples(sycl::queue& q, const Scene& scene,
+                                 const Frame& frame,
+                                 const std::vector<sycl::event>& depends_on) {
+  /* Snapshot, the viewer moves the shared camera while batches run */
+  const Camera camera = *scene.camera;
+
+  /* Path tracer program */
+  auto pathtracer = [=](sycl::nd_item<2> it) {
+    RenderPixel<Sampler>(scene, camera, frame, it.get_global_id(0),
+                         it.get_global_id(1));
+  };
+
+  /* NOTE here how `sycl::nd_range` is used instead of `sycl::range`. This part is
+   * is important since it specifies the work group size. If the work group is not
+   * specified explicitely, this may result in bugs where the workers process data
+   * outside of the given range!!!!!!!
+   */
+  return q.submit([&](sycl::handler& h) {
+    h.depends_on(depends_on);
+    sycl::range<2> global_range{(size_t)frame.width, (size_t)frame.height};
+    sycl::range<2> local_range{kAABlockWidth, kAABlockHeight};
+    h.parallel_for(sycl::nd_range{global_range,local_range}, pathtracer);
+  });
+}
+}  // namespace render
+
+sycl::event render::RenderSamples(sycl::queue& q, const Scene& scene,
+                                  const Frame& frame,
+                                  const std::vector<sycl::event>& depends_on) {
+  if (scene.sampler == miscutils::SamplerType::kPhilox) {
+    return SubmitSamples<miscutils::PhiloxSampler>(q, scene, frame, depends_on);
+  }
+  return SubmitSamples<miscutils::SobolSampler>(q, scene, frame, depends_on);
+}
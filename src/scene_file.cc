@@ -0,0 +1,442 @@
+#include "include/scene_file.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <type_traits>
+#include <variant>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+const char kMagic[8] = "PTSCENE";
+/* Alignment of every array in the file */
+const uint64_t kAlignment = 16;
+
+/* Stored form of an `Instance`, whose mesh handle cannot be stored */
+struct InstanceRecord {
+  uint32_t geometry;
+  Transform to_world;
+};
+
+/* Sequential writer of the file layout, remembers the first failure */
+class Writer {
+ private:
+  std::FILE* file_;
+  uint64_t offset_ = 0;
+  bool ok_ = true;
+
+  void Bytes(const void* data, uint64_t size) {
+    if (this->ok_ && size > 0 &&
+        std::fwrite(data, 1, size, this->file_) != size) {
+      this->ok_ = false;
+    }
+    this->offset_ += size;
+  }
+
+ public:
+  explicit Writer(std::FILE* file) : file_(file) {}
+
+  void Header() {
+    uint32_t version[2] = {kSceneFileVersion, 0};
+    this->Bytes(kMagic, sizeof(kMagic));
+    this->Bytes(version, sizeof(version));
+  }
+
+  template <typename T>
+  void Array(const T* data, uint64_t count) {
+    static_assert(std::is_trivially_copyable_v<T>,
+                  "Scene files store raw bytes");
+    static const uint8_t kZeros[kAlignment] = {};
+    uint64_t header[2] = {count, sizeof(T)};
+    this->Bytes(header, sizeof(header));
+    this->Bytes(data, count * sizeof(T));
+    this->Bytes(kZeros, (kAlignment - this->offset_ % kAlignment) % kAlignment);
+  }
+
+  template <typename T>
+  void Value(const T& value) {
+    this->Array(&value, 1);
+  }
+
+  bool Ok() const { return this->ok_; }
+};
+
+/*  Sequential reader over the mapped file. Arrays are returned as pointers
+    into the mapping, `nullptr` if the file is truncated or the element size
+    does not match */
+class Reader {
+ private:
+  const uint8_t* data_;
+  uint64_t size_;
+  uint64_t offset_ = 0;
+
+ public:
+  Reader(const uint8_t* data, uint64_t size) : data_(data), size_(size) {}
+
+  bool Header() {
+    uint32_t version[2];
+    if (this->size_ < sizeof(kMagic) + sizeof(version) ||
+        std::memcmp(this->data_, kMagic, sizeof(kMagic)) != 0) {
+      return false;
+    }
+    std::memcpy(version, this->data_ + sizeof(kMagic), sizeof(version));
+    this->offset_ = sizeof(kMagic) + sizeof(version);
+    return version[0] == kSceneFileVersion;
+  }
+
+  template <typename T>
+  const T* Array(uint64_t& count) {
+    uint64_t header[2];
+    if (this->size_ - this->offset_ < sizeof(header)) return nullptr;
+    std::memcpy(header, this->data_ + this->offset_, sizeof(header));
+    this->offset_ += sizeof(header);
+
+    count = header[0];
+    if (header[1] != sizeof(T) ||
+        count > (this->size_ - this->offset_) / sizeof(T)) {
+      return nullptr;
+    }
+    const T* array = reinterpret_cast<const T*>(this->data_ + this->offset_);
+    uint64_t end = this->offset_ + count * sizeof(T);
+    this->offset_ = std::min(this->size_, (end + kAlignment - 1) /
+                                              kAlignment * kAlignment);
+    return array;
+  }
+
+  template <typename T>
+  bool Value(T& value) {
+    uint64_t count;
+    const T* array = this->Array<T>(count);
+    if (array == nullptr || count != 1) return false;
+    std::memcpy(&value, array, sizeof(T));
+    return true;
+  }
+
+  /* Array of exactly `count` elements */
+  template <typename T>
+  const T* Array(uint64_t expected, bool& ok) {
+    uint64_t count;
+    const T* array = this->Array<T>(count);
+    ok = ok && array != nullptr && count == expected;
+    return array;
+  }
+};
+
+/* Shared memory copy of a mapped array, `nullptr` for empty arrays */
+template <typename T>
+T* Upload(sycl::queue& q, const T* data, uint64_t count,
+          std::vector<sycl::event>& copies) {
+  if (count == 0) return nullptr;
+  T* buffer = sycl::malloc_shared<T>(count, q);
+  copies.push_back(q.memcpy(buffer, data, count * sizeof(T)));
+  return buffer;
+}
+
+/*  Whether `nodes` form a tree `bvh::BVH::Traverse` can walk: children come
+    after their parent, leaves stay within `primitive_count` primitives and
+    no node is deeper than the traversal stack */
+bool ValidTree(const bvh::Node* nodes, uint64_t node_count,
+               uint64_t primitive_count) {
+  std::vector<uint32_t> depth(node_count, 0);
+  for (uint64_t i = 0; i < node_count; i++) {
+    const bvh::Node& node = nodes[i];
+    if (depth[i] >= (uint32_t)kBVHMaxDepth) return false;
+    if (node.count > 0) {
+      if ((uint64_t)node.offset + node.count > primitive_count) return false;
+      continue;
+    }
+    if (node.offset <= i + 1 || node.offset >= node_count) return false;
+    depth[i + 1] = std::max(depth[i + 1], depth[i] + 1);
+    depth[node.offset] = std::max(depth[node.offset], depth[i] + 1);
+  }
+  return true;
+}
+}  // namespace
+
+bool SceneFile::Write(const std::string& path, const Camera& camera,
+                      const std::vector<Material>& materials,
+                      const texture::HostAtlas& textures,
+                      const std::vector<Mesh>& geometries,
+                      const containerutils::VariantContainer<Objects>& objects,
+                      const SceneBVH& bvh) {
+  std::FILE* file = std::fopen(path.c_str(), "wb");
+  if (file == nullptr) {
+    printf("Scene error: %s: Cannot open for writing\n", path.c_str());
+    return false;
+  }
+
+  std::vector<Sphere> spheres;
+  std::vector<Plane> planes;
+  std::vector<Mesh> meshes;
+  std::vector<InstanceRecord> instances;
+  objects.forEach([&](const auto& obj) {
+    using T = std::decay_t<decltype(obj)>;
+    if constexpr (std::is_same_v<T, Sphere>) {
+      spheres.push_back(obj);
+    } else if constexpr (std::is_same_v<T, Plane>) {
+      planes.push_back(obj);
+    } else if constexpr (std::is_same_v<T, Mesh>) {
+      meshes.push_back(obj);
+    } else if constexpr (std::is_same_v<T, Instance>) {
+      instances.push_back({obj.GeometryIndex(), obj.ToWorld()});
+    }
+  });
+
+  Writer writer(file);
+  writer.Header();
+  writer.Value(camera);
+  writer.Array(materials.data(), materials.size());
+  writer.Array(textures.texels.data(), textures.texels.size());
+  writer.Array(textures.levels.data(), textures.levels.size());
+  writer.Array(textures.textures.data(), textures.textures.size());
+  writer.Array(spheres.data(), spheres.size());
+  writer.Array(planes.data(), planes.size());
+
+  auto write_meshes = [&writer](const std::vector<Mesh>& list) {
+    writer.Value((uint64_t)list.size());
+    for (const Mesh& mesh : list) {
+      uint32_t counts[3] = {mesh.vertex_count_, mesh.triangle_count_,
+                            mesh.bvh_.node_count};
+      writer.Value(mesh.bounds_);
+      writer.Value(counts);
+      writer.Array(mesh.vertices_, mesh.vertex_count_);
+      writer.Array(mesh.indices_, 3 * (uint64_t)mesh.triangle_count_);
+      writer.Array(mesh.normals_, mesh.triangle_count_);
+      writer.Array(mesh.material_ids_, mesh.triangle_count_);
+      writer.Array(mesh.packets_, mesh.triangle_count_ / kTrianglePacketWidth);
+      writer.Array(mesh.texcoords_,
+                   mesh.texcoords_ != nullptr ? mesh.triangle_count_ : 0);
+      writer.Array(mesh.bvh_.nodes, mesh.bvh_.node_count);
+    }
+  };
+  write_meshes(meshes);
+  write_meshes(geometries);
+  writer.Array(instances.data(), instances.size());
+
+  /* Every bounded object is a leaf, so the leaf count follows */
+  uint64_t leaves = 0;
+  for (uint32_t i = 0; i < bvh.tree.node_count; i++) {
+    leaves += bvh.tree.nodes[i].count;
+  }
+  writer.Array(bvh.tree.nodes, bvh.tree.node_count);
+  writer.Array(bvh.refs, leaves);
+
+  bool ok = writer.Ok();
+  if (std::fclose(file) != 0) ok = false;
+  if (!ok) {
+    printf("Scene error: %s: Write failed\n", path.c_str());
+  }
+  return ok;
+}
+
+bool SceneFile::Read(sycl::queue& q, const std::string& path, Camera& camera,
+                     std::vector<Material>& materials,
+                     texture::HostAtlas& textures,
+                     std::vector<Mesh>& geometries,
+                     containerutils::VariantContainer<Objects>& objects,
+                     SceneBVH& bvh) {
+  int fd = open(path.c_str(), O_RDONLY);
+  struct stat info;
+  if (fd < 0 || fstat(fd, &info) != 0) {
+    printf("Scene error: %s: Cannot open\n", path.c_str());
+    if (fd >= 0) close(fd);
+    return false;
+  }
+  void* mapping = info.st_size > 0
+                      ? mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE,
+                             fd, 0)
+                      : MAP_FAILED;
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    printf("Scene error: %s: Cannot map\n", path.c_str());
+    return false;
+  }
+  /* Every byte is read exactly once, front to back */
+  madvise(mapping, info.st_size, MADV_SEQUENTIAL);
+
+  Reader reader(static_cast<const uint8_t*>(mapping), info.st_size);
+  bool ok = reader.Header();
+  if (!ok) {
+    printf("Scene error: %s: Not a scene file of version %u\n", path.c_str(),
+           kSceneFileVersion);
+    munmap(mapping, info.st_size);
+    return false;
+  }
+
+  uint64_t material_count = 0, sphere_count = 0, plane_count = 0;
+  uint64_t texel_count = 0, level_count = 0, texture_count = 0;
+  const Material* material_data = nullptr;
+  const texture::Texel* texel_data = nullptr;
+  const texture::Level* level_data = nullptr;
+  const texture::Texture* texture_data = nullptr;
+  const Sphere* sphere_data = nullptr;
+  const Plane* plane_data = nullptr;
+  ok = reader.Value(camera) &&
+       (material_data = reader.Array<Material>(material_count)) != nullptr &&
+       (texel_data = reader.Array<texture::Texel>(texel_count)) != nullptr &&
+       (level_data = reader.Array<texture::Level>(level_count)) != nullptr &&
+       (texture_data = reader.Array<texture::Texture>(texture_count)) !=
+           nullptr &&
+       (sphere_data = reader.Array<Sphere>(sphere_count)) != nullptr &&
+       (plane_data = reader.Array<Plane>(plane_count)) != nullptr;
+
+  /* Materials, textures and objects are checked against what they reference */
+  for (uint64_t i = 0; ok && i < material_count; i++) {
+    for (texture::Id id : {material_data[i].albedo_texture,
+                           material_data[i].roughness_texture,
+                           material_data[i].metallic_texture}) {
+      ok = ok && (id == texture::kNone || id < texture_count);
+    }
+  }
+  for (uint64_t i = 0; ok && i < texture_count; i++) {
+    ok = texture_data[i].level_count > 0 &&
+         (uint64_t)texture_data[i].first_level + texture_data[i].level_count <=
+             level_count;
+  }
+  for (uint64_t i = 0; ok && i < level_count; i++) {
+    const texture::Level& level = level_data[i];
+    uint64_t tiles_y = (level.height + texture::kTileSize - 1) /
+                       texture::kTileSize;
+    ok = level.width > 0 && level.height > 0 &&
+         (uint64_t)level.tiles_x * texture::kTileSize >= level.width &&
+         level.offset + (uint64_t)level.tiles_x * tiles_y *
+                            texture::kTileSize * texture::kTileSize <=
+         texel_count;
+  }
+  for (uint64_t i = 0; ok && i < sphere_count; i++) {
+    ok = sphere_data[i].MaterialId() < material_count;
+  }
+  for (uint64_t i = 0; ok && i < plane_count; i++) {
+    ok = plane_data[i].MaterialId() < material_count;
+  }
+
+  /*  The bulk of the file, straight from the mapping into shared memory.
+      Meshes only enter the container once the whole file checked out */
+  std::vector<sycl::event> copies;
+  std::vector<Mesh> meshes;
+  for (std::vector<Mesh>* list : {&meshes, &geometries}) {
+    uint64_t mesh_count = 0;
+    ok = ok && reader.Value(mesh_count);
+    for (uint64_t m = 0; ok && m < mesh_count; m++) {
+      Mesh mesh;
+      uint32_t counts[3];
+      ok = reader.Value(mesh.bounds_) && reader.Value(counts) &&
+           counts[1] % kTrianglePacketWidth == 0;
+      if (!ok) break;
+      mesh.vertex_count_ = counts[0];
+      mesh.triangle_count_ = counts[1];
+
+      const auto* vertices =
+          reader.Array<sycl::vec<float, 3>>(counts[0], ok);
+      const auto* indices =
+          reader.Array<uint32_t>(3 * (uint64_t)counts[1], ok);
+      const auto* normals = reader.Array<sycl::vec<float, 3>>(counts[1], ok);
+      const auto* material_ids = reader.Array<material::Id>(counts[1], ok);
+      const auto* packets =
+          reader.Array<MeshPacket>(counts[1] / kTrianglePacketWidth, ok);
+      uint64_t texcoord_count = 0;
+      const auto* texcoords = reader.Array<FaceTexcoords>(texcoord_count);
+      ok = ok && texcoords != nullptr &&
+           (texcoord_count == 0 || texcoord_count == counts[1]);
+      const auto* nodes = reader.Array<bvh::Node>(counts[2], ok);
+      ok = ok && ValidTree(nodes, counts[2], counts[1] / kTrianglePacketWidth);
+      /* Faces are checked against the vertices and materials they use */
+      for (uint64_t i = 0; ok && i < 3 * (uint64_t)counts[1]; i++) {
+        ok = indices[i] < counts[0];
+      }
+      for (uint64_t i = 0; ok && i < counts[1]; i++) {
+        ok = material_ids[i] < material_count;
+      }
+      if (!ok) break;
+
+      mesh.vertices_ = Upload(q, vertices, counts[0], copies);
+      mesh.indices_ = Upload(q, indices, 3 * (uint64_t)counts[1], copies);
+      mesh.normals_ = Upload(q, normals, counts[1], copies);
+      mesh.material_ids_ = Upload(q, material_ids, counts[1], copies);
+      mesh.packets_ =
+          Upload(q, packets, counts[1] / kTrianglePacketWidth, copies);
+      mesh.texcoords_ = Upload(q, texcoords, texcoord_count, copies);
+      mesh.bvh_.nodes = Upload(q, nodes, counts[2], copies);
+      mesh.bvh_.node_count = counts[2];
+      list->push_back(mesh);
+    }
+  }
+
+  /* Instances are checked against the geometries they reference */
+  uint64_t instance_count = 0;
+  const InstanceRecord* instances = nullptr;
+  ok = ok &&
+       (instances = reader.Array<InstanceRecord>(instance_count)) != nullptr;
+  for (uint64_t i = 0; ok && i < instance_count; i++) {
+    ok = instances[i].geometry < geometries.size();
+  }
+
+  uint64_t node_count = 0, ref_count = 0;
+  const bvh::Node* nodes = nullptr;
+  const PrimitiveRef* refs = nullptr;
+  ok = ok && (nodes = reader.Array<bvh::Node>(node_count)) != nullptr &&
+       (refs = reader.Array<PrimitiveRef>(ref_count)) != nullptr &&
+       ValidTree(nodes, node_count, ref_count);
+
+  /* References are checked against the objects of their type */
+  uint64_t type_counts[std::variant_size_v<Objects>] = {};
+  type_counts[containerutils::variant_index<Objects, Sphere>()] = sphere_count;
+  type_counts[containerutils::variant_index<Objects, Plane>()] = plane_count;
+  type_counts[containerutils::variant_index<Objects, Mesh>()] = meshes.size();
+  type_counts[containerutils::variant_index<Objects, Instance>()] =
+      instance_count;
+  for (uint64_t i = 0; ok && i < ref_count; i++) {
+    ok = refs[i].type < std::variant_size_v<Objects> &&
+         refs[i].index < type_counts[refs[i].type];
+  }
+  if (ok) {
+    bvh.tree.nodes = Upload(q, nodes, node_count, copies);
+    bvh.tree.node_count = node_count;
+    bvh.refs = Upload(q, refs, ref_count, copies);
+  }
+
+  /* The mapping has to outlive the copies */
+  sycl::event::wait(copies);
+
+  if (!ok) {
+    printf("Scene error: %s: Truncated or written by an incompatible build\n",
+           path.c_str());
+    for (std::vector<Mesh>* list : {&meshes, &geometries}) {
+      for (Mesh& mesh : *list) {
+        mesh.Free(q);
+      }
+    }
+    geometries.clear();
+    FreeSceneBVH(bvh, q);
+    munmap(mapping, info.st_size);
+    return false;
+  }
+
+  materials.assign(material_data, material_data + material_count);
+  textures.texels.assign(texel_data, texel_data + texel_count);
+  textures.levels.assign(level_data, level_data + level_count);
+  textures.textures.assign(texture_data, texture_data + texture_count);
+  objects.Reserve<Sphere>(q, sphere_count);
+  for (uint64_t i = 0; i < sphere_count; i++) {
+    objects.push_back(q, sphere_data[i]);
+  }
+  objects.Reserve<Plane>(q, plane_count);
+  for (uint64_t i = 0; i < plane_count; i++) {
+    objects.push_back(q, plane_data[i]);
+  }
+  for (const Mesh& mesh : meshes) {
+    objects.push_back(q, mesh);
+  }
+  objects.Reserve<Instance>(q, instance_count);
+  for (uint64_t i = 0; i < instance_count; i++) {
+    objects.push_back(q, Instance(geometries[instances[i].geometry],
+                                  instances[i].geometry,
+                                  instances[i].to_world));
+  }
+  munmap(mapping, info.st_size);
+  return true;
+}
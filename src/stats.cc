@@ -0,0 +1,122 @@
+#include "include/stats.h"
+
+#include "include/integrator.h"
+#include "include/render.h"
+
+/*  Linear color of a heatmap value in [0, 1]. The ramp runs over blue, cyan,
+    yellow and red to white in display values, which are linearized so that
+    `render::ToDisplay` reproduces them */
+static sycl::vec<float, 3> HeatColor(float t) {
+  const sycl::vec<float, 3> kRamp[5] = {{0.0f, 0.0f, 1.0f},
+                                        {0.0f, 1.0f, 1.0f},
+                                        {1.0f, 1.0f, 0.0f},
+                                        {1.0f, 0.0f, 0.0f},
+                                        {1.0f, 1.0f, 1.0f}};
+  float x = sycl::fmin(sycl::fmax(t, 0.0f), 1.0f) * 4.0f;
+  int i = sycl::min((int)x, 3);
+  sycl::vec<float, 3> display = kRamp[i] + (kRamp[i + 1] - kRamp[i]) * (x - i);
+  return sycl::pow(display, sycl::vec<float, 3>{2.2f, 2.2f, 2.2f});
+}
+
+const char* stats::CounterName(Counter counter) {
+  switch (counter) {
+    case Counter::kRays:
+      return "rays";
+    case Counter::kPrimitiveTests:
+      return "tests";
+    case Counter::kNodesVisited:
+      return "nodes";
+    default:
+      return "bounces";
+  }
+}
+
+stats::Heatmap::Heatmap(sycl::queue& q, int width, int height)
+    : width_(width), height_(height) {
+  this->counters_ =
+      sycl::malloc_device<Counters>((std::size_t)width * height, q);
+  this->maximum_ = sycl::malloc_shared<uint32_t>(1, q);
+}
+
+void stats::Heatmap::Free(sycl::queue& q) {
+  sycl::free(this->counters_, q);
+  sycl::free(this->maximum_, q);
+}
+
+void stats::Heatmap::Attach(render::Frame& frame) const {
+  frame.counters = this->counters_;
+}
+
+sycl::event stats::Heatmap::Draw(sycl::queue& q, const render::Frame& frame,
+                                 Counter counter, int samples, float* output,
+                                 const std::vector<sycl::event>& depends_on) {
+  const Counters* counters = this->counters_;
+  uint32_t* maximum = this->maximum_;
+  const int width = this->width_;
+
+  sycl::range<2> global_range{(size_t)this->width_, (size_t)this->height_};
+  sycl::range<2> local_range{kAABlockWidth, kAABlockHeight};
+  sycl::nd_range<2> pixels{global_range, local_range};
+
+  /* Mean of the counter per sample of pixel `index` */
+  auto mean = [=](uint32_t index) {
+    float count = frame.sample_counts != nullptr
+                      ? sycl::fmax((float)frame.sample_counts[index], 1.0f)
+                      : (float)samples;
+    return (float)Get(counters[index], counter) / count;
+  };
+
+  sycl::event reset = q.submit([&](sycl::handler& h) {
+    h.depends_on(depends_on);
+    h.single_task([=]() { *maximum = 0; });
+  });
+
+  /* Non negative floats order like their bits, so the maximum is taken on
+     those */
+  sycl::event reduced = q.submit([&](sycl::handler& h) {
+    h.depends_on(reset);
+    h.parallel_for(pixels, [=](sycl::nd_item<2> it) {
+      uint32_t index = width * it.get_global_id(1) + it.get_global_id(0);
+      sycl::atomic_ref<uint32_t, sycl::memory_order::relaxed,
+                       sycl::memory_scope::device,
+                       sycl::access::address_space::global_space>
+          largest(*maximum);
+      largest.fetch_max(sycl::bit_cast<uint32_t>(mean(index)));
+    });
+  });
+
+  return q.submit([&](sycl::handler& h) {
+    h.depends_on(reduced);
+    h.parallel_for(pixels, [=](sycl::nd_item<2> it) {
+      uint32_t index = width * it.get_global_id(1) + it.get_global_id(0);
+      float largest = sycl::bit_cast<float>(*maximum);
+      sycl::vec<float, 3> color =
+          HeatColor(largest > 0.0f ? mean(index) / largest : 0.0f);
+
+      for (int c = 0; c < 3; c++) {
+        if (output != nullptr) {
+          output[index*3+c] = color[c];
+        }
+        if (frame.framebuffer != nullptr) {
+          sycl::device_ptr<uint8_t> framebuffer = frame.framebuffer;
+          framebuffer[index*3+c] = render::ToDisplay(color[c], 1.0f);
+        }
+      }
+    });
+  });
+}
+
+std::array<uint64_t, stats::kCounterCount> stats::Heatmap::Totals(
+    sycl::queue& q) const {
+  std::vector<Counters> counters((std::size_t)this->width_ * this->height_);
+  q.memcpy(counters.data(), this->counters_,
+           counters.size() * sizeof(Counters)).wait();
+
+  std::array<uint64_t, kCounterCount> totals{};
+  for (const Counters& pixel : counters) {
+    for (int i = 0; i < kCounterCount; i++) {
+      totals[i] += Get(pixel, (Counter)i);
+    }
+  }
+  return totals;
+}
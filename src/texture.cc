@@ -0,0 +1,191 @@
+#include "include/texture.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+
+namespace {
+/* Gamma the tracer writes PPM files with, see `imageutils::WritePPM` */
+const float kGamma = 2.2f;
+
+/*  Reads a binary PPM or a PFM file into linear values, bottom row first.
+    8-bit PPM values are gamma decoded for color textures only. Returns false
+    on unsupported or truncated files */
+bool ReadImage(const std::string& path, bool color, int& width, int& height,
+               std::vector<float>& rgb) {
+  std::FILE* file = std::fopen(path.c_str(), "rb");
+  if (file == nullptr) return false;
+
+  char magic[3] = {};
+  float scale = 0.0f;
+  int maximum = 0;
+  bool ok = std::fscanf(file, "%2s %d %d", magic, &width, &height) == 3 &&
+            width > 0 && height > 0;
+  bool pfm = ok && std::strcmp(magic, "PF") == 0;
+  if (pfm) {
+    ok = std::fscanf(file, "%f", &scale) == 1 && scale < 0.0f;
+  } else {
+    ok = ok && std::strcmp(magic, "P6") == 0 &&
+         std::fscanf(file, "%d", &maximum) == 1 && maximum > 0 &&
+         maximum < 256;
+  }
+  /* A single whitespace character separates the header from the data */
+  ok = ok && std::fgetc(file) != EOF;
+
+  std::size_t count = (std::size_t)width * height * 3;
+  rgb.resize(ok ? count : 0);
+  if (ok && pfm) {
+    /* Little endian and bottom row first already */
+    ok = std::fread(rgb.data(), sizeof(float), count, file) == count;
+  } else if (ok) {
+    std::vector<uint8_t> bytes(count);
+    ok = std::fread(bytes.data(), 1, count, file) == count;
+    /* PPM files are stored top row first */
+    for (int y = 0; ok && y < height; y++) {
+      const uint8_t* row = &bytes[(std::size_t)(height - 1 - y) * width * 3];
+      for (int i = 0; i < width * 3; i++) {
+        float value = (float)row[i] / maximum;
+        rgb[(std::size_t)y * width * 3 + i] =
+            color ? std::pow(value, kGamma) : value;
+      }
+    }
+  }
+  std::fclose(file);
+  return ok;
+}
+
+/* Next smaller mip level of a `width` x `height` image, a 2x2 box filter */
+std::vector<float> Downsample(const std::vector<float>& rgb, int width,
+                              int height) {
+  int w = std::max(width / 2, 1), h = std::max(height / 2, 1);
+  std::vector<float> result((std::size_t)w * h * 3);
+  for (int y = 0; y < h; y++) {
+    for (int x = 0; x < w; x++) {
+      /* Odd sizes drop the last row or column, 1 texel sizes repeat it */
+      int x0 = std::min(2 * x, width - 1), x1 = std::min(2 * x + 1, width - 1);
+      int y0 = std::min(2 * y, height - 1);
+      int y1 = std::min(2 * y + 1, height - 1);
+      for (int c = 0; c < 3; c++) {
+        auto at = [&](int px, int py) {
+          return rgb[((std::size_t)py * width + px) * 3 + c];
+        };
+        result[((std::size_t)y * w + x) * 3 + c] =
+            0.25f * (at(x0, y0) + at(x1, y0) + at(x0, y1) + at(x1, y1));
+      }
+    }
+  }
+  return result;
+}
+
+/* 8-bit value of a linear channel, see `texture::Texel` */
+uint8_t Quantize(float value, bool color) {
+  value = std::fmin(std::fmax(value, 0.0f), 1.0f);
+  return (uint8_t)std::lround((color ? std::sqrt(value) : value) * 255.0f);
+}
+}  // namespace
+
+texture::Id texture::Library::Add(const std::string& path, bool color) {
+  for (std::size_t i = 0; i < this->images_.size(); i++) {
+    if (this->images_[i].path == path && this->images_[i].color == color) {
+      return i;
+    }
+  }
+  if (this->images_.size() >= kNone) {
+    printf("Texture error: %s: Too many textures\n", path.c_str());
+    return kNone;
+  }
+
+  Image image;
+  image.path = path;
+  image.color = color;
+  if (!ReadImage(path, color, image.width, image.height, image.rgb)) {
+    printf("Texture error: %s: Not a binary 8-bit PPM or PFM file\n",
+           path.c_str());
+    return kNone;
+  }
+  if (std::max(image.width, image.height) > 1 << (kMaxLevels - 1)) {
+    printf("Texture error: %s: Larger than %d texels\n", path.c_str(),
+           1 << (kMaxLevels - 1));
+    return kNone;
+  }
+  this->images_.push_back(std::move(image));
+  return this->images_.size() - 1;
+}
+
+texture::HostAtlas texture::Library::Build() const {
+  HostAtlas atlas;
+  for (const Image& image : this->images_) {
+    Texture texture;
+    texture.first_level = atlas.levels.size();
+    texture.level_count = 0;
+    texture.color = image.color;
+
+    std::vector<float> rgb = image.rgb;
+    int width = image.width, height = image.height;
+    while (true) {
+      Level level;
+      level.offset = atlas.texels.size();
+      level.width = width;
+      level.height = height;
+      level.tiles_x = (width + kTileSize - 1) / kTileSize;
+      int tiles_y = (height + kTileSize - 1) / kTileSize;
+
+      /* Tiles in row major order, texels in row major order inside them.
+         Padding texels past the edges are never read */
+      atlas.texels.resize(atlas.texels.size() + (std::size_t)level.tiles_x *
+                                                    tiles_y * kTileSize *
+                                                    kTileSize,
+                          Texel{0, 0, 0, 0});
+      for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+          uint32_t tile = (y / kTileSize) * level.tiles_x + x / kTileSize;
+          const float* value = &rgb[((std::size_t)y * width + x) * 3];
+          atlas.texels[level.offset + tile * kTileSize * kTileSize +
+                       (y % kTileSize) * kTileSize + x % kTileSize] =
+              Texel{Quantize(value[0], image.color),
+                    Quantize(value[1], image.color),
+                    Quantize(value[2], image.color), 255};
+        }
+      }
+      atlas.levels.push_back(level);
+      texture.level_count++;
+
+      if (width == 1 && height == 1) break;
+      rgb = Downsample(rgb, width, height);
+      width = std::max(width / 2, 1);
+      height = std::max(height / 2, 1);
+    }
+    atlas.textures.push_back(texture);
+  }
+  return atlas;
+}
+
+/* Device copy of a host vector, `nullptr` if it is empty */
+template <typename T>
+static T* UploadVector(sycl::queue& q, const std::vector<T>& host,
+                       std::vector<sycl::event>& copies) {
+  if (host.empty()) return nullptr;
+  T* buffer = sycl::malloc_device<T>(host.size(), q);
+  copies.push_back(q.memcpy(buffer, host.data(), host.size() * sizeof(T)));
+  return buffer;
+}
+
+texture::Atlas texture::Upload(sycl::queue& q, const HostAtlas& host) {
+  std::vector<sycl::event> copies;
+  Atlas atlas;
+  atlas.texels = UploadVector(q, host.texels, copies);
+  atlas.levels = UploadVector(q, host.levels, copies);
+  atlas.textures = UploadVector(q, host.textures, copies);
+  atlas.texture_count = host.textures.size();
+  sycl::event::wait(copies);
+  return atlas;
+}
+
+void texture::Free(Atlas& atlas, sycl::queue& q) {
+  if (atlas.texels != nullptr) sycl::free(atlas.texels, q);
+  if (atlas.levels != nullptr) sycl::free(atlas.levels, q);
+  if (atlas.textures != nullptr) sycl::free(atlas.textures, q);
+  atlas = Atlas();
+}
@@ -0,0 +1,120 @@
+#include "include/tiles.h"
+
+#include <algorithm>
+
+#include "include/integrator.h"
+#include "include/utils.h"
+
+render::TileScheduler::TileScheduler(sycl::queue& q, int width, int height,
+                                     int tile_size, uint32_t workers)
+    : width_(width), height_(height), tile_size_(tile_size) {
+  uint32_t tiles_x = (width + tile_size - 1) / tile_size;
+  uint32_t tiles_y = (height + tile_size - 1) / tile_size;
+  this->tile_count_ = tiles_x * tiles_y;
+
+  std::vector<uint32_t> tiles;
+  tiles.reserve(this->tile_count_);
+  for (uint32_t y = 0; y < tiles_y; y++) {
+    for (uint32_t x = 0; x < tiles_x; x++) {
+      tiles.push_back(y << 16 | x);
+    }
+  }
+  std::sort(tiles.begin(), tiles.end(), [](uint32_t a, uint32_t b) {
+    return miscutils::Morton2D(a & 0xFFFF, a >> 16) <
+           miscutils::Morton2D(b & 0xFFFF, b >> 16);
+  });
+
+  if (workers == 0) {
+    workers = q.get_device().get_info<sycl::info::device::max_compute_units>();
+  }
+  this->workers_ = std::max(1u, std::min(workers, this->tile_count_));
+
+  /* Equal shares of the curve, the stealing evens out their cost */
+  std::vector<uint64_t> ranges(this->workers_);
+  for (uint32_t i = 0; i < this->workers_; i++) {
+    uint64_t begin = (uint64_t)this->tile_count_ * i / this->workers_;
+    uint64_t end = (uint64_t)this->tile_count_ * (i + 1) / this->workers_;
+    ranges[i] = end << 32 | begin;
+  }
+
+  this->tiles_ = sycl::malloc_device<uint32_t>(this->tile_count_, q);
+  this->ranges_ = sycl::malloc_device<uint64_t>(this->workers_, q);
+  this->initial_ranges_ = sycl::malloc_device<uint64_t>(this->workers_, q);
+  q.memcpy(this->tiles_, tiles.data(), tiles.size() * sizeof(uint32_t));
+  q.memcpy(this->initial_ranges_, ranges.data(),
+           ranges.size() * sizeof(uint64_t));
+  q.wait();
+}
+
+void render::TileScheduler::Free(sycl::queue& q) {
+  sycl::free(this->tiles_, q);
+  sycl::free(this->ranges_, q);
+  sycl::free(this->initial_ranges_, q);
+}
+
+sycl::event render::TileScheduler::RenderSamples(
+    sycl::queue& q, const Scene& scene, const Frame& frame,
+    const std::vector<sycl::event>& depends_on) {
+  if (scene.sampler == miscutils::SamplerType::kPhilox) {
+    return this->Submit<miscutils::PhiloxSampler>(q, scene, frame, depends_on);
+  }
+  return this->Submit<miscutils::SobolSampler>(q, scene, frame, depends_on);
+}
+
+template <class Sampler>
+sycl::event render::TileScheduler::Submit(
+    sycl::queue& q, const Scene& scene, const Frame& frame,
+    const std::vector<sycl::event>& depends_on) {
+  const Camera camera = *scene.camera;
+  const uint32_t* tiles = this->tiles_;
+  uint64_t* ranges = this->ranges_;
+  const uint32_t workers = this->workers_;
+  const uint32_t tile_size = this->tile_size_;
+  const uint32_t width = this->width_, height = this->height_;
+
+  /* The previous batch has emptied all ranges */
+  sycl::event restored = q.submit([&](sycl::handler& h) {
+    h.depends_on(depends_on);
+    h.memcpy(ranges, this->initial_ranges_, workers * sizeof(uint64_t));
+  });
+
+  return q.submit([&](sycl::handler& h) {
+    h.depends_on(restored);
+    h.parallel_for(sycl::nd_range<1>{sycl::range<1>{workers},
+                                     sycl::range<1>{1}},
+                   [=](sycl::nd_item<1> it) {
+      uint32_t worker = it.get_global_id(0);
+
+      /* Own range first, then the others in turn */
+      for (uint32_t k = 0; k < workers; k++) {
+        uint32_t victim = (worker + k) % workers;
+        sycl::atomic_ref<uint64_t, sycl::memory_order::relaxed,
+                         sycl::memory_scope::device,
+                         sycl::access::address_space::global_space>
+            range(ranges[victim]);
+
+        while (true) {
+          uint64_t current = range.load();
+          uint32_t begin = (uint32_t)current;
+          uint32_t end = current >> 32;
+          if (begin >= end) break;
+
+          /* Owners pop the front, thieves the back */
+          uint32_t tile = k == 0 ? begin : end - 1;
+          uint64_t taken = k == 0 ? current + 1 : current - (1ull << 32);
+          if (!range.compare_exchange_strong(current, taken)) continue;
+
+          uint32_t x0 = (tiles[tile] & 0xFFFF) * tile_size;
+          uint32_t y0 = (tiles[tile] >> 16) * tile_size;
+          uint32_t x1 = sycl::min(x0 + tile_size, width);
+          uint32_t y1 = sycl::min(y0 + tile_size, height);
+          for (uint32_t y = y0; y < y1; y++) {
+            for (uint32_t x = x0; x < x1; x++) {
+              RenderPixel<Sampler>(scene, camera, frame, x, y);
+            }
+          }
+        }
+      }
+    });
+  });
+}
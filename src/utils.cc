@@ -4,30 +4,130 @@ int miscutils::ShadowFactor(float a) {
     return a > 0 ? 1 : 0; 
 }
 
-double miscutils::XorShiftPRNG::operator()() {
-    uint64_t x = this->state_;
-    x ^= x << 13;
-    x ^= x >> 7;
-    x ^= x << 17;
+/* lowbias32 integer hash by Chris Wellons, see
+https://nullprogram.com/blog/2018/07/31/
+*/
+uint32_t miscutils::Hash32(uint32_t x) {
+  x ^= x >> 16;
+  x *= 0x7FEB352Du;
+  x ^= x >> 15;
+  x *= 0x846CA68Bu;
+  x ^= x >> 16;
+  return x;
+}
 
-    this->state_ = x;
-    return (double)(x) / (double)(0xFFFFFFFFFFFFFFFF);
+/* Spreads the lower 16 bits of `x` to the even bits */
+static uint32_t SpreadBits(uint32_t x) {
+  x &= 0xFFFFu;
+  x = (x | (x << 8)) & 0x00FF00FFu;
+  x = (x | (x << 4)) & 0x0F0F0F0Fu;
+  x = (x | (x << 2)) & 0x33333333u;
+  x = (x | (x << 1)) & 0x55555555u;
+  return x;
 }
 
-/* Big creds to:
-https://lemire.me/blog/2018/08/15/fast-strongly-universal-64-bit-hashing-everywhere/
-*/
-uint64_t miscutils::Hash64(uint64_t i) {
-    uint64_t a1 = 0x65d200ce55b19ad8;
-    uint64_t b1 = 0x4f2162926e40c299;
-    uint64_t c1 = 0x162dd799029970f8;
-    uint64_t a2 = 0x68b665e6872bd1f4;
-    uint64_t b2 = 0xb6cfcf9d79b51db2;
-    uint64_t c2 = 0x7a2b92ae912898c2;
-
-    uint32_t low = (uint32_t)i;
-    uint32_t high = i >> 32;
-
-    return ((a1 * low + b1 * high + c1) >> 32)
-        | ((a2 * low + b2 * high + c2) & 0xFFFFFFFF00000000L);
-}
\ No newline at end of file
+uint32_t miscutils::Morton2D(uint32_t x, uint32_t y) {
+  return SpreadBits(x) | (SpreadBits(y) << 1);
+}
+
+/* Upper 24 bits as a float in [0, 1) */
+static float ToUnitFloat(uint32_t x) {
+  return (x >> 8) * 0x1p-24f;
+}
+
+/* Philox4x32 with 10 rounds, Salmon et al. 2011 */
+static void Philox4x32(uint32_t counter[4], uint32_t key0, uint32_t key1) {
+  for (int round = 0; round < 10; round++) {
+    uint32_t hi0 = sycl::mul_hi(0xD2511F53u, counter[0]);
+    uint32_t lo0 = 0xD2511F53u * counter[0];
+    uint32_t hi1 = sycl::mul_hi(0xCD9E8D57u, counter[2]);
+    uint32_t lo1 = 0xCD9E8D57u * counter[2];
+    counter[0] = hi1 ^ counter[1] ^ key0;
+    counter[1] = lo1;
+    counter[2] = hi0 ^ counter[3] ^ key1;
+    counter[3] = lo0;
+    key0 += 0x9E3779B9u;
+    key1 += 0xBB67AE85u;
+  }
+}
+
+float miscutils::PhiloxSampler::operator()() {
+  uint32_t counter[4] = {this->dimension_ / 4, this->sample_, this->pixel_, 0};
+  Philox4x32(counter, 0x5EED1234u, 0xC0FFEE42u);
+  return ToUnitFloat(counter[this->dimension_++ % 4]);
+}
+
+static uint32_t ReverseBits(uint32_t x) {
+  x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+  x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+  x = ((x >> 4) & 0x0F0F0F0Fu) | ((x & 0x0F0F0F0Fu) << 4);
+  x = ((x >> 8) & 0x00FF00FFu) | ((x & 0x00FF00FFu) << 8);
+  return (x >> 16) | (x << 16);
+}
+
+/* Hash based Owen scrambling of the bits of `x` from the highest one down */
+static uint32_t NestedUniformScramble(uint32_t x, uint32_t seed) {
+  x = ReverseBits(x);
+  /* Laine-Karras style permutation */
+  x += seed;
+  x ^= x * 0x6C50B47Cu;
+  x ^= x * 0xB82F1E52u;
+  x ^= x * 0xC7AFE638u;
+  x ^= x * 0x8D22F6E6u;
+  return ReverseBits(x);
+}
+
+static uint32_t HashCombine(uint32_t seed, uint32_t value) {
+  return seed ^ (value + 0x9E3779B9u + (seed << 6) + (seed >> 2));
+}
+
+/*  Direction numbers of the first 4 Sobol dimensions from the primitive
+    polynomials x+1, x^2+x+1 and x^3+x+1 (Joe and Kuo), as 32 bit matrices */
+struct SobolDirections {
+  uint32_t v[4][32];
+
+  constexpr SobolDirections() : v() {
+    const uint32_t degree[4] = {0, 1, 2, 3};
+    const uint32_t coefficients[4] = {0, 0, 1, 1};
+    const uint32_t initial[4][3] = {{0, 0, 0}, {1, 0, 0}, {1, 3, 0}, {1, 3, 1}};
+
+    for (int bit = 0; bit < 32; bit++) {
+      this->v[0][bit] = 1u << (31 - bit);
+    }
+    for (int d = 1; d < 4; d++) {
+      uint32_t s = degree[d];
+      for (uint32_t bit = 0; bit < 32; bit++) {
+        if (bit < s) {
+          this->v[d][bit] = initial[d][bit] << (31 - bit);
+          continue;
+        }
+        uint32_t value = this->v[d][bit - s] ^ (this->v[d][bit - s] >> s);
+        for (uint32_t k = 1; k < s; k++) {
+          value ^= ((coefficients[d] >> (s - 1 - k)) & 1u) *
+                   this->v[d][bit - k];
+        }
+        this->v[d][bit] = value;
+      }
+    }
+  }
+};
+
+static constexpr SobolDirections kSobolDirections{};
+
+static uint32_t Sobol(uint32_t index, int dimension) {
+  uint32_t x = 0;
+  for (int bit = 0; index != 0; bit++, index >>= 1) {
+    x ^= (index & 1u) * kSobolDirections.v[dimension][bit];
+  }
+  return x;
+}
+
+float miscutils::SobolSampler::operator()() {
+  uint32_t group = this->dimension_ / 4;
+  int lane = this->dimension_++ % 4;
+
+  uint32_t seed = Hash32(HashCombine(Hash32(this->pixel_), group));
+  uint32_t index = NestedUniformScramble(this->sample_, seed);
+  return ToUnitFloat(
+      NestedUniformScramble(Sobol(index, lane), HashCombine(seed, lane)));
+}
@@ -0,0 +1,359 @@
+#include "include/wavefront.h"
+
+#include "include/integrator.h"
+
+/* Launch range covering `count` work items of a 1D queue kernel */
+static sycl::nd_range<1> QueueRange(uint32_t count) {
+  std::size_t groups = (count + kWavefrontGroupSize - 1) / kWavefrontGroupSize;
+  return sycl::nd_range<1>{sycl::range<1>{groups * kWavefrontGroupSize},
+                           sycl::range<1>{kWavefrontGroupSize}};
+}
+
+render::Wavefront::Wavefront(sycl::queue& q, int width, int height,
+                             bool sort_rays)
+    : width_(width), height_(height) {
+  std::size_t paths = (std::size_t)width * height;
+
+  this->rays_ = sycl::malloc_device<Ray>(paths, q);
+  this->throughput_ = sycl::malloc_device<sycl::vec<float, 3>>(paths, q);
+  this->dimensions_ = sycl::malloc_device<uint32_t>(paths, q);
+  this->radiance_ = sycl::malloc_device<sycl::vec<float, 3>>(paths, q);
+  this->features_ = sycl::malloc_device<Features>(paths, q);
+  this->counters_ = sycl::malloc_device<stats::Counters>(paths, q);
+  this->hits_ = sycl::malloc_device<std::optional<Intersector>>(paths, q);
+
+  this->queues_[0] = sycl::malloc_device<uint32_t>(paths, q);
+  this->queues_[1] = sycl::malloc_device<uint32_t>(paths, q);
+  this->queue_sizes_ = sycl::malloc_shared<uint32_t>(2, q);
+  for (uint32_t*& queue : this->family_queues_) {
+    queue = sycl::malloc_device<uint32_t>(paths, q);
+  }
+  this->family_sizes_ = sycl::malloc_shared<uint32_t>(material::kFamilyCount,
+                                                      q);
+  if (sort_rays) {
+    this->sort_keys_ = sycl::malloc_device<uint32_t>(paths, q);
+    this->sorted_ = sycl::malloc_device<uint32_t>(paths, q);
+    this->sort_bins_ = sycl::malloc_device<uint32_t>(kRaySortBins, q);
+  }
+}
+
+void render::Wavefront::Free(sycl::queue& q) {
+  sycl::free(this->rays_, q);
+  sycl::free(this->throughput_, q);
+  sycl::free(this->dimensions_, q);
+  sycl::free(this->radiance_, q);
+  sycl::free(this->features_, q);
+  sycl::free(this->counters_, q);
+  sycl::free(this->hits_, q);
+  sycl::free(this->queues_[0], q);
+  sycl::free(this->queues_[1], q);
+  sycl::free(this->queue_sizes_, q);
+  for (uint32_t* queue : this->family_queues_) {
+    sycl::free(queue, q);
+  }
+  sycl::free(this->family_sizes_, q);
+  if (this->sort_keys_ != nullptr) {
+    sycl::free(this->sort_keys_, q);
+    sycl::free(this->sorted_, q);
+    sycl::free(this->sort_bins_, q);
+  }
+}
+
+sycl::event render::Wavefront::RenderSamples(
+    sycl::queue& q, const Scene& scene, const Frame& frame,
+    const std::vector<sycl::event>& depends_on) {
+  if (scene.sampler == miscutils::SamplerType::kPhilox) {
+    return this->Submit<miscutils::PhiloxSampler>(q, scene, frame, depends_on);
+  }
+  return this->Submit<miscutils::SobolSampler>(q, scene, frame, depends_on);
+}
+
+template <material::Family F, class Sampler>
+sycl::event render::Wavefront::SubmitShade(sycl::queue& q, const Scene& scene,
+                                           uint32_t sample, uint32_t bound,
+                                           uint32_t* out, uint32_t* out_size,
+                                           sycl::event extended) {
+  const uint32_t* in = this->family_queues_[(int)F];
+  const uint32_t* in_size = &this->family_sizes_[(int)F];
+  Ray* rays = this->rays_;
+  sycl::vec<float, 3>* throughput = this->throughput_;
+  uint32_t* dimensions = this->dimensions_;
+  sycl::vec<float, 3>* radiance = this->radiance_;
+  const std::optional<Intersector>* hits = this->hits_;
+
+  return q.submit([&](sycl::handler& h) {
+    h.depends_on(extended);
+    h.parallel_for(QueueRange(bound), [=](sycl::nd_item<1> it) {
+      uint32_t i = it.get_global_id(0);
+      if (i >= *in_size) return;
+
+      uint32_t path = in[i];
+      Sampler random(path, sample, dimensions[path]);
+      bool alive = ShadeFamily<F>(scene, random, *hits[path], rays[path],
+                                  throughput[path], radiance[path]);
+      dimensions[path] = random.Dimension();
+      if (!alive) return;
+
+      sycl::atomic_ref<uint32_t, sycl::memory_order::relaxed,
+                       sycl::memory_scope::device,
+                       sycl::access::address_space::global_space>
+          size(*out_size);
+      out[size.fetch_add(1u)] = path;
+    });
+  });
+}
+
+/*  Octant of the ray direction above the Morton code of the origin cell,
+    origins outside `bounds` are clamped to its border cells */
+static uint32_t SortKey(const Ray& ray, const bvh::AABB& bounds) {
+  const uint32_t cells = 1u << kRaySortCellBits;
+  sycl::vec<float, 3> extent = sycl::fmax(bounds.max - bounds.min,
+                                          sycl::vec<float, 3>{1e-6f});
+  sycl::vec<float, 3> relative = (ray.origin - bounds.min) / extent;
+
+  uint32_t key = 0;
+  for (int bit = kRaySortCellBits - 1; bit >= 0; bit--) {
+    for (int axis = 0; axis < 3; axis++) {
+      uint32_t cell = (uint32_t)sycl::clamp(relative[axis] * cells, 0.0f,
+                                            cells - 1.0f);
+      key = key << 1 | ((cell >> bit) & 1u);
+    }
+  }
+  uint32_t octant = (ray.dir.x() < 0.0f ? 1u : 0u) |
+                    (ray.dir.y() < 0.0f ? 2u : 0u) |
+                    (ray.dir.z() < 0.0f ? 4u : 0u);
+  return octant << (3 * kRaySortCellBits) | key;
+}
+
+sycl::event render::Wavefront::SortQueue(sycl::queue& q,
+                                         const bvh::AABB& bounds,
+                                         const uint32_t* queue,
+                                         uint32_t count) {
+  const Ray* rays = this->rays_;
+  uint32_t* keys = this->sort_keys_;
+  uint32_t* sorted = this->sorted_;
+  uint32_t* bins = this->sort_bins_;
+
+  sycl::event cleared = q.fill(bins, 0u, kRaySortBins);
+
+  /* Histogram of the keys */
+  sycl::event counted = q.submit([&](sycl::handler& h) {
+    h.depends_on(cleared);
+    h.parallel_for(QueueRange(count), [=](sycl::nd_item<1> it) {
+      uint32_t i = it.get_global_id(0);
+      if (i >= count) return;
+
+      uint32_t key = SortKey(rays[queue[i]], bounds);
+      keys[i] = key;
+      sycl::atomic_ref<uint32_t, sycl::memory_order::relaxed,
+                       sycl::memory_scope::device,
+                       sycl::access::address_space::global_space>(bins[key])
+          .fetch_add(1u);
+    });
+  });
+
+  /* Exclusive prefix sum, the bins are few enough for a single work item */
+  sycl::event scanned = q.submit([&](sycl::handler& h) {
+    h.depends_on(counted);
+    h.single_task([=]() {
+      uint32_t sum = 0;
+      for (uint32_t b = 0; b < kRaySortBins; b++) {
+        uint32_t size = bins[b];
+        bins[b] = sum;
+        sum += size;
+      }
+    });
+  });
+
+  /* Scatter every path to the next free slot of its key */
+  return q.submit([&](sycl::handler& h) {
+    h.depends_on(scanned);
+    h.parallel_for(QueueRange(count), [=](sycl::nd_item<1> it) {
+      uint32_t i = it.get_global_id(0);
+      if (i >= count) return;
+
+      sycl::atomic_ref<uint32_t, sycl::memory_order::relaxed,
+                       sycl::memory_scope::device,
+                       sycl::access::address_space::global_space>
+          slot(bins[keys[i]]);
+      sorted[slot.fetch_add(1u)] = queue[i];
+    });
+  });
+}
+
+/*  Paths only keep the next dimension of their sampler, the sampler itself is
+    rebuilt from pixel, sample and dimension in every shade kernel */
+template <class Sampler>
+sycl::event render::Wavefront::Submit(
+    sycl::queue& q, const Scene& scene, const Frame& frame,
+    const std::vector<sycl::event>& depends_on) {
+  const Camera camera = *scene.camera;
+  Ray* rays = this->rays_;
+  sycl::vec<float, 3>* throughput = this->throughput_;
+  uint32_t* dimensions = this->dimensions_;
+  sycl::vec<float, 3>* radiance = this->radiance_;
+  Features* features = this->features_;
+  stats::Counters* counters = this->counters_;
+  std::optional<Intersector>* hits = this->hits_;
+  uint32_t* queue_sizes = this->queue_sizes_;
+  uint32_t* family_sizes = this->family_sizes_;
+  const int width = this->width_;
+
+  /* Ray origins are binned inside the bounded objects */
+  bvh::AABB bounds;
+  if (scene.bvh.tree.node_count > 0) {
+    const bvh::Node& root = scene.bvh.tree.nodes[0];
+    bounds = bvh::AABB({root.min[0], root.min[1], root.min[2]},
+                       {root.max[0], root.max[1], root.max[2]});
+  }
+
+  sycl::range<2> global_range{(size_t)this->width_, (size_t)this->height_};
+  sycl::range<2> local_range{kAABlockWidth, kAABlockHeight};
+
+  /*  Stages are chained on events. The host only waits for the shade
+      kernels of a bounce, to size the launches of the next one by the
+      number of surviving paths */
+  std::vector<sycl::event> last = depends_on;
+  for (int s = 0; s < kSamplesPerPixel; s++) {
+    const uint32_t sample = frame.total_executed_samples + s;
+    uint32_t* queue = this->queues_[0];
+
+    /* Generate: camera rays for every pixel that is sampled. Overwrites the
+       path state the accumulation of the previous batch may still read.
+       With skipped tiles the queue length is counted on the device */
+    uint32_t* generated = &queue_sizes[0];
+    *generated = frame.active_tiles == nullptr
+                     ? this->width_ * this->height_ : 0;
+    sycl::event step = q.submit([&](sycl::handler& h) {
+      h.depends_on(last);
+      h.parallel_for(sycl::nd_range{global_range, local_range},
+                     [=](sycl::nd_item<2> it) {
+        auto w = it.get_global_id(0);
+        auto h = it.get_global_id(1);
+        uint32_t path = width * h + w;
+
+        if (s == 0) {
+          radiance[path] = sycl::vec<float, 3>{0.0f, 0.0f, 0.0f};
+          features[path] = Features();
+          counters[path] = stats::Counters();
+        }
+        if (!PixelActive(frame, w, h)) {
+          return;
+        }
+
+        Sampler random(path, sample);
+        Ray ray;
+        float x = random(), y = random();
+        camera.GenerateRay(w + x, h + y, ray);
+        random.NextGroup();
+#ifdef PATHTRACER_STATS
+        ray.counters = &counters[path];
+#endif
+        rays[path] = ray;
+        throughput[path] = sycl::vec<float, 3>{1.0f, 1.0f, 1.0f};
+        dimensions[path] = random.Dimension();
+        if (frame.active_tiles == nullptr) {
+          queue[path] = path;
+          return;
+        }
+
+        /* Only sampled pixels are queued when tiles are skipped */
+        sycl::atomic_ref<uint32_t, sycl::memory_order::relaxed,
+                         sycl::memory_scope::device,
+                         sycl::access::address_space::global_space>
+            size(*generated);
+        queue[size.fetch_add(1u)] = path;
+      });
+    });
+
+    /* Upper bound of the paths in the current queue, exact after the first
+       bounce */
+    uint32_t count = this->width_ * this->height_;
+    int current = 0;
+    const uint32_t* in = this->queues_[0];
+    const uint32_t* in_size = generated;
+    while (count > 0) {
+      uint32_t* out = this->queues_[1 - current];
+      uint32_t* out_size = &queue_sizes[1 - current];
+      *out_size = 0;
+
+      /* Extend: closest hit of every live path. Misses are finished right
+         away, hits are sorted by the family they are shaded with */
+      uint32_t* families[material::kFamilyCount];
+      for (int f = 0; f < material::kFamilyCount; f++) {
+        families[f] = this->family_queues_[f];
+        family_sizes[f] = 0;
+      }
+      sycl::event extended = q.submit([&](sycl::handler& h) {
+        h.depends_on(step);
+        h.parallel_for(QueueRange(count), [=](sycl::nd_item<1> it) {
+          uint32_t i = it.get_global_id(0);
+          if (i >= *in_size) return;
+
+          uint32_t path = in[i];
+          const Ray& ray = rays[path];
+          std::optional<Intersector> hit =
+              closest_obj(ray, *scene.objects, scene.bvh);
+          if (ray.depth == 0 && frame.albedo != nullptr) {
+            AddFeatures(scene, hit, ray, features[path]);
+          }
+          if (!hit.has_value()) {
+            radiance[path] += throughput[path]*Background(scene, ray);
+            return;
+          }
+          hits[path] = hit;
+
+          int family = (int)HitFamily(scene, *hit, ray);
+          sycl::atomic_ref<uint32_t, sycl::memory_order::relaxed,
+                           sycl::memory_scope::device,
+                           sycl::access::address_space::global_space>
+              size(family_sizes[family]);
+          families[family][size.fetch_add(1u)] = path;
+        });
+      });
+
+      /* Shade: contributions and continuation rays, one kernel without
+         material branches per family. The family queue lengths are only
+         known on the device, every kernel covers the whole bound and its
+         surplus work items return at once. Survivors are compacted into the
+         next queue */
+      using material::Family;
+      std::vector<sycl::event> shaded = {
+          this->SubmitShade<Family::kDiffuse, Sampler>(q, scene, sample, count,
+                                                       out, out_size, extended),
+          this->SubmitShade<Family::kMetal, Sampler>(q, scene, sample, count,
+                                                     out, out_size, extended),
+          this->SubmitShade<Family::kDielectric, Sampler>(
+              q, scene, sample, count, out, out_size, extended),
+          this->SubmitShade<Family::kEmissive, Sampler>(
+              q, scene, sample, count, out, out_size, extended)};
+      sycl::event::wait_and_throw(shaded);
+
+      count = *out_size;
+      current = 1 - current;
+      in = out;
+      in_size = out_size;
+      step = sycl::event();
+      if (this->sort_keys_ != nullptr && count >= kRaySortMinPaths &&
+          scene.bvh.tree.node_count > 0) {
+        step = this->SortQueue(q, bounds, out, count);
+        in = this->sorted_;
+      }
+    }
+    last = {step};
+  }
+
+  /* Accumulate: finished samples into the frame */
+  return q.submit([&](sycl::handler& h) {
+    h.depends_on(last);
+    h.parallel_for(sycl::nd_range{global_range, local_range},
+                   [=](sycl::nd_item<2> it) {
+      auto w = it.get_global_id(0);
+      auto h = it.get_global_id(1);
+      uint32_t path = width * h + w;
+
+      AccumulatePixel(frame, path, PixelActive(frame, w, h), radiance[path],
+                      features[path], counters[path]);
+    });
+  });
+}
@@ -0,0 +1,270 @@
+/*  Scene converter. Reads a text scene description, loads the referenced OBJ
+    files, builds all acceleration structures and writes the result as a
+    precompiled scene file that the tracer loads without any parsing:
+
+      pathtracer_convert assets/scenes/cornell-box.txt cornell-box.ptscene
+      pathtracer --scene cornell-box.ptscene
+
+    The description has one statement per line, `#` starts a comment.
+    Positions are in the Z-up world of the tracer, OBJ files are Y-up and get
+    rotated on load, see `Mesh::Load`:
+
+      camera    ox oy oz  dx dy dz  fov
+      material  NAME  r g b  metallic roughness emission  [glass IOR]
+                [albedo PATH]  [roughness PATH]  [metallic PATH]
+      sphere    x y z  radius  MATERIAL
+      plane     px py pz  nx ny nz  MATERIAL
+      obj       PATH  tx ty tz
+      geometry  NAME  PATH
+      instance  NAME  tx ty tz  rx ry rz  scale
+
+    Materials are shaded by family: emissive if they emit, glass with the
+    given index of refraction, metal if at least half metallic and diffuse
+    otherwise, see `material::FamilyOf`. Texture maps multiply the base
+    color, the roughness and the metallic parameter, a metallic map switches
+    between diffuse and metal per texel. Maps are binary PPM or
+    PFM images, see `texture::Library`. Spheres are textured by latitude and
+    longitude, planes repeat the texture every unit. OBJ and texture paths
+    are relative to the description. The MTL materials of an OBJ file are
+    added to the scene with their `map_Kd`, `map_Pr` and `map_Pm` textures,
+    its faces reference those. `geometry` loads an OBJ file once without
+    placing it, every `instance` of it then places the same triangles
+    scaled, rotated by rx, ry and rz degrees around the X, Y and Z axes and
+    moved */
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sycl/sycl.hpp>
+
+#include "include/camera.h"
+#include "include/material.h"
+#include "include/object.h"
+#include "include/render.h"
+#include "include/scene_file.h"
+#include "include/texture.h"
+
+namespace {
+/* Scene assembled from a description, everything in shared memory */
+struct ConvertedScene {
+  std::optional<Camera> camera;
+  std::vector<Material> materials;
+  std::map<std::string, material::Id> material_ids;
+  texture::Library textures;
+  /* Meshes shared by instances */
+  std::vector<Mesh> geometries;
+  std::map<std::string, uint32_t> geometry_ids;
+  containerutils::VariantContainer<Objects>* objects;
+};
+
+void PrintUsage(const char* program) {
+  printf("Usage: %s DESCRIPTION OUTPUT\n"
+         "  DESCRIPTION         Text scene description, see tools/convert.cc\n"
+         "  OUTPUT              Scene file for `pathtracer --scene`\n",
+         program);
+}
+
+/* Directory part of `path` including the trailing slash, empty if none */
+std::string Directory(const std::string& path) {
+  std::size_t slash = path.find_last_of('/');
+  return slash == std::string::npos ? "" : path.substr(0, slash + 1);
+}
+
+/*  Executes one statement of the description. Prints the reason and returns
+    false on invalid statements */
+bool ParseStatement(sycl::queue& q, const std::string& directory,
+                    std::istringstream& line, ConvertedScene& scene) {
+  std::string keyword;
+  line >> keyword;
+
+  auto material = [&scene](const std::string& name, material::Id& id) {
+    auto it = scene.material_ids.find(name);
+    if (it == scene.material_ids.end()) {
+      printf("Unknown material %s\n", name.c_str());
+      return false;
+    }
+    id = it->second;
+    return true;
+  };
+
+  float x, y, z, a, b, c, value;
+  std::string name;
+  material::Id id;
+  if (keyword == "camera") {
+    if (!(line >> x >> y >> z >> a >> b >> c >> value)) return false;
+    scene.camera.emplace(sycl::vec<float, 3>(a, b, c),
+                         sycl::vec<float, 3>(x, y, z),
+                         sycl::vec<float, 3>(0.0f, 0.0f, 1.0f), value, 1.0f,
+                         kImageWidth, kImageHeight);
+  } else if (keyword == "material") {
+    float metallic, roughness;
+    if (!(line >> name >> x >> y >> z >> metallic >> roughness >> value)) {
+      return false;
+    }
+    if (scene.materials.size() >= material::kMaxMaterials) {
+      printf("Too many materials\n");
+      return false;
+    }
+    /* Optionally followed by `glass IOR` and texture maps */
+    std::string option, path;
+    float ior = 0.0f;
+    texture::Id maps[3] = {texture::kNone, texture::kNone, texture::kNone};
+    const char* kMapNames[3] = {"albedo", "roughness", "metallic"};
+    while (line >> option) {
+      if (option == "glass") {
+        if (!(line >> ior) || ior <= 1.0f) return false;
+        continue;
+      }
+      int map = std::find(kMapNames, kMapNames + 3, option) - kMapNames;
+      if (map == 3 || !(line >> path)) return false;
+      maps[map] = scene.textures.Add(
+          path[0] == '/' ? path : directory + path, map == 0);
+      if (maps[map] == texture::kNone) return false;
+    }
+    Material material(sycl::vec<float, 3>{x, y, z}, metallic, roughness,
+                      ior > 0.0f,
+                      ior > 0.0f ? material::ReflectanceForIor(ior) : 0.0f,
+                      value);
+    material.albedo_texture = maps[0];
+    material.roughness_texture = maps[1];
+    material.metallic_texture = maps[2];
+    scene.material_ids[name] = scene.materials.size();
+    scene.materials.push_back(material);
+  } else if (keyword == "sphere") {
+    if (!(line >> x >> y >> z >> value >> name) || !material(name, id)) {
+      return false;
+    }
+    scene.objects->push_back(q,
+                             Sphere(sycl::vec<float, 3>(x, y, z), value, id));
+  } else if (keyword == "plane") {
+    if (!(line >> x >> y >> z >> a >> b >> c >> name) || !material(name, id)) {
+      return false;
+    }
+    scene.objects->push_back(
+        q, Plane(sycl::vec<float, 3>(x, y, z),
+                 sycl::normalize(sycl::vec<float, 3>(a, b, c)), id));
+  } else if (keyword == "obj") {
+    if (!(line >> name >> x >> y >> z)) return false;
+    std::optional<Mesh> mesh =
+        Mesh::Load(q, name[0] == '/' ? name : directory + name,
+                   scene.materials, scene.textures,
+                   sycl::vec<float, 3>(x, y, z));
+    if (!mesh.has_value()) return false;
+    scene.objects->push_back(q, *mesh);
+  } else if (keyword == "geometry") {
+    std::string path;
+    if (!(line >> name >> path)) return false;
+    if (scene.geometry_ids.count(name) > 0) {
+      printf("Geometry %s defined twice\n", name.c_str());
+      return false;
+    }
+    std::optional<Mesh> mesh =
+        Mesh::Load(q, path[0] == '/' ? path : directory + path,
+                   scene.materials, scene.textures,
+                   sycl::vec<float, 3>(0.0f, 0.0f, 0.0f));
+    if (!mesh.has_value()) return false;
+    scene.geometry_ids[name] = scene.geometries.size();
+    scene.geometries.push_back(*mesh);
+  } else if (keyword == "instance") {
+    if (!(line >> name >> x >> y >> z >> a >> b >> c >> value)) return false;
+    auto it = scene.geometry_ids.find(name);
+    if (it == scene.geometry_ids.end()) {
+      printf("Unknown geometry %s\n", name.c_str());
+      return false;
+    }
+    if (!(value > 0.0f)) {
+      printf("Instance scale has to be positive\n");
+      return false;
+    }
+    scene.objects->push_back(q, Instance(
+        scene.geometries[it->second], it->second,
+        Transform::Compose(sycl::vec<float, 3>(x, y, z),
+                           sycl::vec<float, 3>(a, b, c), value)));
+  } else {
+    printf("Unknown statement %s\n", keyword.c_str());
+    return false;
+  }
+  return true;
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc != 3) {
+    PrintUsage(argv[0]);
+    return -1;
+  }
+  const std::string input = argv[1], output = argv[2];
+
+  std::ifstream description(input);
+  if (!description) {
+    printf("Cannot open %s\n", input.c_str());
+    return -1;
+  }
+
+  sycl::queue q;
+  auto start = std::chrono::steady_clock::now();
+
+  ConvertedScene scene;
+  scene.objects =
+      sycl::malloc_shared<containerutils::VariantContainer<Objects>>(1, q);
+  new (scene.objects) containerutils::VariantContainer<Objects>();
+
+  bool ok = true;
+  std::string text;
+  for (int number = 1; ok && std::getline(description, text); number++) {
+    text = text.substr(0, text.find('#'));
+    if (text.find_first_not_of(" \t\r") == std::string::npos) continue;
+
+    std::istringstream line(text);
+    ok = ParseStatement(q, Directory(input), line, scene);
+    if (!ok) {
+      printf("%s:%d: Invalid statement: %s\n", input.c_str(), number,
+             text.c_str());
+    }
+  }
+
+  if (ok && !scene.camera.has_value()) {
+    /* Same default view as the built-in scene */
+    scene.camera.emplace(sycl::vec<float, 3>(1.0f, 0.0f, 0.0f),
+                         sycl::vec<float, 3>(0.0f, 0.0f, 0.0f),
+                         sycl::vec<float, 3>(0.0f, 0.0f, 1.0f), 90.0f, 1.0f,
+                         kImageWidth, kImageHeight);
+  }
+
+  SceneBVH bvh;
+  if (ok) {
+    bvh = BuildSceneBVH(q, *scene.objects);
+    ok = SceneFile::Write(output, *scene.camera, scene.materials,
+                          scene.textures.Build(), scene.geometries,
+                          *scene.objects, bvh);
+    FreeSceneBVH(bvh, q);
+  }
+
+  if (ok) {
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    printf("Wrote %zu objects, %zu shared geometries and %zu materials to %s "
+           "in %.3f s\n", scene.objects->size(), scene.geometries.size(),
+           scene.materials.size(), output.c_str(), seconds);
+  }
+
+  scene.objects->forEach([&q](const auto& obj) {
+    if constexpr (std::is_same_v<std::decay_t<decltype(obj)>, Mesh>) {
+      Mesh mesh = obj;
+      mesh.Free(q);
+    }
+  });
+  for (Mesh& mesh : scene.geometries) {
+    mesh.Free(q);
+  }
+  scene.objects->Free(q);
+  sycl::free(scene.objects, q);
+  return ok ? 0 : -1;
+}